@@ -1,11 +1,549 @@
 ﻿#include <iostream>
 #include <cassert>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <charconv>
+#include <clocale>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <cstdint>
+#include <cctype>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <span>
+#include <map>
+#include <tuple>
+#include <cfloat>
+#include <climits>
+#include <limits>
+#include <set>
+#include <typeinfo>
+#include <type_traits>
+#include <complex>
+#include <bit>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <sys/uio.h>
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define LR6_IO_URING // асинхронный ввод-вывод через io_uring
+#endif
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#define LR6_PERF_EVENTS // аппаратные счётчики через perf_event_open
+#endif
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LR6_NOINLINE __declspec(noinline)
+#elif defined(__GNUC__)
+#define LR6_NOINLINE __attribute__((noinline))
+#else
+#define LR6_NOINLINE
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LR6_SSE2 // сканер CSV использует 128-битные сравнения, приближённый atan2 — пары double
+#endif
 
 struct Expression;
 struct Number;
 struct BinaryOperation;
 struct FunctionCall;
 struct Variable;
+struct Comparison;
+struct Select;
+struct MinMax;
+struct Negate;
+struct IntPower;
+struct Sum;
+struct IndexedVariable;
+struct Dot;
+
+// Профиль вычислений по дереву: с LR6_INSTRUMENT (например, -DLR6_INSTRUMENT) каждый evaluate
+// считается по виду узла, а в среднем каждое SAMPLE-е вычисление замеряется в тактах rdtsc
+// вместе с потомками. Промежутки между замерами случайны: при постоянном шаге в дереве с числом
+// узлов, кратным шагу, замерялись бы одни и те же узлы. Без макроса LR6_EVALUATION пуст и не
+// порождает ни одной команды.
+#ifdef LR6_INSTRUMENT
+#if !defined(_MSC_VER) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+struct EvaluationProfile { // счётчики текущего потока
+	enum { NUMBER, VARIABLE, PLUS, MINUS, MUL, DIV, FUNCTION, COMPARISON = FUNCTION + 8, SELECT, MINMAX, NEGATE, INT_POWER,
+		SUM, ELEMENT, DOT, KINDS }; // у FunctionCall вид FUNCTION + номер функции
+	static unsigned const SAMPLE = 64;
+
+	struct NodeCost { // замеры одного узла
+		int kind;
+		std::uint64_t samples, cycles; // тактов во всех замерах, с потомками
+	};
+
+	std::uint64_t counts[KINDS]; // вычислений
+	std::uint64_t samples[KINDS], cycles[KINDS];
+	std::map<Expression const*, NodeCost> nodes; // узлы должны быть живы до отчёта
+	unsigned countdown; // вычислений до следующего замера
+	std::uint32_t random; // xorshift32 для промежутков
+
+	EvaluationProfile() { reset(); }
+	void reset() {
+		for (int k = 0; k < KINDS; ++k)
+			counts[k] = samples[k] = cycles[k] = 0;
+		nodes.clear();
+		random = 2463534242u;
+		countdown = SAMPLE;
+	}
+	bool sample() { // попадает ли очередное вычисление в выборку; промежутки от 1 до 2 SAMPLE - 1
+		if (--countdown)
+			return false;
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		countdown = 1 + random % (2 * SAMPLE - 1);
+		return true;
+	}
+	static EvaluationProfile& current() {
+		thread_local EvaluationProfile profile;
+		return profile;
+	}
+	static std::uint64_t now() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()); // нет rdtsc — тики часов
+#endif
+	}
+	static int binaryKind(int op) { return op == '+' ? PLUS : op == '-' ? MINUS : op == '*' ? MUL : DIV; }
+};
+
+struct EvaluationSample { // один вызов evaluate: счётчик сразу, такты — в деструкторе, если вызов попал в выборку
+	EvaluationSample(Expression const* node, int kind) : node_(node), kind_(kind), start_(0) {
+		EvaluationProfile& profile = EvaluationProfile::current();
+		++profile.counts[kind];
+		if (profile.sample())
+			start_ = EvaluationProfile::now();
+	}
+	~EvaluationSample() {
+		if (!start_)
+			return;
+		std::uint64_t spent = EvaluationProfile::now() - start_;
+		EvaluationProfile& profile = EvaluationProfile::current();
+		++profile.samples[kind_];
+		profile.cycles[kind_] += spent;
+		EvaluationProfile::NodeCost& cost = profile.nodes[node_];
+		cost.kind = kind_;
+		++cost.samples;
+		cost.cycles += spent;
+	}
+
+private:
+	Expression const* node_;
+	int kind_;
+	std::uint64_t start_;
+};
+#define LR6_EVALUATION(kind) EvaluationSample lr6Sample(this, EvaluationProfile::kind)
+#else
+#define LR6_EVALUATION(kind) ((void)0)
+#endif
+
+// Учёт выделений памяти под узлы деревьев: Expression::operator new и delete считают узлы и их
+// байты в текущем потоке. Считаются только сами узлы — имена и векторы аргументов внутри узлов
+// нет. Узел, созданный в одном потоке и удалённый в другом, уменьшает живые байты второго.
+struct AllocationStats {
+	std::uint64_t allocations, frees; // узлов создано и удалено
+	std::uint64_t allocatedBytes, freedBytes;
+	std::int64_t liveBytes; // allocatedBytes - freedBytes
+	std::int64_t peakBytes; // наибольшее liveBytes (внутри AllocationScope — с начала области)
+
+	AllocationStats() : allocations(0), frees(0), allocatedBytes(0), freedBytes(0), liveBytes(0), peakBytes(0) {}
+	void allocated(size_t size) {
+		++allocations;
+		allocatedBytes += size;
+		liveBytes += static_cast<std::int64_t>(size);
+		if (liveBytes > peakBytes)
+			peakBytes = liveBytes;
+	}
+	void freed(size_t size) {
+		++frees;
+		freedBytes += size;
+		liveBytes -= static_cast<std::int64_t>(size);
+	}
+	static AllocationStats& current() { // счётчики текущего потока с его начала
+		thread_local AllocationStats stats;
+		return stats;
+	}
+};
+
+struct AllocationScope { // выделения текущего потока за время жизни области; области можно вкладывать
+	AllocationScope() : start_(AllocationStats::current()) {
+		AllocationStats::current().peakBytes = start_.liveBytes; // пик области отсчитывается заново
+	}
+	~AllocationScope() {
+		AllocationStats& now = AllocationStats::current();
+		if (now.peakBytes < start_.peakBytes) // внешней области и потоку возвращается их пик
+			now.peakBytes = start_.peakBytes;
+	}
+	AllocationStats delta() const { // liveBytes — сколько осталось, peakBytes — наибольший прирост над началом
+		AllocationStats const& now = AllocationStats::current();
+		AllocationStats d;
+		d.allocations = now.allocations - start_.allocations;
+		d.frees = now.frees - start_.frees;
+		d.allocatedBytes = now.allocatedBytes - start_.allocatedBytes;
+		d.freedBytes = now.freedBytes - start_.freedBytes;
+		d.liveBytes = now.liveBytes - start_.liveBytes;
+		d.peakBytes = now.peakBytes - start_.liveBytes;
+		return d;
+	}
+
+private:
+	AllocationStats start_;
+};
+
+// Трассировка этапов конвейера (разбор, проходы Transformer, компиляция, вычисление):
+// TraceSpan записывает начало и длительность этапа в кольцевой буфер своего потока — пишет
+// только поток-владелец, без блокировок. writeChromeTrace выгружает буферы всех потоков в JSON
+// формата Chrome trace (chrome://tracing, ui.perfetto.dev). Пока Trace::enable не вызван,
+// TraceSpan только читает флаг.
+struct TraceEvent {
+	char const* name; // строковая константа: хранится только указатель
+	std::uint64_t start, duration; // наносекунды от Trace::enable
+};
+
+struct TraceSlot { // ячейка кольца: поля атомарны, выгрузка читает их одновременно с записью
+	std::atomic<char const*> name;
+	std::atomic<std::uint64_t> start, duration;
+};
+
+// Кольцо событий одного потока; при переполнении затираются самые старые. Чтение — как у
+// seqlock: ограда release перед записью ячейки в push и ограда acquire после чтения ячеек в
+// load гарантируют, что если читатель увидел хоть одно поле новой записи, то и written не
+// меньше её номера — тогда ячейка отбрасывается как затёртая.
+struct TraceBuffer {
+	static size_t const CAPACITY = size_t(1) << 14;
+	TraceSlot events[CAPACITY];
+	std::atomic<std::uint64_t> written; // всего записано событий; запись публикуется release
+	unsigned thread; // номер потока в трассе
+
+	explicit TraceBuffer(unsigned id) : written(0), thread(id) {}
+	void push(TraceEvent const& event) {
+		std::uint64_t n = written.load(std::memory_order_relaxed);
+		TraceSlot& slot = events[n % CAPACITY];
+		std::atomic_thread_fence(std::memory_order_release); // номер n виден раньше новой ячейки
+		slot.name.store(event.name, std::memory_order_relaxed);
+		slot.start.store(event.start, std::memory_order_relaxed);
+		slot.duration.store(event.duration, std::memory_order_relaxed);
+		written.store(n + 1, std::memory_order_release);
+	}
+	// события, которые точно целы на момент чтения, по порядку записи
+	void load(std::vector<TraceEvent>& out) const {
+		std::uint64_t end = written.load(std::memory_order_acquire);
+		std::uint64_t begin = end > CAPACITY ? end - CAPACITY : 0;
+		std::vector<TraceEvent> copy;
+		for (std::uint64_t i = begin; i < end; ++i) {
+			TraceSlot const& slot = events[i % CAPACITY];
+			copy.push_back(TraceEvent{ slot.name.load(std::memory_order_relaxed), slot.start.load(std::memory_order_relaxed),
+				slot.duration.load(std::memory_order_relaxed) });
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		std::uint64_t after = written.load(std::memory_order_relaxed);
+		// запись номер after может идти прямо сейчас в ячейку события after - CAPACITY
+		std::uint64_t valid = after >= CAPACITY ? after - CAPACITY + 1 : 0;
+		out.clear();
+		for (std::uint64_t i = begin < valid ? valid : begin; i < end; ++i)
+			out.push_back(copy[i - begin]);
+	}
+};
+
+struct Trace {
+	static void enable() { // начало отсчёта задаётся один раз; повторный вызов его не сдвигает
+		std::int64_t unset = 0;
+		origin().compare_exchange_strong(unset, ticks());
+		flag().store(true, std::memory_order_release);
+	}
+	static bool enabled() { return flag().load(std::memory_order_acquire); }
+	static std::uint64_t now() {
+		return static_cast<std::uint64_t>(ticks() - origin().load(std::memory_order_relaxed));
+	}
+	static TraceBuffer& buffer() { // буфер текущего потока, создаётся при первом событии
+		thread_local std::shared_ptr<TraceBuffer> mine;
+		if (!mine) {
+			std::lock_guard<std::mutex> lock(registryMutex());
+			mine = std::make_shared<TraceBuffer>(static_cast<unsigned>(registry().size()) + 1);
+			registry().push_back(mine); // реестр держит буфер и после завершения потока
+		}
+		return *mine;
+	}
+	static std::vector<std::shared_ptr<TraceBuffer> > buffers() {
+		std::lock_guard<std::mutex> lock(registryMutex());
+		return registry();
+	}
+
+private:
+	static std::atomic<bool>& flag() {
+		static std::atomic<bool> on(false);
+		return on;
+	}
+	static std::int64_t ticks() { // наносекунды steady_clock
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	static std::atomic<std::int64_t>& origin() {
+		static std::atomic<std::int64_t> start(0);
+		return start;
+	}
+	static std::mutex& registryMutex() {
+		static std::mutex mutex;
+		return mutex;
+	}
+	static std::vector<std::shared_ptr<TraceBuffer> >& registry() {
+		static std::vector<std::shared_ptr<TraceBuffer> > all;
+		return all;
+	}
+};
+
+struct TraceSpan { // этап от конструктора до деструктора
+	explicit TraceSpan(char const* name) : name_(name), on_(Trace::enabled()), start_(on_ ? Trace::now() : 0) {}
+	~TraceSpan() {
+		if (on_)
+			Trace::buffer().push(TraceEvent{ name_, start_, Trace::now() - start_ });
+	}
+
+private:
+	char const* name_;
+	bool on_;
+	std::uint64_t start_;
+};
+
+// Выгрузка трассы в JSON: события "X" с временем в микросекундах. Буферы можно читать, пока
+// потоки пишут дальше: события, которые за время чтения могли быть затёрты, отбрасываются.
+inline bool writeChromeTrace(std::string const& path, std::string& error) {
+	std::string json = "{\"traceEvents\":[";
+	bool first = true;
+	char number[32];
+	std::vector<std::shared_ptr<TraceBuffer> > buffers = Trace::buffers();
+	for (size_t b = 0; b < buffers.size(); ++b) {
+		TraceBuffer const& buffer = *buffers[b];
+		std::vector<TraceEvent> events;
+		buffer.load(events);
+		for (size_t i = 0; i < events.size(); ++i) {
+			TraceEvent const& event = events[i];
+			json += first ? "\n" : ",\n";
+			first = false;
+			json += "{\"name\":\"";
+			for (char const* c = event.name; *c; ++c) {
+				if (*c == '"' || *c == '\\')
+					json += '\\';
+				json += *c;
+			}
+			json += "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + std::to_string(buffer.thread) + ",\"ts\":";
+			json.append(number, std::to_chars(number, number + sizeof(number), event.start / 1000.0).ptr);
+			json += ",\"dur\":";
+			json.append(number, std::to_chars(number, number + sizeof(number), event.duration / 1000.0).ptr);
+			json += "}";
+		}
+	}
+	json += "\n]}\n";
+	std::FILE* file = std::fopen(path.c_str(), "wb");
+	if (!file) {
+		error = "не удалось создать " + path;
+		return false;
+	}
+	bool ok = std::fwrite(json.data(), 1, json.size(), file) == json.size();
+	if (std::fclose(file) != 0 || !ok) {
+		error = "ошибка записи в " + path;
+		return false;
+	}
+	return true;
+}
+
+// Аппаратные счётчики через perf_event_open (Linux): PerfCounters открывает счётчики текущего
+// потока, а PerfScope копит их прирост за этап в таблице под именем «метка: этап». Этапы те же,
+// что в трассе: разбор, проходы runPass, компиляция, блоки вычисления; метка — формула или случай
+// замера. Счётчик, который открыть не удалось (нет прав по perf_event_paranoid, виртуальная
+// машина без PMU, не Linux), недоступен, остальные работают. Пока в потоке нет активных
+// PerfCounters, PerfScope только читает указатель.
+struct PerfCounters {
+	enum { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, EVENTS };
+
+	struct Reading { // показания всех счётчиков; enabled и running — для поправки на разделение PMU
+		std::uint64_t value[EVENTS], enabled[EVENTS], running[EVENTS];
+	};
+
+	struct Totals {
+		std::uint64_t calls;
+		double values[EVENTS];
+		Totals() : calls(0) {
+			for (int e = 0; e < EVENTS; ++e)
+				values[e] = 0.0;
+		}
+	};
+
+	PerfCounters() {
+		for (int e = 0; e < EVENTS; ++e)
+			fds_[e] = -1;
+#ifdef LR6_PERF_EVENTS
+		std::uint64_t const l1dReadMiss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		std::uint32_t const types[EVENTS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+		std::uint64_t const configs[EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES,
+			l1dReadMiss, PERF_COUNT_HW_CACHE_MISSES }; // cache-misses — промахи последнего уровня
+		for (int e = 0; e < EVENTS; ++e) {
+			fds_[e] = open(types[e], configs[e]);
+			if (fds_[e] < 0 && error_.empty())
+				error_ = std::string(name(e)) + ": " + std::strerror(errno);
+		}
+#else
+		error_ = "perf_event_open есть только в Linux";
+#endif
+	}
+	~PerfCounters() {
+		if (active() == this)
+			active() = nullptr;
+#ifdef LR6_PERF_EVENTS
+		for (int e = 0; e < EVENTS; ++e)
+			if (fds_[e] >= 0)
+				::close(fds_[e]);
+#endif
+	}
+	PerfCounters(PerfCounters const&) = delete;
+	PerfCounters& operator=(PerfCounters const&) = delete;
+
+	static char const* name(int event) {
+		static char const* const names[EVENTS] = { "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses" };
+		return names[event];
+	}
+	bool available(int event) const { return fds_[event] >= 0; }
+	bool anyAvailable() const {
+		for (int e = 0; e < EVENTS; ++e)
+			if (available(e)) return true;
+		return false;
+	}
+	std::string const& error() const { return error_; } // почему не открылся первый недоступный счётчик
+
+	static PerfCounters*& active() { // счётчики, в которые пишут PerfScope текущего потока
+		thread_local PerfCounters* counters = nullptr;
+		return counters;
+	}
+	void activate() { active() = this; } // счётчики считают поток, который их открыл
+	void setLabel(std::string const& label) { label_ = label; }
+	std::map<std::string, Totals> const& results() const { return results_; }
+
+	void read(Reading& reading) const {
+		for (int e = 0; e < EVENTS; ++e) {
+			reading.value[e] = reading.enabled[e] = reading.running[e] = 0;
+#ifdef LR6_PERF_EVENTS
+			std::uint64_t data[3];
+			if (fds_[e] >= 0 && ::read(fds_[e], data, sizeof(data)) == static_cast<ssize_t>(sizeof(data))) {
+				reading.value[e] = data[0];
+				reading.enabled[e] = data[1];
+				reading.running[e] = data[2];
+			}
+#endif
+		}
+	}
+	void add(char const* stage, Reading const& start) { // прирост с start — ещё один вызов этапа
+		Reading now;
+		read(now);
+		Totals& totals = results_[label_.empty() ? std::string(stage) : label_ + ": " + stage];
+		++totals.calls;
+		for (int e = 0; e < EVENTS; ++e) {
+			std::uint64_t running = now.running[e] - start.running[e];
+			if (running) // счётчик делил PMU с другими — растягиваем на всё время этапа
+				totals.values[e] += static_cast<double>(now.value[e] - start.value[e])
+					* static_cast<double>(now.enabled[e] - start.enabled[e]) / static_cast<double>(running);
+		}
+	}
+	bool open(char const* stage) { // этап уже открыт выше по стеку: вложенный вызов не считается дважды
+		for (size_t i = 0; i < stages_.size(); ++i)
+			if (std::strcmp(stages_[i], stage) == 0) return false;
+		stages_.push_back(stage);
+		return true;
+	}
+	void close() { stages_.pop_back(); }
+
+private:
+#ifdef LR6_PERF_EVENTS
+	static int open(std::uint32_t type, std::uint64_t config) {
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.exclude_kernel = 1; // только своя программа: так счётчики доступны и без прав root
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)); // этот поток, любой процессор
+	}
+#endif
+
+	int fds_[EVENTS];
+	std::string error_;
+	std::string label_;
+	std::map<std::string, Totals> results_;
+	std::vector<char const*> stages_;
+};
+
+struct PerfScope { // этап от конструктора до деструктора
+	explicit PerfScope(char const* stage) : counters_(PerfCounters::active()), stage_(stage) {
+		if (counters_ && !counters_->open(stage))
+			counters_ = nullptr; // тело суммы внутри вычисления — часть внешнего этапа
+		if (counters_)
+			counters_->read(start_);
+	}
+	~PerfScope() {
+		if (!counters_)
+			return;
+		counters_->add(stage_, start_);
+		counters_->close();
+	}
+
+private:
+	PerfCounters* counters_;
+	char const* stage_;
+	PerfCounters::Reading start_;
+};
+
+// отчёт: этапы с числом вызовов и суммами счётчиков, IPC — instructions / cycles
+inline void printPerfReport(std::ostream& out, PerfCounters const& counters) {
+	if (!counters.anyAvailable()) {
+		out << "аппаратные счётчики недоступны: " << counters.error() << std::endl;
+		return;
+	}
+	if (!counters.error().empty())
+		out << "часть счётчиков недоступна (" << counters.error() << ")" << std::endl;
+	std::map<std::string, PerfCounters::Totals> const& results = counters.results();
+	for (std::map<std::string, PerfCounters::Totals>::const_iterator it = results.begin(); it != results.end(); ++it) {
+		PerfCounters::Totals const& totals = it->second;
+		out << it->first << " (" << totals.calls << " вызовов):";
+		for (int e = 0; e < PerfCounters::EVENTS; ++e)
+			if (counters.available(e))
+				out << " " << PerfCounters::name(e) << " " << static_cast<std::uint64_t>(totals.values[e]);
+		if (counters.available(PerfCounters::CYCLES) && counters.available(PerfCounters::INSTRUCTIONS) && totals.values[PerfCounters::CYCLES] > 0)
+			out << " IPC " << totals.values[PerfCounters::INSTRUCTIONS] / totals.values[PerfCounters::CYCLES];
+		out << std::endl;
+	}
+}
 
 struct Transformer { //реализация паттерна проектирования Visitor
 	virtual ~Transformer() {}
@@ -13,6 +551,14 @@ struct Transformer { //реализация паттерна проектиро
 	virtual Expression* transformBinaryOperation(BinaryOperation const*) = 0;
 	virtual Expression* transformFunctionCall(FunctionCall const*) = 0;
 	virtual Expression* transformVariable(Variable const*) = 0;
+	virtual Expression* transformComparison(Comparison const*) = 0;
+	virtual Expression* transformSelect(Select const*) = 0;
+	virtual Expression* transformMinMax(MinMax const*) = 0;
+	virtual Expression* transformNegate(Negate const*) = 0;
+	virtual Expression* transformIntPower(IntPower const*) = 0;
+	virtual Expression* transformSum(Sum const*) = 0;
+	virtual Expression* transformIndexedVariable(IndexedVariable const*) = 0;
+	virtual Expression* transformDot(Dot const*) = 0;
 };
 
 struct Expression //базовая абстрактная структура "Выражение"
@@ -20,14 +566,41 @@ struct Expression //базовая абстрактная структура "В
 	virtual ~Expression() { } //виртуальный деструктор
 	virtual double evaluate() const = 0; //абстрактный метод «вычислить»
 	virtual Expression* transform(Transformer* tr) const = 0; // возвращает полностью новое АСД
-	
+
+	// все узлы создаются через new: считаем их в AllocationStats. Размер узла хранится перед ним,
+	// потому что из двух operator delete класса выражение delete выбирает тот, что без размера.
+	// new не встраивается: иначе GCC видит malloc в паре с operator delete класса и предупреждает
+	static size_t const HEADER = alignof(std::max_align_t);
+	LR6_NOINLINE static void* operator new(size_t size) {
+		char* block = static_cast<char*>(std::malloc(HEADER + size));
+		if (!block)
+			throw std::bad_alloc();
+		*reinterpret_cast<size_t*>(block) = size;
+		AllocationStats::current().allocated(size);
+		return block + HEADER;
+	}
+	static void operator delete(void* node) {
+		if (!node)
+			return;
+		char* block = static_cast<char*>(node) - HEADER;
+		AllocationStats::current().freed(*reinterpret_cast<size_t*>(block));
+		std::free(block);
+	}
+	static void operator delete(void* node, size_t size) {
+		assert(!node || *reinterpret_cast<size_t*>(static_cast<char*>(node) - HEADER) == size);
+		(void)size;
+		operator delete(node);
+	}
 };
 
 struct Number : Expression // стуктура «Число»
 {
 	Number(double value) : value_(value) {} //конструктор
 	double value() const { return value_; } // метод чтения значения числа
-	double evaluate() const { return value_; } // реализация виртуального метода «вычислить»
+	double evaluate() const { // реализация виртуального метода «вычислить»
+		LR6_EVALUATION(NUMBER);
+		return value_;
+	}
 	~Number() {}//деструктор, тоже виртуальный
 
 	Expression* transform(Transformer* tr) const {
@@ -57,7 +630,11 @@ struct BinaryOperation : Expression // «Бинарная операция»
 	Expression const* left() const { return left_; } // чтение левого операнда
 	Expression const* right() const { return right_; } // чтение правого операнда
 	int operation() const { return op_; } // чтение символа операции
+	// операнд переходит вызывающему, после этого узел можно только удалить
+	Expression const* releaseLeft() { Expression const* left = left_; left_ = nullptr; return left; }
+	Expression const* releaseRight() { Expression const* right = right_; right_ = nullptr; return right; }
 	double evaluate() const { // реализация виртуального метода «вычислить»
+		LR6_EVALUATION(binaryKind(op_));
 		double left = left_->evaluate(); // вычисляем левую часть
 		double right = right_->evaluate(); // вычисляем правую часть
 		switch (op_) {// в зависимости от вида операции выполняем вычисления
@@ -80,18 +657,115 @@ private:
 
 struct FunctionCall : Expression // структура «Вызов функции»
 {
+	enum { SQRT, ABS, POW, HYPOT, ATAN2, FMA, FUNCTIONS }; // номера функций в реестре
+	struct Info {
+		char const* name;
+		size_t arity; // число аргументов
+	};
+	static Info const& info(int id) { // реестр функций; min, max и select — отдельные узлы
+		static Info const table[FUNCTIONS] = {
+			{ "sqrt", 1 }, { "abs", 1 }, { "pow", 2 }, { "hypot", 2 }, { "atan2", 2 }, { "fma", 3 },
+		};
+		return table[id];
+	}
+	static int find(std::string const& name) { // -1, если такой функции нет
+		for (int id = 0; id < FUNCTIONS; ++id)
+			if (name == info(id).name) return id;
+		return -1;
+	}
+
 	// в конструкторе надо учесть имя функции и ее аогумент
-	FunctionCall(std::string const& name, Expression const* arg) : name_(name), arg_(arg) {
-		assert(arg_);
-		assert(name_ == "sqrt" || name_ == "abs");
-	} // разрешены только вызов sqrt и abs
+	FunctionCall(std::string const& name, Expression const* arg) : name_(name), id_(find(name)), args_(1, arg) {
+		assert(arg);
+		assert(id_ >= 0 && info(id_).arity == 1);
+	} // с одним аргументом разрешены только вызов sqrt и abs
+	FunctionCall(std::string const& name, std::vector<Expression const*> const& args) : name_(name), id_(find(name)), args_(args) {
+		assert(id_ >= 0 && info(id_).arity == args_.size()); // число аргументов проверяет реестр
+		for (size_t i = 0; i < args_.size(); ++i)
+			assert(args_[i]);
+	}
 	std::string const& name() const { return name_; }
-	Expression const* arg() const { return arg_; } // чтение аргумента функции
-	~FunctionCall() { delete arg_; }
+	int id() const { return id_; }
+	Expression const* arg(size_t i = 0) const { return args_[i]; } // чтение аргумента функции
+	size_t arity() const { return args_.size(); }
+	~FunctionCall() {
+		for (size_t i = 0; i < args_.size(); ++i)
+			delete args_[i];
+	}
 	virtual double evaluate() const { // реализация виртуального метода «вычислить»
-		if (name_ == "sqrt")
-			return sqrt(arg_->evaluate()); // либо вычисляем корень квадратный
-		else return fabs(arg_->evaluate()); // либо модуль — остальные функции запрещены
+		LR6_EVALUATION(FUNCTION + id_);
+		double x[3];
+		for (size_t i = 0; i < args_.size(); ++i)
+			x[i] = args_[i]->evaluate();
+		return apply(id_, x);
+	}
+
+	// pow с целым показателем до POW_SQUARING_LIMIT по модулю считается возведением в квадрат:
+	// не больше 2 log2 n умножений вместо std::pow, ошибка растёт до |n| округлений
+	static long const POW_SQUARING_LIMIT = 16;
+	static bool smallInteger(double y) { return y == std::trunc(y) && std::fabs(y) <= POW_SQUARING_LIMIT; }
+	template<class T> static T power(T x, long n) { // x^n возведением в квадрат
+		T result = 1, base = x;
+		for (long e = n < 0 ? -n : n; e; e >>= 1) {
+			if (e & 1) result *= base;
+			if (e > 1) base *= base;
+		}
+		return n < 0 ? T(1) / result : result;
+	}
+	// без переполнения: max * sqrt(1 + (min/max)^2), до 3 ulp против 1 у std::hypot, зато без
+	// ветвлений и векторизуется; бесконечность побеждает NaN, как в std::hypot
+	template<class T> static T hypot(T x, T y) {
+		T ax = std::fabs(x), ay = std::fabs(y);
+		T m = ax > ay ? ax : ay, s = ax > ay ? ay : ax;
+		T q = s / m;
+		T h = m * std::sqrt(T(1) + q * q);
+		T const inf = std::numeric_limits<T>::infinity();
+		return ax == inf || ay == inf ? inf : m == T(0) ? T(0) : h;
+	}
+	template<class T> static T apply(int id, T const* x) { // значение для float и double
+		switch (id) {
+		case SQRT: return std::sqrt(x[0]);
+		case ABS: return std::fabs(x[0]);
+		case POW: return smallInteger(x[1]) ? power(x[0], static_cast<long>(x[1])) : std::pow(x[0], x[1]);
+		case HYPOT: return hypot(x[0], x[1]);
+		case ATAN2: return std::atan2(x[0], x[1]);
+		default: return std::fma(x[0], x[1], x[2]);
+		}
+	}
+	// n строк сразу: x[i] — столбец i-го аргумента, r может совпадать с любым из них
+	template<class T> static void applyLoop(int id, T* r, T const* const* x, size_t n) {
+		switch (id) {
+		case SQRT: for (size_t k = 0; k < n; ++k) r[k] = std::sqrt(x[0][k]); break;
+		case ABS: for (size_t k = 0; k < n; ++k) r[k] = std::fabs(x[0][k]); break;
+		case POW: for (size_t k = 0; k < n; ++k) r[k] = smallInteger(x[1][k]) ? power(x[0][k], static_cast<long>(x[1][k])) : std::pow(x[0][k], x[1][k]); break;
+		case HYPOT: for (size_t k = 0; k < n; ++k) r[k] = hypot(x[0][k], x[1][k]); break;
+		case ATAN2: for (size_t k = 0; k < n; ++k) r[k] = std::atan2(x[0][k], x[1][k]); break;
+		default: for (size_t k = 0; k < n; ++k) r[k] = std::fma(x[0][k], x[1][k], x[2][k]); break;
+		}
+	}
+	// pow с одинаковым для всех строк целым показателем: каждое умножение — цикл по всем строкам,
+	// те же умножения в том же порядке, что в power. r может совпадать с x: x читается только
+	// до первой записи в r, дальше степени берутся из square
+	template<class T> static void powerLoop(T* r, T const* x, long n, T* square, size_t count) {
+		T const* base = x;
+		bool started = false;
+		for (long e = n < 0 ? -n : n; e; e >>= 1) {
+			if (e & 1) {
+				if (started)
+					for (size_t k = 0; k < count; ++k) r[k] *= base[k];
+				else if (r != base)
+					for (size_t k = 0; k < count; ++k) r[k] = base[k];
+				started = true;
+			}
+			if (e > 1) {
+				for (size_t k = 0; k < count; ++k) square[k] = base[k] * base[k];
+				base = square;
+			}
+		}
+		if (!started)
+			for (size_t k = 0; k < count; ++k) r[k] = 1;
+		if (n < 0)
+			for (size_t k = 0; k < count; ++k) r[k] = T(1) / r[k];
 	}
 
 	Expression* transform(Transformer* tr) const {
@@ -101,14 +775,18 @@ struct FunctionCall : Expression // структура «Вызов функци
 
 private:
 	std::string const name_; // имя функции 
-	Expression const* arg_; // указатель на ее аргумент
+	int id_; // номер в реестре
+	std::vector<Expression const*> args_; // указатели на ее аргументы
 };
 
 struct Variable : Expression // структура «Переменная»
 {
 	Variable(std::string const& name) : name_(name) { } //в конструкторе надо указать ее имя
 	std::string const& name() const { return name_; } // чтение имени переменной
-	double evaluate() const { return 0.0; } // реализация виртуального метода «вычислить»
+	double evaluate() const { // реализация виртуального метода «вычислить»
+		LR6_EVALUATION(VARIABLE);
+		return 0.0;
+	}
 
 	Expression* transform(Transformer* tr) const {
 		return tr->transformVariable(this);
@@ -118,110 +796,6233 @@ private:
 	std::string const name_; // имя переменной
 };
 
-struct CopySyntaxTree : Transformer {
-	Expression* transformNumber(Number const* number) {
-		return new Number(number->value());
+struct Comparison : Expression // «Сравнение»: 1, если условие выполнено, иначе 0
+{
+	enum { LESS, LESS_EQUAL, GREATER, GREATER_EQUAL, EQUAL, NOT_EQUAL };
+	Comparison(Expression const* left, int op, Expression const* right) : left_(left), op_(op), right_(right) {
+		assert(left_ && right_ && op_ >= LESS && op_ <= NOT_EQUAL);
+	}
+	~Comparison() {
+		delete left_;
+		delete right_;
+	}
+	Expression const* left() const { return left_; }
+	Expression const* right() const { return right_; }
+	int operation() const { return op_; }
+	static char const* symbol(int op) {
+		static char const* const symbols[] = { "<", "<=", ">", ">=", "==", "!=" };
+		return symbols[op];
+	}
+	template<class T> static bool holds(int op, T const& a, T const& b) { // с NaN верно только !=
+		switch (op) {
+		case LESS: return a < b;
+		case LESS_EQUAL: return a <= b;
+		case GREATER: return a > b;
+		case GREATER_EQUAL: return a >= b;
+		case EQUAL: return a == b;
+		default: return a != b;
+		}
+	}
+	double evaluate() const {
+		LR6_EVALUATION(COMPARISON);
+		return holds(op_, left_->evaluate(), right_->evaluate()) ? 1.0 : 0.0;
 	}
 
-	Expression* transformBinaryOperation(BinaryOperation const* binop) {
-		return new BinaryOperation(
-			(binop->left())->transform(this),
-			binop->operation(), 
-			(binop->right())->transform(this)
-		);
+	Expression* transform(Transformer* tr) const {
+		return tr->transformComparison(this);
 	}
 
-	Expression* transformFunctionCall(FunctionCall const* fcall) {
-		return new FunctionCall(
-			fcall->name(),
-			(fcall->arg())->transform(this)
-		);
+private:
+	Expression const* left_;
+	int op_;
+	Expression const* right_;
+};
+
+struct Select : Expression // «Выбор»: then, если условие не равно нулю, иначе otherwise
+{
+	Select(Expression const* condition, Expression const* then, Expression const* otherwise)
+		: condition_(condition), then_(then), otherwise_(otherwise) {
+		assert(condition_ && then_ && otherwise_);
+	}
+	~Select() {
+		delete condition_;
+		delete then_;
+		delete otherwise_;
+	}
+	Expression const* condition() const { return condition_; }
+	Expression const* then() const { return then_; }
+	Expression const* otherwise() const { return otherwise_; }
+	double evaluate() const { // вычисляется только выбранная ветвь
+		LR6_EVALUATION(SELECT);
+		return condition_->evaluate() != 0.0 ? then_->evaluate() : otherwise_->evaluate();
 	}
 
-	Expression* transformVariable(Variable const* var) {
-		return new Variable(var->name());
+	Expression* transform(Transformer* tr) const {
+		return tr->transformSelect(this);
 	}
+
+private:
+	Expression const* condition_;
+	Expression const* then_;
+	Expression const* otherwise_;
 };
 
-struct FoldConstants : Transformer {
-	Expression* transformNumber(Number const* number) {//Просто число, преобразований не требуется
-		return new Number(number->value());
+struct MinMax : Expression // «Минимум» или «максимум» двух значений
+{
+	enum { MIN, MAX };
+	MinMax(int kind, Expression const* left, Expression const* right) : kind_(kind), left_(left), right_(right) {
+		assert(left_ && right_ && (kind_ == MIN || kind_ == MAX));
+	}
+	~MinMax() {
+		delete left_;
+		delete right_;
+	}
+	int kind() const { return kind_; }
+	char const* name() const { return kind_ == MIN ? "min" : "max"; }
+	Expression const* left() const { return left_; }
+	Expression const* right() const { return right_; }
+	// как minpd/maxpd: если одно из значений NaN, результат — right
+	template<class T> static T apply(int kind, T const& a, T const& b) {
+		return kind == MIN ? (a < b ? a : b) : (a > b ? a : b);
+	}
+	double evaluate() const {
+		LR6_EVALUATION(MINMAX);
+		return apply(kind_, left_->evaluate(), right_->evaluate());
 	}
-	Expression* transformBinaryOperation(BinaryOperation const* binop) {
-		//Рассматриваем левое и правое выражения (с рекурсией)
-		Expression* L = (binop->left())->transform(this);
-		Expression* R = (binop->right())->transform(this);
 
-		//Проверка, являются ли левое и правое выражения числами
-		Number* L_numb = dynamic_cast<Number*>(L);
-		Number* R_numb = dynamic_cast<Number*>(R);
+	Expression* transform(Transformer* tr) const {
+		return tr->transformMinMax(this);
+	}
 
-		//Промежуточный узел дерева
-		int Op = binop->operation();
-		BinaryOperation* newBinop = new BinaryOperation(L, Op, R);
+private:
+	int kind_;
+	Expression const* left_;
+	Expression const* right_;
+};
 
-		if (L_numb && R_numb) {//оба явялются числами => нужно вычислить (свернуть)
-			Expression* foldConst = new Number(newBinop->evaluate());
-			delete newBinop; //узел больше не нужен
-			return foldConst;
-		}
-		//Хотя бы одно из выражений не принадлежит типу Number
-		return newBinop;
+struct Negate : Expression // «Смена знака»: -operand, всегда точна
+{
+	Negate(Expression const* operand) : operand_(operand) {
+		assert(operand_);
+	}
+	~Negate() { delete operand_; }
+	Expression const* operand() const { return operand_; }
+	Expression const* releaseOperand() { Expression const* operand = operand_; operand_ = nullptr; return operand; }
+	double evaluate() const {
+		LR6_EVALUATION(NEGATE);
+		return -operand_->evaluate();
+	}
 
+	Expression* transform(Transformer* tr) const {
+		return tr->transformNegate(this);
 	}
-	Expression* transformFunctionCall(FunctionCall const* fcall) {
-		//Рассматриваем аргумент функции
-		Expression* Arg = (fcall->arg())->transform(this);
 
-		//Проверка, является ли аргумент числом
-		Number* Arg_numb = dynamic_cast<Number*>(Arg);
+private:
+	Expression const* operand_;
+};
 
-		//Промежуточный узел дерева
-		std::string Name = fcall->name();
-		FunctionCall* newFcall = new FunctionCall(Name, Arg);
+struct IntPower : Expression // «Целая степень»: base^exponent по кратчайшей цепочке умножений
+{
+	// шаг k цепочки: значение k + 1 = значение first * значение second, значение 0 — основание,
+	// последнее значение — |exponent|-я степень
+	typedef std::vector<std::pair<int, int> > Chain;
+	static unsigned long const SEARCH_LIMIT = 64; // до этой степени цепочка ищется перебором, дальше — двоичный метод
 
-		if (Arg_numb) { //аргумент имеет тип Number => нужно вычислить (свернуть)
-			Expression* foldConst = new Number(newFcall->evaluate());
-			delete newFcall; //узел больше не нужен
-			return foldConst;
+	IntPower(Expression const* base, int exponent) : base_(base), exponent_(exponent), chain_(chain(exponent)) {
+		assert(base_);
+	}
+	~IntPower() { delete base_; }
+	Expression const* base() const { return base_; }
+	Expression const* releaseBase() { Expression const* base = base_; base_ = nullptr; return base; }
+	int exponent() const { return exponent_; }
+	Chain const& steps() const { return chain_; }
+	double evaluate() const {
+		LR6_EVALUATION(INT_POWER);
+		return apply(base_->evaluate(), exponent_, chain_);
+	}
+
+	template<class T> static T apply(T const& base, int exponent, Chain const& steps) {
+		T values[64]; // двоичный метод для 31-битного показателя — не больше 62 шагов
+		values[0] = base;
+		for (size_t k = 0; k < steps.size(); ++k)
+			values[k + 1] = values[steps[k].first] * values[steps[k].second];
+		T result = exponent == 0 ? T(1.0) : values[steps.size()];
+		return exponent < 0 ? T(1.0) / result : result;
+	}
+
+	static Chain chain(int exponent) {
+		unsigned long n = exponent < 0 ? 0ul - static_cast<unsigned long>(static_cast<long>(exponent)) : static_cast<unsigned long>(exponent);
+		Chain steps;
+		if (n <= 1)
+			return steps;
+		if (n <= SEARCH_LIMIT) { // перебор с углублением: первая найденная цепочка кратчайшая
+			std::vector<unsigned long> values(1, 1);
+			for (size_t limit = 1; !extend(values, steps, n, limit); ++limit) {}
+			return steps;
 		}
-		return newFcall;
+		int square = 0, result = -1; // двоичный метод: квадраты и произведения нужных из них
+		for (unsigned long e = n; e; e >>= 1) {
+			if (e & 1) {
+				if (result < 0)
+					result = square;
+				else {
+					steps.push_back(std::make_pair(result, square));
+					result = static_cast<int>(steps.size());
+				}
+			}
+			if (e > 1) {
+				steps.push_back(std::make_pair(square, square));
+				square = static_cast<int>(steps.size());
+			}
+		}
+		return steps;
 	}
-	Expression* transformVariable(Variable const* var) { //Просто переменная, преобразований не требуется
-		return new Variable(var->name());
+
+	Expression* transform(Transformer* tr) const {
+		return tr->transformIntPower(this);
+	}
+
+private:
+	// звёздная цепочка: к последнему значению прибавляется одно из прежних; для степеней до
+	// 12508 среди звёздных цепочек всегда есть кратчайшая
+	static bool extend(std::vector<unsigned long>& values, Chain& steps, unsigned long n, size_t limit) {
+		unsigned long last = values.back();
+		if (last == n)
+			return true;
+		if (steps.size() == limit || (last << (limit - steps.size())) < n) // даже удвоениями не дойти
+			return false;
+		for (size_t j = values.size(); j-- > 0; ) {
+			if (last + values[j] > n)
+				continue;
+			values.push_back(last + values[j]);
+			steps.push_back(std::make_pair(static_cast<int>(values.size()) - 2, static_cast<int>(j)));
+			if (extend(values, steps, n, limit))
+				return true;
+			values.pop_back();
+			steps.pop_back();
+		}
+		return false;
 	}
+
+	Expression const* base_;
+	int exponent_;
+	Chain chain_;
 };
 
-void printExpr(const Expression* expression) { //Вывод выражения на экран
-	const Number* numb = dynamic_cast<const Number*>(expression);
-	if (numb) {
-		std::cout << numb->value();
+enum SumMode { SIMPLE_SUM, PAIRWISE_SUM, KAHAN_SUM }; // порядок сложения слагаемых Sum
+
+// n (кратно 8) слагаемых по восьми накопителям: x[k] — в lane[k % 8]; с поправками carry для Кэхэна.
+// У double накопители — четыре пары SSE2, порядок сложений тот же, что в общем цикле
+template<class T> inline void accumulateLanes(T* lane, T const* x, size_t n) {
+	for (size_t k = 0; k < n; k += 8)
+		for (size_t j = 0; j < 8; ++j) lane[j] = lane[j] + x[k + j];
+}
+template<class T> inline void compensateLanes(T* lane, T* carry, T const* x, size_t n) {
+	for (size_t k = 0; k < n; k += 8)
+		for (size_t j = 0; j < 8; ++j) {
+			T y = x[k + j] - carry[j];
+			T t = lane[j] + y;
+			carry[j] = (t - lane[j]) - y;
+			lane[j] = t;
+		}
+}
+#ifdef LR6_SSE2
+inline void accumulateLanes(double* lane, double const* x, size_t n) {
+	__m128d s[4] = { _mm_loadu_pd(lane), _mm_loadu_pd(lane + 2), _mm_loadu_pd(lane + 4), _mm_loadu_pd(lane + 6) };
+	for (size_t k = 0; k < n; k += 8)
+		for (int j = 0; j < 4; ++j) s[j] = _mm_add_pd(s[j], _mm_loadu_pd(x + k + 2 * j));
+	for (int j = 0; j < 4; ++j) _mm_storeu_pd(lane + 2 * j, s[j]);
+}
+inline void compensateLanes(double* lane, double* carry, double const* x, size_t n) {
+	__m128d s[4], c[4];
+	for (int j = 0; j < 4; ++j) {
+		s[j] = _mm_loadu_pd(lane + 2 * j);
+		c[j] = _mm_loadu_pd(carry + 2 * j);
 	}
-	else {
-		const BinaryOperation* binop = dynamic_cast<const BinaryOperation*>(expression);
-		if (binop) {
-			printExpr(binop->left());
-			std::cout << static_cast<char>(binop->operation());
-			printExpr(binop->right());
+	for (size_t k = 0; k < n; k += 8)
+		for (int j = 0; j < 4; ++j) {
+			__m128d y = _mm_sub_pd(_mm_loadu_pd(x + k + 2 * j), c[j]);
+			__m128d t = _mm_add_pd(s[j], y);
+			c[j] = _mm_sub_pd(_mm_sub_pd(t, s[j]), y);
+			s[j] = t;
 		}
-		else {
-			const FunctionCall* funCall = dynamic_cast<const FunctionCall*>(expression);
-			if (funCall) {
-				std::cout << funCall->name() + "(";
-				printExpr(funCall->arg());
-				std::cout << ")";
+	for (int j = 0; j < 4; ++j) {
+		_mm_storeu_pd(lane + 2 * j, s[j]);
+		_mm_storeu_pd(carry + 2 * j, c[j]);
+	}
+}
+#endif
+
+// Сумма потока слагаемых. SIMPLE_SUM — одна цепочка слева направо, как дерево из PLUS. Иначе
+// слагаемые идут блоками по BLOCK, внутри блока — по LANES независимым накопителям (цикл по
+// накопителям векторизуется, цепочка s += x — нет). PAIRWISE_SUM складывает накопители попарно,
+// а суммы блоков — каскадом, как разряды двоичного счётчика: у каждого слагаемого не больше
+// BLOCK / LANES + 3 + 2 log2(блоков) округлений. KAHAN_SUM ведёт в каждом накопителе поправку.
+// Результат зависит только от последовательности слагаемых, а не от того, какими порциями они
+// пришли в add: неполный блок дожидается продолжения в буфере.
+template<class T> struct Summation {
+	static size_t const BLOCK = 128;
+	static size_t const LANES = 8; // как в accumulateLanes
+
+	Summation(SumMode mode) : mode_(mode), filled_(0), blocks_(0), simple_(0.0) {
+		for (size_t j = 0; j < LANES; ++j)
+			sum_[j] = carry_[j] = T(0.0);
+	}
+
+	void add(T const* x, size_t n) {
+		if (mode_ == SIMPLE_SUM) {
+			for (size_t k = 0; k < n; ++k) simple_ = simple_ + x[k];
+			return;
+		}
+		while (n) {
+			if (filled_ == 0 && n >= BLOCK) { // целые блоки — прямо из памяти вызывающего
+				consume(x, BLOCK);
+				x += BLOCK;
+				n -= BLOCK;
+				continue;
 			}
-			else {
-				const Variable* var = dynamic_cast<const Variable*>(expression);
-				std::cout << var->name();
+			size_t m = BLOCK - filled_ < n ? BLOCK - filled_ : n;
+			for (size_t k = 0; k < m; ++k) buffer_[filled_ + k] = x[k];
+			filled_ += m;
+			x += m;
+			n -= m;
+			if (filled_ == BLOCK) {
+				consume(buffer_, BLOCK);
+				filled_ = 0;
 			}
 		}
 	}
-}
 
-int main()
-{
-	/*std::cout << "Hello World!\n";
+	T result() const { // состояние не меняется, можно добавлять слагаемые дальше
+		if (mode_ == SIMPLE_SUM)
+			return simple_;
+		Summation rest(*this);
+		if (filled_)
+			rest.consume(buffer_, filled_); // неполный блок — последний
+		return rest.total();
+	}
+
+	// граница |вычисленная - точная| / sum |x| для count слагаемых в double без их собственных
+	// ошибок: gamma(k) = k u / (1 - k u) для k округлений на пути слагаемого, для Кэхэна 2u + O(n u^2)
+	// в каждом накопителе и столько же при сложении накопителей
+	static double errorBound(SumMode mode, double count) {
+		double const u = 0x1p-53;
+		if (count <= 1.0)
+			return 0.0;
+		if (mode == KAHAN_SUM)
+			return (4.0 + 4.0 * count * u) * u;
+		double k = count - 1.0;
+		if (mode == PAIRWISE_SUM)
+			k = std::fmin(k, BLOCK / LANES + 3.0 + 2.0 * std::ceil(std::log2(std::ceil(count / BLOCK))) + 1.0);
+		return k * u < 1.0 ? k * u / (1.0 - k * u) : HUGE_VAL;
+	}
+
+private:
+	static void kahan(T& sum, T& carry, T const& x) { // carry — потерянная часть со знаком минус
+		T y = x - carry;
+		T t = sum + y;
+		carry = (t - sum) - y;
+		sum = t;
+	}
+
+	void consume(T const* x, size_t n) { // блок из n <= BLOCK слагаемых
+		size_t full = n - n % LANES;
+		if (mode_ == KAHAN_SUM) {
+			compensateLanes(sum_, carry_, x, full);
+			for (size_t j = 0; j < n - full; ++j) kahan(sum_[j], carry_[j], x[full + j]);
+			return;
+		}
+		T lane[LANES];
+		for (size_t j = 0; j < LANES; ++j) lane[j] = T(0.0);
+		accumulateLanes(lane, x, full);
+		for (size_t j = 0; j < n - full; ++j) lane[j] = lane[j] + x[full + j];
+		for (size_t width = LANES / 2; width; width /= 2) // (0+1)+(2+3), ...: запись j не задевает ещё не прочитанные 2j, 2j+1
+			for (size_t j = 0; j < width; ++j) lane[j] = lane[2 * j] + lane[2 * j + 1];
+		T s = lane[0];
+		size_t level = 0; // уровень l каскада — сумма 2^l блоков, занят, если бит l в blocks_
+		for (unsigned long long b = blocks_; b & 1; b >>= 1, ++level)
+			s = cascade_[level] + s;
+		cascade_[level] = s;
+		++blocks_;
+	}
+
+	T total() const {
+		T s(0.0);
+		if (mode_ == KAHAN_SUM) { // накопители и их поправки — ещё одна компенсированная сумма
+			T carry(0.0);
+			for (size_t j = 0; j < LANES; ++j) {
+				kahan(s, carry, sum_[j]);
+				kahan(s, carry, T(0.0) - carry_[j]);
+			}
+			return s;
+		}
+		bool started = false;
+		for (size_t level = 0; blocks_ >> level; ++level)
+			if ((blocks_ >> level) & 1) { // от младших уровней к старшим, старшие блоки слева
+				s = started ? cascade_[level] + s : cascade_[level];
+				started = true;
+			}
+		return s;
+	}
+
+	SumMode mode_;
+	T buffer_[BLOCK]; // начало неполного блока
+	size_t filled_;
+	unsigned long long blocks_; // сложенных блоков
+	T simple_; // сумма SIMPLE_SUM
+	T sum_[LANES], carry_[LANES]; // накопители KAHAN_SUM и их поправки
+	T cascade_[64]; // суммы PAIRWISE_SUM по уровням каскада
+};
+
+struct Sum : Expression // «Сумма»: body при index = from, from + 1, ..., to; пустая (to < from) равна нулю
+{
+	Sum(std::string const& index, long from, long to, Expression const* body, SumMode mode = PAIRWISE_SUM)
+		: index_(index), from_(from), to_(to), body_(body), mode_(mode) {
+		assert(body_ && !index_.empty());
+	}
+	~Sum() { delete body_; }
+	std::string const& index() const { return index_; } // имя индекса: в теле — переменная, в w[index] — номер элемента
+	long from() const { return from_; }
+	long to() const { return to_; }
+	size_t count() const { return to_ < from_ ? 0 : static_cast<size_t>(to_ - from_) + 1; } // число слагаемых
+	Expression const* body() const { return body_; }
+	SumMode mode() const { return mode_; }
+	static char const* name(SumMode mode) {
+		static char const* const names[] = { "sum_simple", "sum", "sum_kahan" };
+		return names[mode];
+	}
+	static int find(std::string const& name) { // режим по имени в формуле, -1 — не сумма
+		for (int mode = SIMPLE_SUM; mode <= KAHAN_SUM; ++mode)
+			if (name == Sum::name(static_cast<SumMode>(mode))) return mode;
+		return -1;
+	}
+	double evaluate() const { // переменные, как и индекс, равны нулю, поэтому все слагаемые одинаковы
+		LR6_EVALUATION(SUM);
+		return uniform(count(), body_->evaluate());
+	}
+	// сумма count одинаковых слагаемых: одно умножение вместо count сложений, погрешность —
+	// одно округление; 0 + ... делает -0 нулём, как у Summation
+	template<class T> static T uniform(size_t count, T const& value) {
+		return count ? T(0.0) + T(static_cast<double>(count)) * value : T(0.0);
+	}
+
+	Expression* transform(Transformer* tr) const {
+		return tr->transformSum(this);
+	}
+
+private:
+	std::string const index_;
+	long from_, to_;
+	Expression const* body_;
+	SumMode mode_;
+};
+
+struct IndexedVariable : Expression // «Элемент массива» name[index + offset], index — индекс объемлющей суммы
+{
+	IndexedVariable(std::string const& name, std::string const& index, long offset = 0) : name_(name), index_(index), offset_(offset) {}
+	std::string const& name() const { return name_; } // имя массива
+	std::string const& index() const { return index_; }
+	long offset() const { return offset_; }
+	std::string element() const { // запись как в формуле: w[i], w[i+1], w[i-1]
+		return name_ + "[" + index_ + (offset_ > 0 ? "+" : "") + (offset_ ? std::to_string(offset_) : "") + "]";
+	}
+	double evaluate() const { // как у Variable: значения массивов задаются при вычислении
+		LR6_EVALUATION(ELEMENT);
+		return 0.0;
+	}
+
+	Expression* transform(Transformer* tr) const {
+		return tr->transformIndexedVariable(this);
+	}
+
+private:
+	std::string const name_;
+	std::string const index_;
+	long offset_;
+};
+
+// Значение-массив внутри dot: переменная-массив, произведение матрицы на массив или поэлементная
+// операция над массивами одной длины. Это не Expression — скалярного значения у массива нет:
+// формула остаётся скалярной, массивы сворачиваются в число скалярным произведением
+struct ArrayExpression {
+	enum { VARIABLE, MATVEC, ELEMENTWISE };
+	static ArrayExpression variable(std::string const& name) {
+		ArrayExpression expr = { VARIABLE, name, 0, {} };
+		return expr;
+	}
+	static ArrayExpression matVec(std::string const& matrix, ArrayExpression const& x) {
+		ArrayExpression expr = { MATVEC, matrix, 0, { x } };
+		return expr;
+	}
+	static ArrayExpression elementwise(int op, ArrayExpression const& a, ArrayExpression const& b) {
+		assert(op == '+' || op == '-' || op == '*');
+		ArrayExpression expr = { ELEMENTWISE, std::string(), op, { a, b } };
+		return expr;
+	}
+
+	int kind;
+	std::string name; // массив VARIABLE или матрица MATVEC: строки подряд, столбцов — длина аргумента
+	int op; // '+', '-' или '*' у ELEMENTWISE
+	std::vector<ArrayExpression> operands;
+
+	std::string text() const { // запись как в формуле
+		switch (kind) {
+		case VARIABLE: return name;
+		case MATVEC: return "matvec(" + name + "," + operands[0].text() + ")";
+		default: return "(" + operands[0].text() + static_cast<char>(op) + operands[1].text() + ")";
+		}
+	}
+	void arrays(std::set<std::string>& names) const { // имена всех массивов и матриц
+		if (kind != ELEMENTWISE)
+			names.insert(name);
+		for (size_t i = 0; i < operands.size(); ++i)
+			operands[i].arrays(names);
+	}
+};
+
+// Ядра массивов. Произведения идут порциями по Summation::BLOCK и складываются попарно, поэтому
+// dot и каждая строка matvec не зависят от разбивки на порции; matvec берёт MATVEC_ROWS строк за
+// один проход по x, и порция x читается из L1 для всех этих строк
+size_t const MATVEC_ROWS = 4;
+
+template<class T> T dotProduct(T const* a, T const* b, size_t n) {
+	size_t const block = Summation<T>::BLOCK;
+	T products[block];
+	Summation<T> total(PAIRWISE_SUM);
+	for (size_t k = 0; k < n; k += block) {
+		size_t m = n - k < block ? n - k : block;
+		for (size_t j = 0; j < m; ++j) products[j] = a[k + j] * b[k + j];
+		total.add(products, m);
+	}
+	return total.result();
+}
+
+template<class T> void matVec(T* y, T const* matrix, size_t rows, size_t cols, T const* x) { // y = M x, M по строкам
+	size_t const block = Summation<T>::BLOCK;
+	T products[block];
+	for (size_t r = 0; r < rows; r += MATVEC_ROWS) {
+		size_t count = rows - r < MATVEC_ROWS ? rows - r : MATVEC_ROWS;
+		std::vector<Summation<T> > sums(count, Summation<T>(PAIRWISE_SUM));
+		for (size_t k = 0; k < cols; k += block) {
+			size_t m = cols - k < block ? cols - k : block;
+			for (size_t q = 0; q < count; ++q) {
+				T const* row = matrix + (r + q) * cols + k;
+				for (size_t j = 0; j < m; ++j) products[j] = row[j] * x[k + j];
+				sums[q].add(products, m);
+			}
+		}
+		for (size_t q = 0; q < count; ++q)
+			y[r + q] = sums[q].result();
+	}
+}
+
+// длина значения при привязках lookup(имя) -> span; false и описание в error, если формы не согласованы
+template<class Lookup> bool arrayLength(ArrayExpression const& expr, Lookup const& lookup, size_t& length, std::string& error) {
+	if (expr.kind == ArrayExpression::VARIABLE) {
+		length = lookup(expr.name).size();
+		return true;
+	}
+	if (expr.kind == ArrayExpression::MATVEC) {
+		size_t cols, size = lookup(expr.name).size();
+		if (!arrayLength(expr.operands[0], lookup, cols, error))
+			return false;
+		if (cols ? size % cols != 0 : size != 0) {
+			error = "в матрице " + expr.name + " " + std::to_string(size) + " чисел — не целое число строк длины " + std::to_string(cols);
+			return false;
+		}
+		length = cols ? size / cols : 0;
+		return true;
+	}
+	size_t a, b;
+	if (!arrayLength(expr.operands[0], lookup, a, error) || !arrayLength(expr.operands[1], lookup, b, error))
+		return false;
+	if (a != b) {
+		error = "длины массивов в " + expr.text() + " различаются: " + std::to_string(a) + " и " + std::to_string(b);
+		return false;
+	}
+	length = a;
+	return true;
+}
+
+// значение массива в типе T; промежуточные массивы живут в storage. Привязанный массив double
+// берётся без копии, формы должны быть проверены arrayLength
+template<class T, class Lookup> std::span<T const> arrayValue(ArrayExpression const& expr, Lookup const& lookup,
+	std::deque<std::vector<T> >& storage) {
+	if (expr.kind == ArrayExpression::VARIABLE) {
+		std::span<double const> values = lookup(expr.name);
+		if constexpr (std::is_same<T, double>::value)
+			return values;
+		else {
+			storage.push_back(std::vector<T>(values.begin(), values.end()));
+			return storage.back();
+		}
+	}
+	if (expr.kind == ArrayExpression::MATVEC) {
+		std::span<T const> x = arrayValue<T>(expr.operands[0], lookup, storage);
+		std::span<T const> matrix = arrayValue<T>(ArrayExpression::variable(expr.name), lookup, storage);
+		assert(x.size() ? matrix.size() % x.size() == 0 : matrix.empty());
+		storage.push_back(std::vector<T>(x.size() ? matrix.size() / x.size() : 0));
+		matVec(storage.back().data(), matrix.data(), storage.back().size(), x.size(), x.data());
+		return storage.back();
+	}
+	std::span<T const> a = arrayValue<T>(expr.operands[0], lookup, storage);
+	std::span<T const> b = arrayValue<T>(expr.operands[1], lookup, storage);
+	assert(a.size() == b.size());
+	storage.push_back(std::vector<T>(a.size()));
+	T* r = storage.back().data();
+	switch (expr.op) {
+	case '+': for (size_t k = 0; k < a.size(); ++k) r[k] = a[k] + b[k]; break;
+	case '-': for (size_t k = 0; k < a.size(); ++k) r[k] = a[k] - b[k]; break;
+	default: for (size_t k = 0; k < a.size(); ++k) r[k] = a[k] * b[k]; break;
+	}
+	return storage.back();
+}
+
+struct Dot : Expression // «Скалярное произведение» массивов-выражений: sum a[k] b[k] попарным сложением
+{
+	Dot(ArrayExpression const& left, ArrayExpression const& right) : left_(left), right_(right) {}
+	ArrayExpression const& left() const { return left_; }
+	ArrayExpression const& right() const { return right_; }
+	template<class T, class Lookup> T value(Lookup const& lookup) const {
+		std::deque<std::vector<T> > storage;
+		std::span<T const> a = arrayValue<T>(left_, lookup, storage), b = arrayValue<T>(right_, lookup, storage);
+		assert(a.size() == b.size());
+		return dotProduct(a.data(), b.data(), a.size());
+	}
+	double evaluate() const { // массивы без значений пусты, как переменные без значений равны нулю
+		LR6_EVALUATION(DOT);
+		return 0.0;
+	}
+
+	Expression* transform(Transformer* tr) const {
+		return tr->transformDot(this);
+	}
+
+private:
+	ArrayExpression left_, right_;
+};
+
+struct CopySyntaxTree : Transformer {
+	Expression* transformNumber(Number const* number) {
+		return new Number(number->value());
+	}
+
+	Expression* transformBinaryOperation(BinaryOperation const* binop) {
+		return new BinaryOperation(
+			(binop->left())->transform(this),
+			binop->operation(), 
+			(binop->right())->transform(this)
+		);
+	}
+
+	Expression* transformFunctionCall(FunctionCall const* fcall) {
+		std::vector<Expression const*> args;
+		for (size_t i = 0; i < fcall->arity(); ++i)
+			args.push_back(fcall->arg(i)->transform(this));
+		return new FunctionCall(fcall->name(), args);
+	}
+
+	Expression* transformVariable(Variable const* var) {
+		return new Variable(var->name());
+	}
+
+	Expression* transformComparison(Comparison const* cmp) {
+		return new Comparison(cmp->left()->transform(this), cmp->operation(), cmp->right()->transform(this));
+	}
+
+	Expression* transformSelect(Select const* sel) {
+		return new Select(sel->condition()->transform(this), sel->then()->transform(this), sel->otherwise()->transform(this));
+	}
+
+	Expression* transformMinMax(MinMax const* mm) {
+		return new MinMax(mm->kind(), mm->left()->transform(this), mm->right()->transform(this));
+	}
+
+	Expression* transformNegate(Negate const* neg) {
+		return new Negate(neg->operand()->transform(this));
+	}
+
+	Expression* transformIntPower(IntPower const* power) {
+		return new IntPower(power->base()->transform(this), power->exponent());
+	}
+
+	Expression* transformSum(Sum const* sum) {
+		return new Sum(sum->index(), sum->from(), sum->to(), sum->body()->transform(this), sum->mode());
+	}
+
+	Expression* transformIndexedVariable(IndexedVariable const* var) {
+		return new IndexedVariable(var->name(), var->index(), var->offset());
+	}
+
+	Expression* transformDot(Dot const* dot) {
+		return new Dot(dot->left(), dot->right());
+	}
+};
+
+// Выделения по проходам Transformer: runPass выполняет проход над деревом и копит в таблице
+// текущего потока число вызовов, сумму счётчиков и наибольший пик под именем прохода; в трассе
+// проход — этап с тем же именем.
+struct PassAllocations {
+	std::uint64_t calls;
+	AllocationStats total; // peakBytes — наибольший пик одного вызова
+	PassAllocations() : calls(0) {}
+	void add(AllocationStats const& d) {
+		++calls;
+		total.allocations += d.allocations;
+		total.frees += d.frees;
+		total.allocatedBytes += d.allocatedBytes;
+		total.freedBytes += d.freedBytes;
+		total.liveBytes += d.liveBytes;
+		if (d.peakBytes > total.peakBytes)
+			total.peakBytes = d.peakBytes;
+	}
+};
+
+inline std::map<std::string, PassAllocations>& passAllocations() {
+	thread_local std::map<std::string, PassAllocations> passes;
+	return passes;
+}
+
+inline Expression* runPass(char const* name, Expression const* expr, Transformer* pass) {
+	TraceSpan span(name);
+	PerfScope perf(name);
+	AllocationScope scope;
+	Expression* result = expr->transform(pass);
+	passAllocations()[name].add(scope.delta());
+	return result;
+}
+
+// Память, которую занимают узлы дерева: измеряется копированием, allocations — число узлов
+inline AllocationStats treeAllocation(Expression const* expr) {
+	AllocationScope scope;
+	CopySyntaxTree copy;
+	Expression* twin = expr->transform(&copy);
+	AllocationStats d = scope.delta();
+	delete twin;
+	d.frees = d.freedBytes = 0;
+	return d;
+}
+
+inline void printAllocations(std::ostream& out, AllocationStats const& stats) {
+	out << stats.allocations << " выделений, " << stats.frees << " освобождений, " << stats.allocatedBytes
+		<< " байт выделено, живых " << stats.liveBytes << ", пик " << stats.peakBytes;
+}
+
+// отчёт о выделениях узлов в текущем потоке: всего и по проходам runPass
+inline void printAllocationReport(std::ostream& out) {
+	out << "узлы деревьев: ";
+	printAllocations(out, AllocationStats::current());
+	out << std::endl;
+	std::map<std::string, PassAllocations> const& passes = passAllocations();
+	for (std::map<std::string, PassAllocations>::const_iterator it = passes.begin(); it != passes.end(); ++it) {
+		out << "  " << it->first << " (" << it->second.calls << " вызовов): ";
+		printAllocations(out, it->second.total);
+		out << std::endl;
+	}
+}
+
+struct FoldConstants : Transformer {
+	Expression* transformNumber(Number const* number) {//Просто число, преобразований не требуется
+		return new Number(number->value());
+	}
+	Expression* transformBinaryOperation(BinaryOperation const* binop) {
+		//Рассматриваем левое и правое выражения (с рекурсией)
+		Expression* L = (binop->left())->transform(this);
+		Expression* R = (binop->right())->transform(this);
+
+		//Проверка, являются ли левое и правое выражения числами
+		Number* L_numb = dynamic_cast<Number*>(L);
+		Number* R_numb = dynamic_cast<Number*>(R);
+
+		//Промежуточный узел дерева
+		int Op = binop->operation();
+		BinaryOperation* newBinop = new BinaryOperation(L, Op, R);
+
+		if (L_numb && R_numb) {//оба явялются числами => нужно вычислить (свернуть)
+			Expression* foldConst = new Number(newBinop->evaluate());
+			delete newBinop; //узел больше не нужен
+			return foldConst;
+		}
+		//Хотя бы одно из выражений не принадлежит типу Number
+		return newBinop;
+
+	}
+	Expression* transformFunctionCall(FunctionCall const* fcall) {
+		//Рассматриваем аргументы функции
+		std::vector<Expression const*> Args;
+		bool Args_numb = true;
+		for (size_t i = 0; i < fcall->arity(); ++i) {
+			Args.push_back(fcall->arg(i)->transform(this));
+			Args_numb = Args_numb && dynamic_cast<Number const*>(Args.back()); //Проверка, является ли аргумент числом
+		}
+
+		//Промежуточный узел дерева
+		std::string Name = fcall->name();
+		FunctionCall* newFcall = new FunctionCall(Name, Args);
+
+		if (Args_numb) { //все аргументы имеют тип Number => нужно вычислить (свернуть)
+			Expression* foldConst = new Number(newFcall->evaluate());
+			delete newFcall; //узел больше не нужен
+			return foldConst;
+		}
+		return newFcall;
+	}
+	Expression* transformVariable(Variable const* var) { //Просто переменная, преобразований не требуется
+		return new Variable(var->name());
+	}
+	Expression* transformComparison(Comparison const* cmp) { // оба операнда числа — сворачиваем
+		Expression* L = cmp->left()->transform(this);
+		Expression* R = cmp->right()->transform(this);
+		Comparison* newCmp = new Comparison(L, cmp->operation(), R);
+		if (dynamic_cast<Number*>(L) && dynamic_cast<Number*>(R)) {
+			Expression* foldConst = new Number(newCmp->evaluate());
+			delete newCmp;
+			return foldConst;
+		}
+		return newCmp;
+	}
+	Expression* transformSelect(Select const* sel) { // известное условие оставляет одну ветвь
+		Expression* C = sel->condition()->transform(this);
+		if (Number* C_numb = dynamic_cast<Number*>(C)) {
+			Expression* chosen = (C_numb->value() != 0.0 ? sel->then() : sel->otherwise())->transform(this);
+			delete C;
+			return chosen;
+		}
+		return new Select(C, sel->then()->transform(this), sel->otherwise()->transform(this));
+	}
+	Expression* transformMinMax(MinMax const* mm) {
+		Expression* L = mm->left()->transform(this);
+		Expression* R = mm->right()->transform(this);
+		MinMax* newMinMax = new MinMax(mm->kind(), L, R);
+		if (dynamic_cast<Number*>(L) && dynamic_cast<Number*>(R)) {
+			Expression* foldConst = new Number(newMinMax->evaluate());
+			delete newMinMax;
+			return foldConst;
+		}
+		return newMinMax;
+	}
+	Expression* transformNegate(Negate const* neg) {
+		Expression* Arg = neg->operand()->transform(this);
+		if (Number* Arg_numb = dynamic_cast<Number*>(Arg)) {
+			Expression* foldConst = new Number(-Arg_numb->value());
+			delete Arg;
+			return foldConst;
+		}
+		return new Negate(Arg);
+	}
+	Expression* transformIntPower(IntPower const* power) {
+		Expression* Base = power->base()->transform(this);
+		IntPower* newPower = new IntPower(Base, power->exponent());
+		if (dynamic_cast<Number*>(Base)) {
+			Expression* foldConst = new Number(newPower->evaluate());
+			delete newPower;
+			return foldConst;
+		}
+		return newPower;
+	}
+	Expression* transformSum(Sum const* sum) { // сумма одинаковых чисел сворачивается
+		Expression* Body = sum->body()->transform(this);
+		Sum* newSum = new Sum(sum->index(), sum->from(), sum->to(), Body, sum->mode());
+		if (dynamic_cast<Number*>(Body)) {
+			Expression* foldConst = new Number(newSum->evaluate());
+			delete newSum;
+			return foldConst;
+		}
+		return newSum;
+	}
+	Expression* transformIndexedVariable(IndexedVariable const* var) {
+		return new IndexedVariable(var->name(), var->index(), var->offset());
+	}
+	Expression* transformDot(Dot const* dot) { // значения массивов известны только при вычислении
+		return new Dot(dot->left(), dot->right());
+	}
+};
+
+struct BigInt { // неотрицательное целое произвольной длины, 32-битные цифры от младшей
+	std::vector<std::uint32_t> digits; // без ведущих нулей, у нуля пусто
+
+	BigInt(std::uint64_t value = 0) {
+		for (; value; value >>= 32)
+			digits.push_back(static_cast<std::uint32_t>(value));
+	}
+	bool zero() const { return digits.empty(); }
+	size_t bits() const { // длина в битах
+		if (digits.empty()) return 0;
+		size_t n = 32 * (digits.size() - 1);
+		for (std::uint32_t top = digits.back(); top; top >>= 1) ++n;
+		return n;
+	}
+	bool bit(size_t i) const { return i / 32 < digits.size() && (digits[i / 32] >> (i % 32) & 1); }
+	size_t trailingZeros() const { // для ненулевого числа
+		size_t i = 0;
+		while (!bit(i)) ++i;
+		return i;
+	}
+	void trim() {
+		while (!digits.empty() && !digits.back()) digits.pop_back();
+	}
+	static int compare(BigInt const& a, BigInt const& b) {
+		if (a.digits.size() != b.digits.size()) return a.digits.size() < b.digits.size() ? -1 : 1;
+		for (size_t i = a.digits.size(); i-- > 0; )
+			if (a.digits[i] != b.digits[i]) return a.digits[i] < b.digits[i] ? -1 : 1;
+		return 0;
+	}
+	static BigInt add(BigInt const& a, BigInt const& b) {
+		BigInt r;
+		std::uint64_t carry = 0;
+		for (size_t i = 0; i < a.digits.size() || i < b.digits.size() || carry; ++i) {
+			carry += std::uint64_t(i < a.digits.size() ? a.digits[i] : 0) + (i < b.digits.size() ? b.digits[i] : 0);
+			r.digits.push_back(static_cast<std::uint32_t>(carry));
+			carry >>= 32;
+		}
+		return r;
+	}
+	static BigInt subtract(BigInt const& a, BigInt const& b) { // a >= b
+		BigInt r(a);
+		std::int64_t borrow = 0;
+		for (size_t i = 0; i < r.digits.size(); ++i) {
+			std::int64_t d = std::int64_t(r.digits[i]) - (i < b.digits.size() ? b.digits[i] : 0) - borrow;
+			borrow = d < 0;
+			r.digits[i] = static_cast<std::uint32_t>(d + (borrow << 32));
+		}
+		r.trim();
+		return r;
+	}
+	static BigInt multiply(BigInt const& a, BigInt const& b) { // столбиком: длины ограничены вызывающим
+		BigInt r;
+		if (a.zero() || b.zero()) return r;
+		r.digits.assign(a.digits.size() + b.digits.size(), 0);
+		for (size_t i = 0; i < a.digits.size(); ++i) {
+			std::uint64_t carry = 0;
+			for (size_t j = 0; j < b.digits.size(); ++j) {
+				carry += std::uint64_t(a.digits[i]) * b.digits[j] + r.digits[i + j];
+				r.digits[i + j] = static_cast<std::uint32_t>(carry);
+				carry >>= 32;
+			}
+			r.digits[i + b.digits.size()] = static_cast<std::uint32_t>(carry);
+		}
+		r.trim();
+		return r;
+	}
+	BigInt shifted(long count) const { // умножение на 2^count, при count < 0 — деление с отбрасыванием
+		BigInt r;
+		if (zero()) return r;
+		if (count >= 0) {
+			r.digits.assign(count / 32, 0);
+			std::uint32_t carry = 0;
+			int s = count % 32;
+			for (size_t i = 0; i < digits.size(); ++i) {
+				r.digits.push_back(digits[i] << s | carry);
+				carry = s ? digits[i] >> (32 - s) : 0;
+			}
+			r.digits.push_back(carry);
+		}
+		else {
+			size_t skip = static_cast<size_t>(-count) / 32;
+			int s = static_cast<int>(-count % 32);
+			for (size_t i = skip; i < digits.size(); ++i)
+				r.digits.push_back(digits[i] >> s | (s && i + 1 < digits.size() ? digits[i + 1] << (32 - s) : 0));
+		}
+		r.trim();
+		return r;
+	}
+	static BigInt gcd(BigInt a, BigInt b) { // двоичный алгоритм: только сдвиги и вычитания
+		if (a.zero()) return b;
+		if (b.zero()) return a;
+		size_t common = std::min(a.trailingZeros(), b.trailingZeros());
+		a = a.shifted(-static_cast<long>(a.trailingZeros()));
+		while (!b.zero()) {
+			b = b.shifted(-static_cast<long>(b.trailingZeros()));
+			if (compare(a, b) > 0) std::swap(a, b);
+			b = subtract(b, a);
+		}
+		return a.shifted(static_cast<long>(common));
+	}
+};
+
+struct Rational { // точное значение num/den со знаком; den > 0, дробь несократима
+	bool negative = false;
+	BigInt num, den = BigInt(1);
+
+	static Rational fromDouble(double value) { // каждое конечное double — двоичная дробь
+		assert(std::isfinite(value));
+		Rational r;
+		int exponent;
+		double mantissa = std::frexp(std::fabs(value), &exponent); // value = m * 2^e, 0.5 <= m < 1
+		r.negative = value < 0.0;
+		r.num = BigInt(static_cast<std::uint64_t>(std::ldexp(mantissa, 53)));
+		exponent -= 53;
+		if (exponent >= 0) r.num = r.num.shifted(exponent);
+		else r.den = r.den.shifted(-exponent);
+		r.reduce();
+		return r;
+	}
+	size_t bits() const { return std::max(num.bits(), den.bits()); }
+
+	static int compare(Rational const& a, Rational const& b) { // -1, 0, 1
+		if (a.negative != b.negative)
+			return a.negative ? -1 : 1;
+		int c = BigInt::compare(BigInt::multiply(a.num, b.den), BigInt::multiply(b.num, a.den));
+		return a.negative ? -c : c;
+	}
+
+	void reduce() {
+		if (num.zero()) {
+			negative = false;
+			den = BigInt(1);
+			return;
+		}
+		long twos = static_cast<long>(std::min(num.trailingZeros(), den.trailingZeros()));
+		num = num.shifted(-twos);
+		den = den.shifted(-twos);
+		if (den.bits() == 1) return; // знаменатель 1 — сокращать нечего
+		if (den.bit(0) || num.bit(0)) { // общий нечётный множитель бывает только после деления
+			BigInt g = BigInt::gcd(num, den);
+			if (g.bits() > 1) {
+				num = divideExact(num, g);
+				den = divideExact(den, g);
+			}
+		}
+	}
+
+	static BigInt divideExact(BigInt const& a, BigInt const& b) { // a делится на b без остатка
+		BigInt q, rest(a);
+		for (long i = static_cast<long>(a.bits()) - static_cast<long>(b.bits()); i >= 0; --i) {
+			BigInt part = b.shifted(i);
+			if (BigInt::compare(part, rest) <= 0) {
+				rest = BigInt::subtract(rest, part);
+				q = BigInt::add(q, BigInt(1).shifted(i));
+			}
+		}
+		return q;
+	}
+
+	static Rational add(Rational const& a, Rational const& b, bool subtract) {
+		Rational r;
+		BigInt x = BigInt::multiply(a.num, b.den), y = BigInt::multiply(b.num, a.den);
+		bool yNegative = b.negative != subtract;
+		if (a.negative == yNegative) {
+			r.num = BigInt::add(x, y);
+			r.negative = a.negative;
+		}
+		else if (BigInt::compare(x, y) >= 0) {
+			r.num = BigInt::subtract(x, y);
+			r.negative = a.negative;
+		}
+		else {
+			r.num = BigInt::subtract(y, x);
+			r.negative = yNegative;
+		}
+		r.den = BigInt::multiply(a.den, b.den);
+		r.reduce();
+		return r;
+	}
+	static Rational multiply(Rational const& a, Rational const& b, bool divide) { // при divide b != 0
+		Rational r;
+		r.num = BigInt::multiply(a.num, divide ? b.den : b.num);
+		r.den = BigInt::multiply(a.den, divide ? b.num : b.den);
+		r.negative = a.negative != b.negative;
+		r.reduce();
+		return r;
+	}
+
+	double toDouble() const { // одно округление к ближайшему (к чётному при равенстве)
+		if (num.zero()) return 0.0;
+		long k = 56 - (static_cast<long>(num.bits()) - static_cast<long>(den.bits())); // частное — 55-57 бит
+		BigInt rest = k >= 0 ? num.shifted(k) : num, divisor = k >= 0 ? den : den.shifted(-k);
+		std::uint64_t q = 0;
+		for (int i = 57; i >= 0; --i) {
+			BigInt part = divisor.shifted(i);
+			if (BigInt::compare(part, rest) <= 0) {
+				rest = BigInt::subtract(rest, part);
+				q |= std::uint64_t(1) << i;
+			}
+		}
+		bool sticky = !rest.zero();
+		int length = 0;
+		for (std::uint64_t v = q; v; v >>= 1) ++length;
+		long exponent = length - 1 - k; // значение в [2^exponent, 2^(exponent+1))
+		long precision = exponent >= -1022 ? 53 : 53 - (-1022 - exponent); // у денормализованных бит меньше
+		long drop = length - precision;
+		std::uint64_t mantissa;
+		if (drop > 63)
+			mantissa = 0; // меньше половины наименьшего денормализованного
+		else {
+			mantissa = q >> drop;
+			std::uint64_t tail = q & ((std::uint64_t(1) << drop) - 1), half = std::uint64_t(1) << (drop - 1);
+			if (tail > half || (tail == half && (sticky || (mantissa & 1))))
+				++mantissa;
+		}
+		double value = std::ldexp(static_cast<double>(mantissa), static_cast<int>(drop - k));
+		return negative ? -value : value;
+	}
+};
+
+// Свёртка констант в точной рациональной арифметике: значения чисел хранятся рядом с деревом
+// и округляются до double один раз, при создании каждого свёрнутого Number. Если точное значение
+// получить нельзя — иррациональный sqrt, деление на ноль или длина числителя либо знаменателя
+// больше maxBits, — дальше вверх по дереву свёртка идёт в double, как в FoldConstants. Предел
+// длины ограничивает цену одной операции, поэтому время остаётся линейным по размеру дерева.
+struct FoldConstantsExact : Transformer {
+	FoldConstantsExact(size_t maxBits = 2048) : maxBits_(maxBits) {}
+
+	Expression* transformNumber(Number const* number) {
+		Number* copy = new Number(number->value());
+		bool finite = std::isfinite(number->value()); // inf и NaN — не дроби, точного значения нет
+		remember(copy, finite, finite ? Rational::fromDouble(number->value()) : Rational());
+		return copy;
+	}
+	Expression* transformBinaryOperation(BinaryOperation const* binop) {
+		Expression* L = (binop->left())->transform(this);
+		Expression* R = (binop->right())->transform(this);
+		BinaryOperation* newBinop = new BinaryOperation(L, binop->operation(), R);
+		if (!dynamic_cast<Number*>(L) || !dynamic_cast<Number*>(R)) {
+			forget(L);
+			forget(R);
+			return newBinop;
+		}
+		std::map<Expression const*, Rational>::const_iterator a = exact_.find(L), b = exact_.find(R);
+		Rational value;
+		bool exact = a != exact_.end() && b != exact_.end()
+			&& !(binop->operation() == BinaryOperation::DIV && b->second.num.zero());
+		if (exact) {
+			switch (binop->operation()) {
+			case BinaryOperation::PLUS: value = Rational::add(a->second, b->second, false); break;
+			case BinaryOperation::MINUS: value = Rational::add(a->second, b->second, true); break;
+			case BinaryOperation::MUL: value = Rational::multiply(a->second, b->second, false); break;
+			default: value = Rational::multiply(a->second, b->second, true); break;
+			}
+		}
+		Number* folded = new Number(exact ? value.toDouble() : newBinop->evaluate());
+		forget(L);
+		forget(R);
+		delete newBinop;
+		remember(folded, exact, value);
+		return folded;
+	}
+	Expression* transformFunctionCall(FunctionCall const* fcall) {
+		std::vector<Expression const*> args;
+		bool numbers = true;
+		for (size_t i = 0; i < fcall->arity(); ++i) {
+			args.push_back(fcall->arg(i)->transform(this));
+			numbers = numbers && dynamic_cast<Number const*>(args.back());
+		}
+		FunctionCall* newFcall = new FunctionCall(fcall->name(), args);
+		if (!numbers) {
+			for (size_t i = 0; i < args.size(); ++i)
+				forget(args[i]);
+			return newFcall;
+		}
+		Rational x[3];
+		bool exact = true;
+		for (size_t i = 0; i < args.size(); ++i) {
+			std::map<Expression const*, Rational>::const_iterator found = exact_.find(args[i]);
+			exact = exact && found != exact_.end();
+			if (found != exact_.end())
+				x[i] = found->second;
+		}
+		Rational value;
+		double result = newFcall->evaluate();
+		switch (fcall->id()) {
+		case FunctionCall::ABS:
+			if (exact) {
+				value = x[0];
+				value.negative = false;
+				result = value.toDouble();
+			}
+			break;
+		case FunctionCall::SQRT:
+			exact = exact && std::isfinite(result) && !x[0].negative; // корень из отрицательного — NaN
+			if (exact) { // корень точен, только если квадрат округлённого корня равен аргументу
+				value = Rational::fromDouble(result);
+				Rational square = Rational::multiply(value, value, false);
+				exact = BigInt::compare(square.num, x[0].num) == 0 && BigInt::compare(square.den, x[0].den) == 0;
+			}
+			break;
+		case FunctionCall::POW: { // целая степень точна, пока длина не больше maxBits
+			double n = static_cast<Number const*>(args[1])->value();
+			exact = exact && FunctionCall::smallInteger(n) && !(n < 0.0 && x[0].num.zero());
+			value = Rational::fromDouble(1.0);
+			for (long e = static_cast<long>(std::fabs(n)); exact && e; --e) {
+				value = Rational::multiply(value, x[0], false);
+				exact = value.bits() <= maxBits_;
+			}
+			if (exact && n < 0.0)
+				value = Rational::multiply(Rational::fromDouble(1.0), value, true);
+			if (exact && !value.num.zero()) // у нуля знак берём из double
+				result = value.toDouble();
+			break;
+		}
+		case FunctionCall::FMA: // a * b + c с одним округлением — то же, что std::fma
+			if (exact) {
+				value = Rational::add(Rational::multiply(x[0], x[1], false), x[2], false);
+				if (!value.num.zero())
+					result = value.toDouble();
+			}
+			break;
+		default: // hypot и atan2 от рациональных чисел обычно иррациональны
+			exact = false;
+			break;
+		}
+		for (size_t i = 0; i < args.size(); ++i)
+			forget(args[i]);
+		delete newFcall;
+		Number* folded = new Number(result);
+		remember(folded, exact, value);
+		return folded;
+	}
+	Expression* transformVariable(Variable const* var) {
+		return new Variable(var->name());
+	}
+	Expression* transformComparison(Comparison const* cmp) {
+		Expression* L = cmp->left()->transform(this);
+		Expression* R = cmp->right()->transform(this);
+		Comparison* newCmp = new Comparison(L, cmp->operation(), R);
+		if (!dynamic_cast<Number*>(L) || !dynamic_cast<Number*>(R)) {
+			forget(L);
+			forget(R);
+			return newCmp;
+		}
+		std::map<Expression const*, Rational>::const_iterator a = exact_.find(L), b = exact_.find(R);
+		double result = newCmp->evaluate();
+		if (a != exact_.end() && b != exact_.end()) // точное сравнение, а не сравнение округлённых
+			result = Comparison::holds(cmp->operation(), Rational::compare(a->second, b->second), 0) ? 1.0 : 0.0;
+		forget(L);
+		forget(R);
+		delete newCmp;
+		Number* folded = new Number(result);
+		remember(folded, true, Rational::fromDouble(result));
+		return folded;
+	}
+	Expression* transformSelect(Select const* sel) {
+		Expression* C = sel->condition()->transform(this);
+		if (Number* C_numb = dynamic_cast<Number*>(C)) { // у выбранной ветви остаётся её точное значение
+			std::map<Expression const*, Rational>::const_iterator c = exact_.find(C);
+			bool chosen = c != exact_.end() ? !c->second.num.zero() : C_numb->value() != 0.0;
+			forget(C);
+			delete C;
+			return (chosen ? sel->then() : sel->otherwise())->transform(this);
+		}
+		forget(C);
+		Expression* T = sel->then()->transform(this);
+		Expression* E = sel->otherwise()->transform(this);
+		forget(T);
+		forget(E);
+		return new Select(C, T, E);
+	}
+	Expression* transformMinMax(MinMax const* mm) {
+		Expression* L = mm->left()->transform(this);
+		Expression* R = mm->right()->transform(this);
+		MinMax* newMinMax = new MinMax(mm->kind(), L, R);
+		if (!dynamic_cast<Number*>(L) || !dynamic_cast<Number*>(R)) {
+			forget(L);
+			forget(R);
+			return newMinMax;
+		}
+		std::map<Expression const*, Rational>::const_iterator a = exact_.find(L), b = exact_.find(R);
+		bool exact = a != exact_.end() && b != exact_.end();
+		Rational value;
+		double result = newMinMax->evaluate();
+		if (exact) {
+			int c = Rational::compare(a->second, b->second);
+			value = (mm->kind() == MinMax::MIN ? c < 0 : c > 0) ? a->second : b->second;
+			result = value.toDouble();
+		}
+		forget(L);
+		forget(R);
+		delete newMinMax;
+		Number* folded = new Number(result);
+		remember(folded, exact, value);
+		return folded;
+	}
+	Expression* transformNegate(Negate const* neg) {
+		Expression* Arg = neg->operand()->transform(this);
+		Number* Arg_numb = dynamic_cast<Number*>(Arg);
+		if (!Arg_numb) {
+			forget(Arg);
+			return new Negate(Arg);
+		}
+		std::map<Expression const*, Rational>::const_iterator a = exact_.find(Arg);
+		bool exact = a != exact_.end();
+		Rational value;
+		if (exact) {
+			value = a->second;
+			value.negative = !value.negative && !value.num.zero();
+		}
+		Number* folded = new Number(-Arg_numb->value()); // смена знака точна и в double
+		forget(Arg);
+		delete Arg;
+		remember(folded, exact, value);
+		return folded;
+	}
+	Expression* transformIntPower(IntPower const* power) { // умножения по той же цепочке, пока длина не больше maxBits
+		Expression* Base = power->base()->transform(this);
+		IntPower* newPower = new IntPower(Base, power->exponent());
+		if (!dynamic_cast<Number*>(Base)) {
+			forget(Base);
+			return newPower;
+		}
+		std::map<Expression const*, Rational>::const_iterator a = exact_.find(Base);
+		bool exact = a != exact_.end() && !(power->exponent() < 0 && a->second.num.zero());
+		std::vector<Rational> values;
+		if (exact)
+			values.push_back(a->second);
+		IntPower::Chain const& steps = power->steps();
+		for (size_t k = 0; exact && k < steps.size(); ++k) {
+			values.push_back(Rational::multiply(values[steps[k].first], values[steps[k].second], false));
+			exact = values.back().bits() <= maxBits_;
+		}
+		Rational value;
+		double result = newPower->evaluate();
+		if (exact) {
+			value = power->exponent() == 0 ? Rational::fromDouble(1.0) : values.back();
+			if (power->exponent() < 0)
+				value = Rational::multiply(Rational::fromDouble(1.0), value, true);
+			if (!value.num.zero()) // у нуля знак берём из double
+				result = value.toDouble();
+		}
+		forget(Base);
+		delete newPower;
+		Number* folded = new Number(result);
+		remember(folded, exact, value);
+		return folded;
+	}
+	Expression* transformSum(Sum const* sum) { // count одинаковых слагаемых — одно точное умножение
+		Expression* Body = sum->body()->transform(this);
+		Sum* newSum = new Sum(sum->index(), sum->from(), sum->to(), Body, sum->mode());
+		if (!dynamic_cast<Number*>(Body)) {
+			forget(Body);
+			return newSum;
+		}
+		std::map<Expression const*, Rational>::const_iterator a = exact_.find(Body);
+		bool exact = a != exact_.end();
+		Rational value;
+		double result = newSum->evaluate();
+		if (exact) {
+			value = Rational::multiply(Rational::fromDouble(static_cast<double>(sum->count())), a->second, false);
+			if (!value.num.zero()) // у нуля знак берём из double
+				result = value.toDouble();
+		}
+		forget(Body);
+		delete newSum;
+		Number* folded = new Number(result);
+		remember(folded, exact, value);
+		return folded;
+	}
+	Expression* transformIndexedVariable(IndexedVariable const* var) {
+		return new IndexedVariable(var->name(), var->index(), var->offset());
+	}
+	Expression* transformDot(Dot const* dot) { // значения массивов известны только при вычислении
+		return new Dot(dot->left(), dot->right());
+	}
+
+private:
+	// адрес свёрнутого числа может достаться новому Number, поэтому запись заводится заново при
+	// каждом создании числа и удаляется, как только число стало операндом
+	void remember(Number const* number, bool exact, Rational const& value) {
+		if (exact && value.bits() <= maxBits_)
+			exact_[number] = value;
+		else
+			exact_.erase(number);
+	}
+	void forget(Expression const* expr) { exact_.erase(expr); }
+
+	size_t maxBits_;
+	std::map<Expression const*, Rational> exact_; // точные значения чисел, созданных этим обходом
+};
+
+void printExpr(const Expression* expression) { //Вывод выражения на экран
+	const Number* numb = dynamic_cast<const Number*>(expression);
+	if (numb) {
+		std::cout << numb->value();
+	}
+	else {
+		const BinaryOperation* binop = dynamic_cast<const BinaryOperation*>(expression);
+		if (binop) {
+			printExpr(binop->left());
+			std::cout << static_cast<char>(binop->operation());
+			printExpr(binop->right());
+		}
+		else {
+			const FunctionCall* funCall = dynamic_cast<const FunctionCall*>(expression);
+			if (funCall) {
+				std::cout << funCall->name() + "(";
+				for (size_t i = 0; i < funCall->arity(); ++i) {
+					if (i)
+						std::cout << ",";
+					printExpr(funCall->arg(i));
+				}
+				std::cout << ")";
+			}
+			else if (const Comparison* cmp = dynamic_cast<const Comparison*>(expression)) {
+				std::cout << "(";
+				printExpr(cmp->left());
+				std::cout << Comparison::symbol(cmp->operation());
+				printExpr(cmp->right());
+				std::cout << ")";
+			}
+			else if (const Select* sel = dynamic_cast<const Select*>(expression)) {
+				std::cout << "select(";
+				printExpr(sel->condition());
+				std::cout << ",";
+				printExpr(sel->then());
+				std::cout << ",";
+				printExpr(sel->otherwise());
+				std::cout << ")";
+			}
+			else if (const MinMax* mm = dynamic_cast<const MinMax*>(expression)) {
+				std::cout << mm->name() << "(";
+				printExpr(mm->left());
+				std::cout << ",";
+				printExpr(mm->right());
+				std::cout << ")";
+			}
+			else if (const Negate* neg = dynamic_cast<const Negate*>(expression)) { // скобки, если операнд составной
+				bool leaf = dynamic_cast<const Number*>(neg->operand()) || dynamic_cast<const Variable*>(neg->operand())
+					|| dynamic_cast<const IndexedVariable*>(neg->operand());
+				std::cout << (leaf ? "-" : "-(");
+				printExpr(neg->operand());
+				std::cout << (leaf ? "" : ")");
+			}
+			else if (const IntPower* power = dynamic_cast<const IntPower*>(expression)) {
+				bool leaf = dynamic_cast<const Variable*>(power->base()) || dynamic_cast<const IndexedVariable*>(power->base());
+				std::cout << (leaf ? "" : "(");
+				printExpr(power->base());
+				std::cout << (leaf ? "^" : ")^") << power->exponent();
+			}
+			else if (const Sum* sum = dynamic_cast<const Sum*>(expression)) {
+				std::cout << Sum::name(sum->mode()) << "(" << sum->index() << "," << sum->from() << "," << sum->to() << ",";
+				printExpr(sum->body());
+				std::cout << ")";
+			}
+			else if (const IndexedVariable* element = dynamic_cast<const IndexedVariable*>(expression)) {
+				std::cout << element->element();
+			}
+			else if (const Dot* dot = dynamic_cast<const Dot*>(expression)) {
+				std::cout << "dot(" << dot->left().text() << "," << dot->right().text() << ")";
+			}
+			else {
+				const Variable* var = dynamic_cast<const Variable*>(expression);
+				std::cout << var->name();
+			}
+		}
+	}
+}
+
+#ifdef LR6_INSTRUMENT
+static_assert(FunctionCall::FUNCTIONS <= EvaluationProfile::COMPARISON - EvaluationProfile::FUNCTION, "мало видов для функций");
+
+inline std::string evaluationKindName(int kind) {
+	static char const* const names[] = { "Number", "Variable", "BinaryOperation +", "BinaryOperation -", "BinaryOperation *",
+		"BinaryOperation /" };
+	if (kind < EvaluationProfile::FUNCTION)
+		return names[kind];
+	if (kind < EvaluationProfile::COMPARISON)
+		return std::string("FunctionCall ") + FunctionCall::info(kind - EvaluationProfile::FUNCTION).name;
+	static char const* const others[] = { "Comparison", "Select", "MinMax", "Negate", "IntPower", "Sum", "IndexedVariable", "Dot" };
+	return others[kind - EvaluationProfile::COMPARISON];
+}
+
+// отчёт профиля текущего потока: вычисления и средние такты по видам узлов, затем top самых
+// дорогих поддеревьев — оценка всех их тактов (с потомками) по выборке
+void printEvaluationProfile(size_t top = 5) {
+	EvaluationProfile const& profile = EvaluationProfile::current();
+	std::cout << "вычислений по видам узлов (такты — среднее по выборке 1/" << EvaluationProfile::SAMPLE << ", с потомками):" << std::endl;
+	for (int k = 0; k < EvaluationProfile::KINDS; ++k) {
+		if (!profile.counts[k])
+			continue;
+		std::cout << "  " << evaluationKindName(k) << ": " << profile.counts[k];
+		if (profile.samples[k])
+			std::cout << ", " << profile.cycles[k] / profile.samples[k] << " тактов";
+		std::cout << std::endl;
+	}
+	std::vector<std::pair<std::uint64_t, Expression const*> > costly;
+	for (std::map<Expression const*, EvaluationProfile::NodeCost>::const_iterator it = profile.nodes.begin(); it != profile.nodes.end(); ++it)
+		costly.push_back(std::make_pair(it->second.cycles * EvaluationProfile::SAMPLE, it->first));
+	std::sort(costly.begin(), costly.end());
+	std::cout << "самые дорогие поддеревья:" << std::endl;
+	for (size_t i = 0; i < top && i < costly.size(); ++i) {
+		Expression const* node = costly[costly.size() - 1 - i].second;
+		std::cout << "  ~" << costly[costly.size() - 1 - i].first << " тактов: ";
+		printExpr(node);
+		std::cout << std::endl;
+	}
+}
+#endif
+
+// Вычисление того же дерева в другом числовом типе T (float, long double, Interval, Dual...).
+// От T нужны конструктор из double, операции + - * / и функции sqrt и abs: для встроенных
+// типов — из std, для своих — находятся по аргументу. Числа формулы хранятся как double;
+// переменные без значения в vars равны нулю, как в Variable::evaluate. Сравнение, выбор,
+// min/max, функции из реестра FunctionCall и целая степень для встроенных типов — шаблоны
+// ниже, свои типы определяют перегрузки этих функций. Смена знака — унарный минус T.
+// Элементы массивов берутся из arrays; элементы без значения, как и переменные, равны нулю,
+// массивы без значения пусты.
+template<class T> T compareValues(int op, T const& a, T const& b) { return T(Comparison::holds(op, a, b) ? 1.0 : 0.0); }
+template<class T> T selectValue(T const& condition, T const& then, T const& otherwise) {
+	return condition != T(0.0) ? then : otherwise;
+}
+template<class T> T minMaxValue(int kind, T const& a, T const& b) { return MinMax::apply(kind, a, b); }
+template<class T> T callValue(int id, std::vector<T> const& args) { return FunctionCall::apply(id, args.data()); }
+template<class T> T integerPowerValue(T const& base, IntPower const* power) {
+	return IntPower::apply(base, power->exponent(), power->steps());
+}
+template<class T> struct SumAccumulator { // слагаемые суммы приходят порциями; свои типы специализируют
+	explicit SumAccumulator(SumMode mode) : total_(mode) {}
+	void add(T const* terms, size_t n) { total_.add(terms, n); }
+	T result() const { return total_.result(); }
+private:
+	Summation<T> total_;
+};
+
+bool usesIndex(Expression const* expr, std::string const& index); // ниже, рядом с operandsOf
+
+typedef std::map<std::string, std::vector<double> > ArrayValues; // массивы по именам, values[k] — элемент k
+
+// indices — текущие значения индексов объемлющих сумм
+template<class T>
+T evaluateAs(Expression const* expression, std::map<std::string, T> const& vars = std::map<std::string, T>(),
+	ArrayValues const& arrays = ArrayValues(), std::map<std::string, long> const& indices = std::map<std::string, long>()) {
+	using std::sqrt;
+	using std::abs;
+	if (const Number* numb = dynamic_cast<const Number*>(expression))
+		return T(numb->value());
+	if (const BinaryOperation* binop = dynamic_cast<const BinaryOperation*>(expression)) {
+		T left = evaluateAs(binop->left(), vars, arrays, indices);
+		T right = evaluateAs(binop->right(), vars, arrays, indices);
+		switch (binop->operation()) {
+		case BinaryOperation::PLUS: return left + right;
+		case BinaryOperation::MINUS: return left - right;
+		case BinaryOperation::DIV: return left / right;
+		default: return left * right;
+		}
+	}
+	if (const FunctionCall* funCall = dynamic_cast<const FunctionCall*>(expression)) {
+		std::vector<T> args;
+		for (size_t i = 0; i < funCall->arity(); ++i)
+			args.push_back(evaluateAs(funCall->arg(i), vars, arrays, indices));
+		if (funCall->id() == FunctionCall::SQRT)
+			return sqrt(args[0]);
+		if (funCall->id() == FunctionCall::ABS)
+			return abs(args[0]);
+		return callValue(funCall->id(), args);
+	}
+	if (const Comparison* cmp = dynamic_cast<const Comparison*>(expression))
+		return compareValues(cmp->operation(), evaluateAs(cmp->left(), vars, arrays, indices), evaluateAs(cmp->right(), vars, arrays, indices));
+	if (const Select* sel = dynamic_cast<const Select*>(expression))
+		return selectValue(evaluateAs(sel->condition(), vars, arrays, indices), evaluateAs(sel->then(), vars, arrays, indices), evaluateAs(sel->otherwise(), vars, arrays, indices));
+	if (const MinMax* mm = dynamic_cast<const MinMax*>(expression))
+		return minMaxValue(mm->kind(), evaluateAs(mm->left(), vars, arrays, indices), evaluateAs(mm->right(), vars, arrays, indices));
+	if (const Negate* neg = dynamic_cast<const Negate*>(expression))
+		return -evaluateAs(neg->operand(), vars, arrays, indices);
+	if (const IntPower* power = dynamic_cast<const IntPower*>(expression))
+		return integerPowerValue(evaluateAs(power->base(), vars, arrays, indices), power);
+	if (const Sum* sum = dynamic_cast<const Sum*>(expression)) { // индекс — и переменная тела, и номер элемента
+		if (!sum->count())
+			return T(0.0);
+		if (!usesIndex(sum->body(), sum->index())) // слагаемые одинаковы: тело считается один раз
+			return Sum::uniform(sum->count(), evaluateAs(sum->body(), vars, arrays, indices));
+		std::map<std::string, T> inner(vars);
+		std::map<std::string, long> current(indices);
+		std::vector<T> terms; // не больше BLOCK слагаемых: остальные уже в total
+		terms.reserve(Summation<T>::BLOCK);
+		SumAccumulator<T> total(sum->mode());
+		for (size_t k = 0; k < sum->count(); ++k) {
+			long i = sum->from() + static_cast<long>(k);
+			inner[sum->index()] = T(static_cast<double>(i));
+			current[sum->index()] = i;
+			terms.push_back(evaluateAs(sum->body(), inner, arrays, current));
+			if (terms.size() == Summation<T>::BLOCK || k + 1 == sum->count()) {
+				total.add(terms.data(), terms.size());
+				terms.clear();
+			}
+		}
+		return total.result();
+	}
+	if (const IndexedVariable* element = dynamic_cast<const IndexedVariable*>(expression)) {
+		std::map<std::string, long>::const_iterator index = indices.find(element->index());
+		ArrayValues::const_iterator values = arrays.find(element->name());
+		assert(index != indices.end()); // элемент бывает только внутри суммы по своему индексу
+		long k = index->second + element->offset();
+		return values != arrays.end() && k >= 0 && static_cast<size_t>(k) < values->second.size() ? T(values->second[k]) : T(0.0);
+	}
+	if (const Dot* dot = dynamic_cast<const Dot*>(expression))
+		return dot->value<T>([&arrays](std::string const& name) {
+			ArrayValues::const_iterator found = arrays.find(name);
+			return found != arrays.end() ? std::span<double const>(found->second) : std::span<double const>();
+		});
+	const Variable* var = dynamic_cast<const Variable*>(expression);
+	assert(var);
+	typename std::map<std::string, T>::const_iterator found = vars.find(var->name());
+	return found != vars.end() ? found->second : T(0.0);
+}
+
+struct Interval { // отрезок, гарантированно содержащий точное значение: границы округляются наружу
+	Interval(double value = 0.0) : lo(value), hi(value) {}
+	Interval(double low, double high) : lo(low), hi(high) {}
+	double lo, hi;
+
+	static Interval outward(double low, double high) { // на ulp шире результата с округлением
+		return Interval(std::nextafter(low, -HUGE_VAL), std::nextafter(high, HUGE_VAL));
+	}
+	friend Interval operator-(Interval const& a) { return Interval(-a.hi, -a.lo); }
+	friend Interval operator+(Interval const& a, Interval const& b) { return outward(a.lo + b.lo, a.hi + b.hi); }
+	friend Interval operator-(Interval const& a, Interval const& b) { return outward(a.lo - b.hi, a.hi - b.lo); }
+	friend Interval operator*(Interval const& a, Interval const& b) {
+		double p[4] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+		double low = p[0], high = p[0];
+		for (int i = 1; i < 4; ++i) {
+			low = p[i] < low ? p[i] : low;
+			high = p[i] > high ? p[i] : high;
+		}
+		return outward(low, high);
+	}
+	friend Interval operator/(Interval const& a, Interval const& b) {
+		if (b.lo <= 0.0 && b.hi >= 0.0) // делитель может быть нулём — значение любое
+			return Interval(-HUGE_VAL, HUGE_VAL);
+		return a * outward(1.0 / b.hi, 1.0 / b.lo);
+	}
+	friend Interval sqrt(Interval const& a) { // отрицательная часть отрезка отбрасывается
+		if (a.hi < 0.0)
+			return Interval(std::nan(""), std::nan(""));
+		Interval r = outward(std::sqrt(a.lo > 0.0 ? a.lo : 0.0), std::sqrt(a.hi));
+		r.lo = r.lo > 0.0 ? r.lo : 0.0;
+		return r;
+	}
+	friend Interval abs(Interval const& a) { // модуль точен, расширять не нужно
+		if (a.lo >= 0.0) return a;
+		if (a.hi <= 0.0) return Interval(-a.hi, -a.lo);
+		return Interval(0.0, -a.lo > a.hi ? -a.lo : a.hi);
+	}
+	// результат сравнения: [1, 1] или [0, 0], если оно решено для всех точек отрезков, иначе [0, 1]
+	friend Interval compareValues(int op, Interval const& a, Interval const& b) {
+		bool canBeTrue, canBeFalse;
+		bool single = a.lo == a.hi && b.lo == b.hi && a.lo == b.lo;
+		switch (op) {
+		case Comparison::LESS: canBeTrue = a.lo < b.hi; canBeFalse = a.hi >= b.lo; break;
+		case Comparison::LESS_EQUAL: canBeTrue = a.lo <= b.hi; canBeFalse = a.hi > b.lo; break;
+		case Comparison::GREATER: canBeTrue = a.hi > b.lo; canBeFalse = a.lo <= b.hi; break;
+		case Comparison::GREATER_EQUAL: canBeTrue = a.hi >= b.lo; canBeFalse = a.lo < b.hi; break;
+		case Comparison::EQUAL: canBeTrue = a.lo <= b.hi && b.lo <= a.hi; canBeFalse = !single; break;
+		default: canBeTrue = !single; canBeFalse = a.lo <= b.hi && b.lo <= a.hi; break;
+		}
+		return Interval(canBeFalse ? 0.0 : 1.0, canBeTrue ? 1.0 : 0.0);
+	}
+	friend Interval selectValue(Interval const& condition, Interval const& then, Interval const& otherwise) {
+		if (condition.lo > 0.0 || condition.hi < 0.0) return then;
+		if (condition.lo == 0.0 && condition.hi == 0.0) return otherwise;
+		return Interval(std::fmin(then.lo, otherwise.lo), std::fmax(then.hi, otherwise.hi)); // любая из ветвей
+	}
+	friend Interval minMaxValue(int kind, Interval const& a, Interval const& b) {
+		return kind == MinMax::MIN ? Interval(std::fmin(a.lo, b.lo), std::fmin(a.hi, b.hi))
+			: Interval(std::fmax(a.lo, b.lo), std::fmax(a.hi, b.hi));
+	}
+	friend Interval callValue(int id, std::vector<Interval> const& x) {
+		switch (id) {
+		case FunctionCall::SQRT: return sqrt(x[0]);
+		case FunctionCall::ABS: return abs(x[0]);
+		case FunctionCall::POW: return power(x[0], x[1]);
+		case FunctionCall::HYPOT: { // у неотрицательных отрезков произведение точное по границам
+			Interval a = abs(x[0]), b = abs(x[1]);
+			return sqrt(a * a + b * b);
+		}
+		case FunctionCall::ATAN2: return atan2(x[0], x[1]);
+		default: return x[0] * x[1] + x[2];
+		}
+	}
+	friend Interval integerPowerValue(Interval const& base, IntPower const* power) { // без зависимости множителей
+		return Interval::power(base, Interval(power->exponent()));
+	}
+	static Interval powerPoint(double v, long long n) { // v^n, n > 0: квадраты отрезка-точки |v| округляются наружу
+		Interval result(1.0), base(std::fabs(v));
+		for (long long e = n; e; e >>= 1) {
+			if (e & 1) result = result * base;
+			if (e > 1) base = base * base;
+		}
+		return v < 0.0 && n % 2 ? Interval(-result.hi, -result.lo) : result;
+	}
+	// целая степень-точка монотонна (чётная — по |x|), поэтому достаточно границ; иначе при x > 0
+	// pow монотонна по каждому аргументу и крайние значения в углах. Степень отрицательного
+	// числа с нецелым показателем не определена — отрезок не ограничен
+	static Interval power(Interval const& x, Interval const& y) {
+		if (y.lo == y.hi && y.lo == std::trunc(y.lo) && std::fabs(y.lo) <= 2147483648.0) {
+			long long n = static_cast<long long>(y.lo); // long в MSVC 32-битный, 2^31 в нём не помещается
+			if (n == 0)
+				return Interval(1.0);
+			Interval a = n % 2 ? x : abs(x);
+			long long m = n < 0 ? -n : n;
+			Interval result(powerPoint(a.lo, m).lo, powerPoint(a.hi, m).hi);
+			return n < 0 ? Interval(1.0) / result : result;
+		}
+		if (x.lo < 0.0 || (x.lo == 0.0 && y.lo <= 0.0))
+			return Interval(-HUGE_VAL, HUGE_VAL);
+		double p[4] = { std::pow(x.lo, y.lo), std::pow(x.lo, y.hi), std::pow(x.hi, y.lo), std::pow(x.hi, y.hi) };
+		return outward(std::fmin(std::fmin(p[0], p[1]), std::fmin(p[2], p[3])), std::fmax(std::fmax(p[0], p[1]), std::fmax(p[2], p[3])));
+	}
+	// угол выпуклого прямоугольника крайний в одной из вершин, если прямоугольник не содержит
+	// начала координат и не пересекает разрез atan2 по отрицательной полуоси x
+	friend Interval atan2(Interval const& y, Interval const& x) {
+		double const pi = std::atan2(0.0, -1.0);
+		bool origin = y.lo <= 0.0 && y.hi >= 0.0 && x.lo <= 0.0 && x.hi >= 0.0;
+		bool cut = x.lo < 0.0 && y.lo < 0.0 && y.hi >= 0.0;
+		if (origin || cut)
+			return outward(-pi, pi);
+		double p[4] = { std::atan2(y.lo, x.lo), std::atan2(y.lo, x.hi), std::atan2(y.hi, x.lo), std::atan2(y.hi, x.hi) };
+		return outward(std::fmin(std::fmin(p[0], p[1]), std::fmin(p[2], p[3])), std::fmax(std::fmax(p[0], p[1]), std::fmax(p[2], p[3])));
+	}
+};
+
+template<> struct SumAccumulator<Interval> { // каждое сложение округляется наружу при любом порядке
+	explicit SumAccumulator(SumMode) : total_(0.0) {}
+	void add(Interval const* terms, size_t n) {
+		for (size_t k = 0; k < n; ++k)
+			total_ = total_ + terms[k];
+	}
+	Interval result() const { return total_; }
+private:
+	Interval total_;
+};
+
+struct Dual { // дуальное число value + derivative*eps, eps^2 = 0: значение и производная за один проход
+	Dual(double v = 0.0, double d = 0.0) : value(v), derivative(d) {}
+	double value, derivative;
+
+	friend Dual operator-(Dual const& a) { return Dual(-a.value, -a.derivative); }
+	friend Dual operator+(Dual const& a, Dual const& b) { return Dual(a.value + b.value, a.derivative + b.derivative); }
+	friend Dual operator-(Dual const& a, Dual const& b) { return Dual(a.value - b.value, a.derivative - b.derivative); }
+	friend Dual operator*(Dual const& a, Dual const& b) {
+		return Dual(a.value * b.value, a.derivative * b.value + a.value * b.derivative);
+	}
+	friend Dual operator/(Dual const& a, Dual const& b) {
+		return Dual(a.value / b.value, (a.derivative * b.value - a.value * b.derivative) / (b.value * b.value));
+	}
+	friend Dual sqrt(Dual const& a) {
+		double root = std::sqrt(a.value);
+		return Dual(root, a.derivative / (2.0 * root));
+	}
+	friend Dual abs(Dual const& a) { return Dual(std::fabs(a.value), a.value < 0.0 ? -a.derivative : a.derivative); }
+	// ветвление по значению, производная — у выбранной ветви (в точке переключения её нет)
+	friend Dual compareValues(int op, Dual const& a, Dual const& b) { return Dual(Comparison::holds(op, a.value, b.value) ? 1.0 : 0.0); }
+	friend Dual selectValue(Dual const& condition, Dual const& then, Dual const& otherwise) {
+		return condition.value != 0.0 ? then : otherwise;
+	}
+	friend Dual minMaxValue(int kind, Dual const& a, Dual const& b) {
+		return MinMax::apply(kind, a.value, b.value) == a.value ? a : b;
+	}
+	friend Dual callValue(int id, std::vector<Dual> const& x) {
+		switch (id) {
+		case FunctionCall::SQRT: return sqrt(x[0]);
+		case FunctionCall::ABS: return abs(x[0]);
+		case FunctionCall::POW: { // d(x^y) = y x^(y-1) dx + x^y ln x dy
+			double args[2] = { x[0].value, x[1].value };
+			double value = FunctionCall::apply(id, args);
+			double derivative = 0.0;
+			if (x[0].derivative) {
+				args[1] = x[1].value - 1.0;
+				derivative += x[1].value * FunctionCall::apply(id, args) * x[0].derivative;
+			}
+			if (x[1].derivative)
+				derivative += value * std::log(x[0].value) * x[1].derivative;
+			return Dual(value, derivative);
+		}
+		case FunctionCall::HYPOT: {
+			double h = FunctionCall::hypot(x[0].value, x[1].value);
+			return Dual(h, (x[0].value * x[0].derivative + x[1].value * x[1].derivative) / h);
+		}
+		case FunctionCall::ATAN2: // atan2(y, x): (x dy - y dx) / (x^2 + y^2)
+			return Dual(std::atan2(x[0].value, x[1].value), (x[1].value * x[0].derivative - x[0].value * x[1].derivative)
+				/ (x[0].value * x[0].value + x[1].value * x[1].value));
+		default:
+			return Dual(std::fma(x[0].value, x[1].value, x[2].value),
+				x[0].derivative * x[1].value + x[0].value * x[1].derivative + x[2].derivative);
+		}
+	}
+};
+
+// комплексное число re + im*i. Умножение, деление и корень — статические функции над частями:
+// их же вызывают циклы ComplexBatchEvaluator, поэтому построчное и пакетное вычисления совпадают
+// бит в бит. sqrt и abs — на главной ветви; порядка у комплексных чисел нет, поэтому сравнения и
+// min/max смотрят на вещественные части, как Dual — на значения
+struct Complex {
+	Complex(double r = 0.0, double i = 0.0) : re(r), im(i) {}
+	double re, im;
+
+	static void multiply(double ar, double ai, double br, double bi, double& re, double& im) {
+		re = ar * br - ai * bi;
+		im = ar * bi + ai * br;
+	}
+	// числитель и знаменатель делятся на большую по модулю часть делителя: без переполнения
+	// при |b| до DBL_MAX и без ветвлений; деление на 0 даёт NaN в обеих частях
+	static void divide(double ar, double ai, double br, double bi, double& re, double& im) {
+		double scale = std::fabs(br) > std::fabs(bi) ? std::fabs(br) : std::fabs(bi);
+		double cr = br / scale, ci = bi / scale;
+		double denominator = br * cr + bi * ci;
+		re = (ar * cr + ai * ci) / denominator;
+		im = (ai * cr - ar * ci) / denominator;
+	}
+	// главная ветвь: re >= 0, разрез по отрицательной вещественной оси, знак мнимой части
+	// результата — знак im (sqrt(-4 - 0i) = -2i)
+	static void root(double ar, double ai, double& re, double& im) {
+		double t = std::sqrt(0.5 * FunctionCall::hypot(ar, ai) + 0.5 * std::fabs(ar));
+		double q = t > 0.0 ? 0.5 * ai / t : 0.0;
+		re = ar >= 0.0 ? t : std::fabs(q);
+		im = ar >= 0.0 ? q : std::copysign(t, ai);
+	}
+
+	friend Complex operator-(Complex const& a) { return Complex(-a.re, -a.im); }
+	friend Complex operator+(Complex const& a, Complex const& b) { return Complex(a.re + b.re, a.im + b.im); }
+	friend Complex operator-(Complex const& a, Complex const& b) { return Complex(a.re - b.re, a.im - b.im); }
+	friend Complex operator*(Complex const& a, Complex const& b) {
+		Complex r;
+		multiply(a.re, a.im, b.re, b.im, r.re, r.im);
+		return r;
+	}
+	friend Complex operator/(Complex const& a, Complex const& b) {
+		Complex r;
+		divide(a.re, a.im, b.re, b.im, r.re, r.im);
+		return r;
+	}
+	Complex& operator*=(Complex const& b) { return *this = *this * b; }
+	friend Complex sqrt(Complex const& a) {
+		Complex r;
+		root(a.re, a.im, r.re, r.im);
+		return r;
+	}
+	friend Complex abs(Complex const& a) { return Complex(FunctionCall::hypot(a.re, a.im)); }
+	friend Complex compareValues(int op, Complex const& a, Complex const& b) { return Complex(Comparison::holds(op, a.re, b.re) ? 1.0 : 0.0); }
+	friend Complex selectValue(Complex const& condition, Complex const& then, Complex const& otherwise) {
+		return condition.re != 0.0 || condition.im != 0.0 ? then : otherwise;
+	}
+	friend Complex minMaxValue(int kind, Complex const& a, Complex const& b) {
+		return MinMax::apply(kind, a.re, b.re) == a.re ? a : b;
+	}
+	friend Complex callValue(int id, std::vector<Complex> const& x) {
+		switch (id) {
+		case FunctionCall::SQRT: return sqrt(x[0]);
+		case FunctionCall::ABS: return abs(x[0]);
+		case FunctionCall::POW: { // целый показатель — умножениями, иначе exp(y log x) на главной ветви логарифма
+			if (x[1].im == 0.0 && FunctionCall::smallInteger(x[1].re))
+				return FunctionCall::power(x[0], static_cast<long>(x[1].re));
+			std::complex<double> r = std::pow(std::complex<double>(x[0].re, x[0].im), std::complex<double>(x[1].re, x[1].im));
+			return Complex(r.real(), r.imag());
+		}
+		case FunctionCall::HYPOT: return sqrt(x[0] * x[0] + x[1] * x[1]);
+		case FunctionCall::ATAN2: return Complex(std::atan2(x[0].re, x[1].re)); // угол точки (x, y) — только для вещественных частей
+		default: return x[0] * x[1] + x[2];
+		}
+	}
+};
+
+struct MixedPrecisionPlan { // узлы, с которых поддерево целиком считается во float
+	std::set<Expression const*> single;
+};
+
+inline std::vector<Expression const*> operandsOf(Expression const* expr) { // непосредственные потомки узла
+	std::vector<Expression const*> operands;
+	if (const BinaryOperation* binop = dynamic_cast<const BinaryOperation*>(expr)) {
+		operands.push_back(binop->left());
+		operands.push_back(binop->right());
+	}
+	else if (const FunctionCall* funCall = dynamic_cast<const FunctionCall*>(expr))
+		for (size_t i = 0; i < funCall->arity(); ++i)
+			operands.push_back(funCall->arg(i));
+	else if (const Comparison* cmp = dynamic_cast<const Comparison*>(expr)) {
+		operands.push_back(cmp->left());
+		operands.push_back(cmp->right());
+	}
+	else if (const Select* sel = dynamic_cast<const Select*>(expr)) {
+		operands.push_back(sel->condition());
+		operands.push_back(sel->then());
+		operands.push_back(sel->otherwise());
+	}
+	else if (const MinMax* mm = dynamic_cast<const MinMax*>(expr)) {
+		operands.push_back(mm->left());
+		operands.push_back(mm->right());
+	}
+	else if (const Negate* neg = dynamic_cast<const Negate*>(expr))
+		operands.push_back(neg->operand());
+	else if (const IntPower* power = dynamic_cast<const IntPower*>(expr))
+		operands.push_back(power->base());
+	else if (const Sum* sum = dynamic_cast<const Sum*>(expr))
+		operands.push_back(sum->body());
+	return operands;
+}
+
+// тело зависит от индекса: сам индекс или элемент по нему, в том числе во вложенных суммах
+inline bool usesIndex(Expression const* expr, std::string const& index) {
+	if (const Variable* var = dynamic_cast<const Variable*>(expr))
+		return var->name() == index;
+	if (const IndexedVariable* element = dynamic_cast<const IndexedVariable*>(expr))
+		return element->index() == index;
+	std::vector<Expression const*> operands = operandsOf(expr);
+	for (size_t i = 0; i < operands.size(); ++i)
+		if (usesIndex(operands[i], index))
+			return true;
+	return false;
+}
+
+// одинаковые по строению деревья: те же узлы с теми же числами, именами и операциями
+inline bool sameTree(Expression const* a, Expression const* b) {
+	if (typeid(*a) != typeid(*b))
+		return false;
+	if (const Number* numb = dynamic_cast<const Number*>(a)) {
+		double x = numb->value(), y = static_cast<const Number*>(b)->value();
+		return std::memcmp(&x, &y, sizeof(x)) == 0; // -0 и 0 — разные числа
+	}
+	if (const Variable* var = dynamic_cast<const Variable*>(a))
+		return var->name() == static_cast<const Variable*>(b)->name();
+	if (const IndexedVariable* element = dynamic_cast<const IndexedVariable*>(a))
+		return element->element() == static_cast<const IndexedVariable*>(b)->element();
+	if (const Dot* dot = dynamic_cast<const Dot*>(a))
+		return dot->left().text() == static_cast<const Dot*>(b)->left().text()
+			&& dot->right().text() == static_cast<const Dot*>(b)->right().text();
+	if (const BinaryOperation* binop = dynamic_cast<const BinaryOperation*>(a)) {
+		if (binop->operation() != static_cast<const BinaryOperation*>(b)->operation()) return false;
+	}
+	else if (const FunctionCall* funCall = dynamic_cast<const FunctionCall*>(a)) {
+		if (funCall->id() != static_cast<const FunctionCall*>(b)->id()) return false;
+	}
+	else if (const Comparison* cmp = dynamic_cast<const Comparison*>(a)) {
+		if (cmp->operation() != static_cast<const Comparison*>(b)->operation()) return false;
+	}
+	else if (const MinMax* mm = dynamic_cast<const MinMax*>(a)) {
+		if (mm->kind() != static_cast<const MinMax*>(b)->kind()) return false;
+	}
+	else if (const IntPower* power = dynamic_cast<const IntPower*>(a)) {
+		if (power->exponent() != static_cast<const IntPower*>(b)->exponent()) return false;
+	}
+	else if (const Sum* sum = dynamic_cast<const Sum*>(a)) {
+		const Sum* other = static_cast<const Sum*>(b);
+		if (sum->index() != other->index() || sum->from() != other->from() || sum->to() != other->to() || sum->mode() != other->mode())
+			return false;
+	}
+	std::vector<Expression const*> left = operandsOf(a), right = operandsOf(b);
+	for (size_t i = 0; i < left.size(); ++i)
+		if (!sameTree(left[i], right[i]))
+			return false;
+	return true;
+}
+
+// Понижение силы операций: pow с небольшим целым числом-показателем и произведения одинаковых
+// поддеревьев (x*x*x) становятся IntPower, который считается по кратчайшей цепочке умножений;
+// смена знака поглощается соседними + и - (a + -b = a - b), проходит через * и / и исчезает при
+// двойном отрицании, а 0 - x записывается как -x. Перестановки знака точны; значения меняются
+// только там, где степень считается другой цепочкой (x*x*x — x^3), что проверяет transformChecked.
+struct StrengthReduce : CopySyntaxTree {
+	Expression* transformBinaryOperation(BinaryOperation const* binop) {
+		Expression* L = binop->left()->transform(this);
+		Expression* R = binop->right()->transform(this);
+		Negate* L_neg = dynamic_cast<Negate*>(L);
+		Negate* R_neg = dynamic_cast<Negate*>(R);
+		switch (binop->operation()) {
+		case BinaryOperation::PLUS:
+			if (R_neg) return new BinaryOperation(L, BinaryOperation::MINUS, release(R_neg)); // a + -b = a - b
+			if (L_neg) return new BinaryOperation(R, BinaryOperation::MINUS, release(L_neg)); // -a + b = b - a
+			break;
+		case BinaryOperation::MINUS:
+			if (R_neg) return new BinaryOperation(L, BinaryOperation::PLUS, release(R_neg)); // a - -b = a + b
+			if (L_neg) // -a - b = -(a + b)
+				return new Negate(new BinaryOperation(release(L_neg), BinaryOperation::PLUS, R));
+			if (Number* L_numb = dynamic_cast<Number*>(L)) {
+				if (L_numb->value() == 0.0) { // 0 - x = -x
+					delete L;
+					return new Negate(R);
+				}
+			}
+			break;
+		default: // * и /: знаки множителей выносятся наружу
+			if (L_neg && R_neg)
+				return new BinaryOperation(release(L_neg), binop->operation(), release(R_neg));
+			if (L_neg && dynamic_cast<Number*>(R)) // -a * c = a * (-c)
+				return new BinaryOperation(release(L_neg), binop->operation(), negated(R));
+			if (R_neg && dynamic_cast<Number*>(L))
+				return new BinaryOperation(negated(L), binop->operation(), release(R_neg));
+			if (L_neg || R_neg)
+				return new Negate(new BinaryOperation(L_neg ? release(L_neg) : L, binop->operation(), R_neg ? release(R_neg) : R));
+			if (binop->operation() == BinaryOperation::MUL)
+				return multiply(L, R);
+			if (Number* L_numb = dynamic_cast<Number*>(L)) { // 1 / x^n = x^-n
+				IntPower* R_pow = dynamic_cast<IntPower*>(R);
+				if (L_numb->value() == 1.0 && R_pow && R_pow->exponent() > 0) {
+					delete L;
+					return power(releaseBase(R_pow), -R_pow->exponent());
+				}
+			}
+			break;
+		}
+		return new BinaryOperation(L, binop->operation(), R);
+	}
+	Expression* transformFunctionCall(FunctionCall const* fcall) {
+		if (fcall->id() != FunctionCall::POW)
+			return CopySyntaxTree::transformFunctionCall(fcall);
+		Expression* B = fcall->arg(0)->transform(this);
+		Expression* E = fcall->arg(1)->transform(this);
+		Number* E_numb = dynamic_cast<Number*>(E);
+		if (!E_numb || !FunctionCall::smallInteger(E_numb->value())) {
+			std::vector<Expression const*> args = { B, E };
+			return new FunctionCall(fcall->name(), args);
+		}
+		int n = static_cast<int>(E_numb->value());
+		delete E;
+		return power(B, n);
+	}
+	Expression* transformNegate(Negate const* neg) {
+		Expression* Arg = neg->operand()->transform(this);
+		if (Negate* Arg_neg = dynamic_cast<Negate*>(Arg)) // --a = a
+			return release(Arg_neg);
+		if (Number* Arg_numb = dynamic_cast<Number*>(Arg)) {
+			Expression* folded = new Number(-Arg_numb->value());
+			delete Arg;
+			return folded;
+		}
+		if (BinaryOperation* Arg_binop = dynamic_cast<BinaryOperation*>(Arg)) { // -(a - b) = b - a
+			if (Arg_binop->operation() == BinaryOperation::MINUS) {
+				Expression const* right = Arg_binop->releaseRight();
+				Expression const* left = Arg_binop->releaseLeft();
+				delete Arg;
+				return new BinaryOperation(right, BinaryOperation::MINUS, left);
+			}
+		}
+		return new Negate(Arg);
+	}
+	Expression* transformIntPower(IntPower const* pow) {
+		return power(pow->base()->transform(this), pow->exponent());
+	}
+
+private:
+	Expression* power(Expression* base, int n) { // base^n с упрощениями
+		if (n == 1)
+			return base;
+		if (n == 0) { // IntPower даёт 1 при любом основании, в том числе NaN
+			delete base;
+			return new Number(1.0);
+		}
+		if (Negate* neg = dynamic_cast<Negate*>(base)) { // (-a)^n = ±a^n
+			Expression* positive = power(release(neg), n);
+			return n % 2 ? new Negate(positive) : positive;
+		}
+		IntPower* inner = dynamic_cast<IntPower*>(base);
+		if (inner && inner->exponent() > 0 && n > 0 && static_cast<long>(inner->exponent()) * n <= INT_MAX) // (a^m)^n = a^(mn)
+			return power(releaseBase(inner), inner->exponent() * n);
+		return new IntPower(base, n);
+	}
+	Expression* multiply(Expression* L, Expression* R) { // a^m * a^k = a^(m+k) для положительных степеней
+		IntPower* L_pow = dynamic_cast<IntPower*>(L);
+		IntPower* R_pow = dynamic_cast<IntPower*>(R);
+		Expression const* L_base = L_pow && L_pow->exponent() > 0 ? L_pow->base() : L;
+		Expression const* R_base = R_pow && R_pow->exponent() > 0 ? R_pow->base() : R;
+		long m = L_base == L ? 1 : L_pow->exponent(), k = R_base == R ? 1 : R_pow->exponent();
+		if (m + k > INT_MAX || dynamic_cast<const Number*>(L_base) || !sameTree(L_base, R_base))
+			return new BinaryOperation(L, BinaryOperation::MUL, R);
+		Expression* base = L_base == L ? L : releaseBase(L_pow);
+		delete R;
+		return power(base, static_cast<int>(m + k));
+	}
+	static Expression* negated(Expression* number) {
+		Expression* result = new Number(-static_cast<Number*>(number)->value());
+		delete number;
+		return result;
+	}
+	// потомок узла, созданного этим проходом, без копирования; сам узел удаляется
+	static Expression* release(Negate* neg) {
+		Expression* operand = const_cast<Expression*>(neg->releaseOperand()); // все узлы создаются через new
+		delete neg;
+		return operand;
+	}
+	static Expression* releaseBase(IntPower* pow) {
+		Expression* base = const_cast<Expression*>(pow->releaseBase());
+		delete pow;
+		return base;
+	}
+};
+
+inline bool sameVariable(Expression const* a, Expression const* b) {
+	const Variable* left = dynamic_cast<const Variable*>(a);
+	const Variable* right = dynamic_cast<const Variable*>(b);
+	return left && right && left->name() == right->name();
+}
+
+struct RangeError { // диапазон значений узла и граница абсолютной ошибки относительно точного значения
+	Interval range;
+	double error;
+};
+
+// Прямое распространение ошибки: операнды с ошибками ea, eb дают ошибку операции (для * —
+// |a| eb + |b| ea + ea eb), к которой добавляется округление результата: |значение| * 2^-24
+// во float и 2^-53 в double плюс наименьшее денормализованное число, 2^-149 и 2^-1074 (точная
+// граница — его половина, но константа 2^-1075 в double округляется до нуля). Переменные без
+// диапазона в ranges не ограничены, и любое поддерево с ними во float имеет бесконечную ошибку.
+// ошибка x^n по ошибке основания: x^m - x'^m <= m (max|x| + e)^(m-1) e, для x^-m — m e / (min|x| - e)^(m+1).
+// Любая цепочка умножений для x^m даёт не больше m - 1 округлений, обратная величина — ещё одно
+inline double integerPowerError(RangeError const& base, double n) {
+	double m = std::fabs(n);
+	double ma = std::fmax(std::fabs(base.range.lo), std::fabs(base.range.hi)) + base.error;
+	double low = (base.range.lo > 0.0 ? base.range.lo : base.range.hi < 0.0 ? -base.range.hi : 0.0) - base.error;
+	if (!base.error || m == 0.0)
+		return 0.0;
+	if (n > 0.0)
+		return m * std::pow(ma, m - 1.0) * base.error;
+	return low > 0.0 ? m * base.error / std::pow(low, m + 1.0) : HUGE_VAL;
+}
+
+// Оценки уже обойдённых узлов: узел, найденный в кэше, не обходится заново. Оценка узла во
+// float (под поддеревом из single) от плана не зависит, в double — верна для текущего плана:
+// кто меняет single, стирает из wide изменённый узел и его предков.
+struct RangeErrorCache {
+	std::map<Expression const*, RangeError> wide, narrow; // в double и во float
+};
+
+inline RangeError rangeError(Expression const* expression, std::map<std::string, Interval> const& ranges,
+	std::set<Expression const*> const& single, bool inSingle = false, RangeErrorCache* cache = nullptr) {
+	inSingle = inSingle || single.count(expression) != 0;
+	if (cache) {
+		std::map<Expression const*, RangeError> const& known = inSingle ? cache->narrow : cache->wide;
+		std::map<Expression const*, RangeError>::const_iterator found = known.find(expression);
+		if (found != known.end())
+			return found->second;
+	}
+	double const unit = inSingle ? 0x1p-24 : 0x1p-53;
+	double const tiny = inSingle ? 0x1p-149 : 0x1p-1074; // FLT_TRUE_MIN и DBL_TRUE_MIN
+	double const limit = inSingle ? FLT_MAX : DBL_MAX;
+	RangeError r = { Interval(), 0.0 };
+	double propagated = 0.0; // ошибка, пришедшая от операндов
+	bool exact = false; // операция без округления
+	double roundings = 1.0; // округлений на единицу младшего разряда результата
+	if (const Number* numb = dynamic_cast<const Number*>(expression)) {
+		r.range = Interval(numb->value());
+		exact = !inSingle || static_cast<float>(numb->value()) == numb->value(); // эталон — число в double
+	}
+	else if (const BinaryOperation* binop = dynamic_cast<const BinaryOperation*>(expression)) {
+		RangeError a = rangeError(binop->left(), ranges, single, inSingle, cache);
+		RangeError b = rangeError(binop->right(), ranges, single, inSingle, cache);
+		double ma = std::fmax(std::fabs(a.range.lo), std::fabs(a.range.hi));
+		double mb = std::fmax(std::fabs(b.range.lo), std::fabs(b.range.hi));
+		switch (binop->operation()) {
+		case BinaryOperation::PLUS:
+			r.range = a.range + b.range;
+			propagated = a.error + b.error;
+			break;
+		case BinaryOperation::MINUS:
+			r.range = a.range - b.range;
+			propagated = a.error + b.error;
+			break;
+		case BinaryOperation::MUL:
+			r.range = a.range * b.range;
+			if (sameVariable(binop->left(), binop->right())) // x*x не бывает отрицательным
+				r.range = abs(a.range) * abs(a.range);
+			propagated = (b.error ? ma * b.error : 0.0) + (a.error ? mb * a.error : 0.0) + a.error * b.error;
+			break;
+		default: { // |a/b - a'/b'| <= (ea + |a/b| eb) / (min|b| - eb), если b' не может обратиться в нуль
+			r.range = a.range / b.range;
+			double low = b.range.lo > 0.0 ? b.range.lo : -b.range.hi; // min|b|, если 0 не в отрезке
+			double mq = std::fmax(std::fabs(r.range.lo), std::fabs(r.range.hi));
+			propagated = low - b.error > 0.0 ? (a.error + (b.error ? mq * b.error : 0.0)) / (low - b.error) : HUGE_VAL;
+			break;
+		}
+		}
+	}
+	else if (const FunctionCall* funCall = dynamic_cast<const FunctionCall*>(expression)) {
+		RangeError arg[3] = { { Interval(), 0.0 }, { Interval(), 0.0 }, { Interval(), 0.0 } };
+		std::vector<Interval> args;
+		for (size_t i = 0; i < funCall->arity(); ++i) {
+			arg[i] = rangeError(funCall->arg(i), ranges, single, inSingle, cache);
+			args.push_back(arg[i].range);
+		}
+		RangeError const& a = arg[0];
+		RangeError const& b = arg[1];
+		r.range = callValue(funCall->id(), args);
+		switch (funCall->id()) {
+		case FunctionCall::SQRT: { // |sqrt(x) - sqrt(x')| <= min(sqrt(e), e / sqrt(min x))
+			double low = a.range.lo > 0.0 ? a.range.lo : 0.0;
+			propagated = low > 0.0 ? std::fmin(std::sqrt(a.error), a.error / std::sqrt(low)) : std::sqrt(a.error);
+			break;
+		}
+		case FunctionCall::ABS:
+			propagated = a.error;
+			exact = true; // модуль не округляется
+			break;
+		case FunctionCall::POW:
+			if (b.range.lo == b.range.hi && !b.error && FunctionCall::smallInteger(b.range.lo)) {
+				propagated = integerPowerError(a, b.range.lo);
+				roundings = b.range.lo ? std::fabs(b.range.lo) + 1.0 : 0.0; // возведение в квадрат — тоже цепочка
+			}
+			else { // по теореме о среднем: |d/dx| = |y x^y / x|, |d/dy| = |x^y ln x| на расширенных отрезках
+				Interval x(a.range.lo - a.error, a.range.hi + a.error), y(b.range.lo - b.error, b.range.hi + b.error);
+				Interval p = Interval::power(x, y);
+				double mp = std::fmax(std::fabs(p.lo), std::fabs(p.hi));
+				double my = std::fmax(std::fabs(y.lo), std::fabs(y.hi));
+				double ml = std::fmax(std::fabs(std::log(x.lo)), std::fabs(std::log(x.hi)));
+				if (!a.error && !b.error)
+					propagated = 0.0;
+				else
+					propagated = x.lo > 0.0 ? (a.error ? my * mp / x.lo * a.error : 0.0) + (b.error ? mp * ml * b.error : 0.0) : HUGE_VAL;
+				roundings = 2.0; // std::pow — до 1 ulp
+			}
+			break;
+		case FunctionCall::HYPOT: // hypot 1-липшицева по каждому аргументу
+			propagated = a.error + b.error;
+			roundings = 3.0;
+			break;
+		case FunctionCall::ATAN2: { // градиент по модулю 1 / расстояние до начала координат
+			Interval y(a.range.lo - a.error, a.range.hi + a.error), x(b.range.lo - b.error, b.range.hi + b.error);
+			double dy = y.lo > 0.0 ? y.lo : y.hi < 0.0 ? -y.hi : 0.0;
+			double dx = x.lo > 0.0 ? x.lo : x.hi < 0.0 ? -x.hi : 0.0;
+			Interval wide = atan2(y, x);
+			if (!a.error && !b.error)
+				propagated = 0.0;
+			else if (wide.hi - wide.lo < 6.0 && (dx > 0.0 || dy > 0.0)) // не вокруг начала и не через разрез
+				propagated = (a.error + b.error) / FunctionCall::hypot(dx, dy);
+			else
+				propagated = wide.hi - wide.lo;
+			roundings = 2.0;
+			break;
+		}
+		default: { // a b + c с одним округлением
+			double ma = std::fmax(std::fabs(a.range.lo), std::fabs(a.range.hi));
+			double mb = std::fmax(std::fabs(b.range.lo), std::fabs(b.range.hi));
+			propagated = (b.error ? ma * b.error : 0.0) + (a.error ? mb * a.error : 0.0) + a.error * b.error + arg[2].error;
+			break;
+		}
+		}
+	}
+	else if (const Comparison* cmp = dynamic_cast<const Comparison*>(expression)) {
+		// вычисленный результат может отличаться от точного, только если операнды с учётом своих
+		// ошибок не разделены; тогда ошибка — вся разница между 0 и 1
+		RangeError a = rangeError(cmp->left(), ranges, single, inSingle, cache);
+		RangeError b = rangeError(cmp->right(), ranges, single, inSingle, cache);
+		r.range = compareValues(cmp->operation(), a.range, b.range);
+		Interval widened = compareValues(cmp->operation(), Interval(a.range.lo - a.error, a.range.hi + a.error),
+			Interval(b.range.lo - b.error, b.range.hi + b.error));
+		propagated = (a.error || b.error) && widened.lo != widened.hi ? 1.0 : 0.0;
+		exact = true;
+	}
+	else if (const Select* sel = dynamic_cast<const Select*>(expression)) {
+		RangeError c = rangeError(sel->condition(), ranges, single, inSingle, cache);
+		RangeError a = rangeError(sel->then(), ranges, single, inSingle, cache);
+		RangeError b = rangeError(sel->otherwise(), ranges, single, inSingle, cache);
+		r.range = selectValue(c.range, a.range, b.range);
+		bool decided = c.range.lo > 0.0 || c.range.hi < 0.0 || (c.range.lo == 0.0 && c.range.hi == 0.0);
+		if (c.error) // условие может сработать не так: результат — любая ветвь вместо другой
+			propagated = std::fmax(a.range.hi, b.range.hi) - std::fmin(a.range.lo, b.range.lo) + std::fmax(a.error, b.error);
+		else
+			propagated = decided ? (c.range.lo == 0.0 && c.range.hi == 0.0 ? b.error : a.error) : std::fmax(a.error, b.error);
+		exact = true;
+	}
+	else if (const MinMax* mm = dynamic_cast<const MinMax*>(expression)) { // выбор не увеличивает ошибку
+		RangeError a = rangeError(mm->left(), ranges, single, inSingle, cache);
+		RangeError b = rangeError(mm->right(), ranges, single, inSingle, cache);
+		r.range = minMaxValue(mm->kind(), a.range, b.range);
+		propagated = std::fmax(a.error, b.error);
+		exact = true;
+	}
+	else if (const Negate* neg = dynamic_cast<const Negate*>(expression)) {
+		RangeError a = rangeError(neg->operand(), ranges, single, inSingle, cache);
+		r.range = -a.range;
+		propagated = a.error;
+		exact = true;
+	}
+	else if (const IntPower* power = dynamic_cast<const IntPower*>(expression)) {
+		RangeError a = rangeError(power->base(), ranges, single, inSingle, cache);
+		r.range = integerPowerValue(a.range, power);
+		propagated = integerPowerError(a, power->exponent());
+		roundings = power->exponent() ? std::fabs(static_cast<double>(power->exponent())) + 1.0 : 0.0;
+		exact = power->exponent() == 0;
+	}
+	else if (const Sum* sum = dynamic_cast<const Sum*>(expression)) {
+		// n слагаемых из диапазона тела, где индекс пробегает [from, to]; их ошибки складываются,
+		// округления сложений — Summation::errorBound от n max|тела|. Суммы считаются только в double
+		double n = static_cast<double>(sum->count());
+		exact = true;
+		if (n) {
+			std::map<std::string, Interval> inner(ranges);
+			inner[sum->index()] = Interval(static_cast<double>(sum->from()), static_cast<double>(sum->to()));
+			RangeError a = rangeError(sum->body(), inner, single, inSingle, cache);
+			double ma = std::fmax(std::fabs(a.range.lo), std::fabs(a.range.hi));
+			double bound = Summation<double>::errorBound(sum->mode(), n);
+			r.range = Interval(n) * a.range;
+			propagated = inSingle ? HUGE_VAL : n * a.error + (bound ? bound * n * ma : 0.0);
+		}
+	}
+	else if (dynamic_cast<const Dot*>(expression)) { // длины массивов известны только при вычислении — оценки нет
+		r.range = Interval(-HUGE_VAL, HUGE_VAL);
+		propagated = HUGE_VAL;
+		exact = true;
+	}
+	else if (const IndexedVariable* element = dynamic_cast<const IndexedVariable*>(expression)) { // диапазон — общий для всех элементов
+		std::map<std::string, Interval>::const_iterator found = ranges.find(element->name());
+		r.range = found != ranges.end() ? found->second : Interval(-HUGE_VAL, HUGE_VAL);
+		exact = !inSingle;
+	}
+	else {
+		const Variable* var = dynamic_cast<const Variable*>(expression);
+		assert(var);
+		std::map<std::string, Interval>::const_iterator found = ranges.find(var->name());
+		r.range = found != ranges.end() ? found->second : Interval(-HUGE_VAL, HUGE_VAL);
+		exact = !inSingle; // входные столбцы в double точны, во float — округляются
+	}
+	double magnitude = std::fmax(std::fabs(r.range.lo), std::fabs(r.range.hi));
+	if (magnitude > limit)
+		r.error = HUGE_VAL; // возможно переполнение
+	else
+		r.error = propagated + (exact ? 0.0 : roundings * magnitude * unit + tiny);
+	if (cache)
+		(inSingle ? cache->narrow : cache->wide)[expression] = r;
+	return r;
+}
+
+struct ErrorBound { // худшая ошибка вычисления в double по всем входам из заданных диапазонов
+	Interval range; // значения формулы
+	double absolute; // |вычисленное - точное|
+	double relative; // absolute / min |точное|; бесконечность, если значение может быть нулём
+};
+
+// Оценка строгая: числа формулы считаются точными, каждая операция округляется на 2^-53 от
+// наибольшего по модулю значения, ошибки операндов распространяются как в rangeError. Она может
+// быть завышена (переменная, встречающаяся дважды, считается двумя независимыми), но не занижена.
+inline ErrorBound errorBound(Expression const* expr, std::map<std::string, Interval> const& ranges) {
+	RangeError r = rangeError(expr, ranges, std::set<Expression const*>());
+	double low = r.range.lo > 0.0 ? r.range.lo : r.range.hi < 0.0 ? -r.range.hi : 0.0;
+	ErrorBound bound = { r.range, r.error, low > 0.0 ? r.error / low : HUGE_VAL };
+	return bound;
+}
+
+// Проверка результата прохода оптимизации: преобразованное дерево принимается, если его оценка
+// ошибки больше исходной не более чем на tolerance и отрезки значений обоих деревьев, расширенные
+// на их ошибки и tolerance, пересекаются (для равносильных формул они содержат одни и те же
+// точные значения). Второе условие — грубая проверка равносильности, а не доказательство.
+inline bool acceptTransform(Expression const* original, Expression const* transformed,
+	std::map<std::string, Interval> const& ranges, double tolerance, ErrorBound* before = nullptr, ErrorBound* after = nullptr) {
+	ErrorBound a = errorBound(original, ranges), b = errorBound(transformed, ranges);
+	if (before) *before = a;
+	if (after) *after = b;
+	double slack = a.absolute + b.absolute + tolerance;
+	bool overlap = b.range.lo - slack <= a.range.hi && a.range.lo - slack <= b.range.hi;
+	return b.absolute <= a.absolute + tolerance && overlap;
+}
+
+// Проход с автоматической проверкой: результат pass, если acceptTransform его принял, иначе копия
+// исходного дерева. Вызывающий владеет возвращённым деревом в обоих случаях.
+inline Expression* transformChecked(Expression const* expr, Transformer* pass, std::map<std::string, Interval> const& ranges,
+	double tolerance, bool* accepted = nullptr) {
+	Expression* result = runPass("transformChecked", expr, pass);
+	bool ok = acceptTransform(expr, result, ranges, tolerance);
+	if (accepted) *accepted = ok;
+	if (ok)
+		return result;
+	delete result;
+	CopySyntaxTree copy;
+	return runPass("CopySyntaxTree", expr, &copy);
+}
+
+inline bool containsReduction(Expression const* expr) { // сумма или скалярное произведение массивов
+	if (dynamic_cast<const Sum*>(expr) || dynamic_cast<const Dot*>(expr))
+		return true;
+	std::vector<Expression const*> operands = operandsOf(expr);
+	for (size_t i = 0; i < operands.size(); ++i)
+		if (containsReduction(operands[i]))
+			return true;
+	return false;
+}
+
+// Смешанная точность для одной формулы: сверху вниз ищутся наибольшие поддеревья (операции,
+// не листья), которые можно считать во float так, чтобы оценка ошибки всей формулы осталась не
+// больше tolerance; найденные добавляются в plan. Возвращает итоговую оценку ошибки. Суммы, dot и
+// поддеревья с ними остаются в double: их считают отдельные программы и ядра BatchEvaluator.
+// Оценки узлов хранятся в кэше, и проба одного кандидата пересчитывает только путь от него до
+// корня: его поддерево во float уже оценено при пробе предка.
+inline double planMixedPrecision(Expression const* expr, std::map<std::string, Interval> const& ranges, double tolerance,
+	MixedPrecisionPlan& plan) {
+	std::map<Expression const*, Expression const*> parent;
+	std::vector<Expression const*> order(1, expr); // каждый узел раньше своих потомков
+	for (size_t k = 0; k < order.size(); ++k) {
+		std::vector<Expression const*> operands = operandsOf(order[k]);
+		for (size_t i = 0; i < operands.size(); ++i) {
+			parent[operands[i]] = order[k];
+			order.push_back(operands[i]);
+		}
+	}
+	std::set<Expression const*> reductions; // узлы, содержащие сумму или dot, — как containsReduction
+	for (size_t k = order.size(); k-- > 0; )
+		if (dynamic_cast<const Sum*>(order[k]) || dynamic_cast<const Dot*>(order[k]) || reductions.count(order[k])) {
+			reductions.insert(order[k]);
+			if (parent.count(order[k]))
+				reductions.insert(parent[order[k]]);
+		}
+	RangeErrorCache cache;
+	rangeError(expr, ranges, plan.single, false, &cache);
+	std::vector<Expression const*> pending(1, expr);
+	std::vector<std::pair<Expression const*, RangeError> > saved;
+	while (!pending.empty()) {
+		Expression const* node = pending.back();
+		pending.pop_back();
+		std::vector<Expression const*> operands = operandsOf(node);
+		if (operands.empty() || dynamic_cast<const Sum*>(node))
+			continue;
+		if (reductions.count(node)) {
+			pending.insert(pending.end(), operands.rbegin(), operands.rend());
+			continue;
+		}
+		plan.single.insert(node);
+		saved.clear();
+		for (Expression const* up = node; up; ) { // оценки узла и его предков в double меняются
+			std::map<Expression const*, RangeError>::iterator found = cache.wide.find(up);
+			if (found != cache.wide.end()) {
+				saved.push_back(*found);
+				cache.wide.erase(found);
+			}
+			std::map<Expression const*, Expression const*>::const_iterator p = parent.find(up);
+			up = p != parent.end() ? p->second : nullptr;
+		}
+		if (rangeError(expr, ranges, plan.single, false, &cache).error <= tolerance)
+			continue; // всё поддерево во float, кэш уже пересчитан
+		plan.single.erase(node);
+		for (size_t i = 0; i < saved.size(); ++i)
+			cache.wide[saved[i].first] = saved[i].second;
+		pending.insert(pending.end(), operands.rbegin(), operands.rend());
+	}
+	return rangeError(expr, ranges, plan.single, false, &cache).error;
+}
+
+struct Parser { // разбор формулы из строки методом рекурсивного спуска
+	Parser(std::string const& text) : text_(text), pos_(0) {}
+
+	Expression* parse(std::string& error) { // при ошибке возвращает nullptr и описание в error
+		TraceSpan span("parse");
+		PerfScope perf("parse");
+		Expression* expr = parseComparison();
+		skipSpaces();
+		if (expr && pos_ != text_.size())
+			fail("лишние символы после выражения");
+		if (!error_.empty()) {
+			delete expr;
+			error = error_ + " (позиция " + std::to_string(pos_) + ")";
+			return nullptr;
+		}
+		return expr;
+	}
+
+private:
+	Expression* parseComparison() { // сравнение — низший приоритет, без цепочек a < b < c
+		Expression* left = parseSum();
+		skipSpaces();
+		if (!left || pos_ >= text_.size())
+			return left;
+		static char const* const symbols[] = { "<=", ">=", "==", "!=", "<", ">" };
+		static int const ops[] = { Comparison::LESS_EQUAL, Comparison::GREATER_EQUAL, Comparison::EQUAL,
+			Comparison::NOT_EQUAL, Comparison::LESS, Comparison::GREATER };
+		for (int i = 0; i < 6; ++i)
+			if (text_.compare(pos_, std::strlen(symbols[i]), symbols[i]) == 0) {
+				pos_ += std::strlen(symbols[i]);
+				Expression* right = parseSum();
+				if (!right) {
+					delete left;
+					return nullptr;
+				}
+				return new Comparison(left, ops[i], right);
+			}
+		return left;
+	}
+
+	Expression* parseSum() { // сумма и разность
+		Expression* left = parseProduct();
+		while (left) {
+			skipSpaces();
+			if (pos_ >= text_.size() || (text_[pos_] != '+' && text_[pos_] != '-'))
+				break;
+			int op = text_[pos_++];
+			Expression* right = parseProduct();
+			if (!right) {
+				delete left;
+				return nullptr;
+			}
+			left = new BinaryOperation(left, op, right);
+		}
+		return left;
+	}
+
+	Expression* parseProduct() { // произведение и частное
+		Expression* left = parsePower();
+		while (left) {
+			skipSpaces();
+			if (pos_ >= text_.size() || (text_[pos_] != '*' && text_[pos_] != '/'))
+				break;
+			int op = text_[pos_++];
+			Expression* right = parsePower();
+			if (!right) {
+				delete left;
+				return nullptr;
+			}
+			left = new BinaryOperation(left, op, right);
+		}
+		return left;
+	}
+
+	Expression* parsePower() { // x^n, показатель — целое число со знаком; -x^2 = -(x^2)
+		Expression* base = parseFactor();
+		skipSpaces();
+		if (!base || pos_ >= text_.size() || text_[pos_] != '^')
+			return base;
+		++pos_;
+		long exponent;
+		if (!parseInteger(exponent) || exponent < INT_MIN || exponent > INT_MAX) {
+			delete base;
+			return fail("показатель степени должен быть целым числом");
+		}
+		return new IntPower(base, static_cast<int>(exponent));
+	}
+
+	Expression* parseFactor() { // число, переменная, вызов функции, скобки или унарный минус
+		skipSpaces();
+		if (pos_ >= text_.size())
+			return fail("неожиданный конец формулы");
+		char c = text_[pos_];
+		if (c == '(') {
+			++pos_;
+			Expression* inner = parseComparison();
+			if (inner && !expect(')')) {
+				delete inner;
+				return nullptr;
+			}
+			return inner;
+		}
+		if (c == '-') { // унарный минус связывает слабее степени
+			++pos_;
+			Expression* operand = parsePower();
+			if (!operand)
+				return nullptr;
+			return new Negate(operand);
+		}
+		if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+			double value;
+			std::from_chars_result res = std::from_chars(text_.data() + pos_, text_.data() + text_.size(), value);
+			if (res.ec != std::errc())
+				return fail("неверная запись числа");
+			pos_ = res.ptr - text_.data();
+			return new Number(value);
+		}
+		if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+			size_t start = pos_;
+			while (pos_ < text_.size() && (std::isalnum(static_cast<unsigned char>(text_[pos_])) || text_[pos_] == '_'))
+				++pos_;
+			std::string name = text_.substr(start, pos_ - start);
+			skipSpaces();
+			if (pos_ < text_.size() && text_[pos_] == '(' && Sum::find(name) >= 0)
+				return parseSumCall(static_cast<SumMode>(Sum::find(name)));
+			if (pos_ < text_.size() && text_[pos_] == '(' && name == "dot")
+				return parseDot();
+			if (pos_ < text_.size() && text_[pos_] == '[')
+				return parseElement(name);
+			if (pos_ < text_.size() && text_[pos_] == '(') { // вызов функции
+				int id = FunctionCall::find(name); // функция из реестра или отдельный узел
+				size_t count = id >= 0 ? FunctionCall::info(id).arity : name == "min" || name == "max" ? 2 : name == "select" ? 3 : 0;
+				if (!count)
+					return fail("неизвестная функция " + name);
+				++pos_;
+				std::vector<Expression const*> args;
+				bool closed = false;
+				while (Expression* arg = parseComparison()) { // аргументы через запятую до ')'
+					args.push_back(arg);
+					skipSpaces();
+					if (pos_ < text_.size() && text_[pos_] == ',') {
+						++pos_;
+						continue;
+					}
+					closed = expect(')');
+					break;
+				}
+				if (closed && args.size() != count)
+					fail("у функции " + name + " должно быть аргументов: " + std::to_string(count));
+				if (!closed || args.size() != count) {
+					for (size_t k = 0; k < args.size(); ++k)
+						delete args[k];
+					return nullptr;
+				}
+				if (id >= 0)
+					return new FunctionCall(name, args);
+				if (count == 2)
+					return new MinMax(name == "min" ? MinMax::MIN : MinMax::MAX, args[0], args[1]);
+				return new Select(args[0], args[1], args[2]);
+			}
+			return new Variable(name);
+		}
+		return fail(std::string("неожиданный символ '") + c + "'");
+	}
+
+	// sum(i, from, to, тело), sum_kahan(...), sum_simple(...): границы — целые числа, в теле i —
+	// переменная, а w[i], w[i+k], w[i-k] — элементы массивов
+	Expression* parseSumCall(SumMode mode) {
+		++pos_; // '('
+		std::string index = parseName();
+		if (index.empty())
+			return fail("ожидалось имя индекса суммы");
+		SumScope scope = { index, 0, 0 };
+		if (!expect(',') || !parseInteger(scope.from) || !expect(',') || !parseInteger(scope.to))
+			return fail("границы суммы должны быть целыми числами");
+		if (!expect(','))
+			return nullptr;
+		sums_.push_back(scope);
+		Expression* body = parseComparison();
+		sums_.pop_back();
+		if (body && !expect(')')) {
+			delete body;
+			return nullptr;
+		}
+		return body ? new Sum(index, scope.from, scope.to, body, mode) : nullptr;
+	}
+
+	Expression* parseElement(std::string const& name) { // name[i], name[i+k], name[i-k]
+		++pos_; // '['
+		std::string index = parseName();
+		if (sums_.empty() || index != sums_.back().index)
+			return fail("элемент массива " + name + " должен индексироваться индексом самой внутренней суммы");
+		long offset = 0;
+		skipSpaces();
+		if (pos_ < text_.size() && (text_[pos_] == '+' || text_[pos_] == '-')) {
+			bool negative = text_[pos_++] == '-';
+			skipSpaces();
+			if (pos_ >= text_.size() || !std::isdigit(static_cast<unsigned char>(text_[pos_])) || !parseInteger(offset))
+				return fail("сдвиг индекса должен быть целым числом");
+			offset = negative ? -offset : offset;
+		}
+		if (!expect(']'))
+			return nullptr;
+		SumScope const& scope = sums_.back();
+		if (scope.from <= scope.to && scope.from + offset < 0)
+			return fail("элемент " + IndexedVariable(name, index, offset).element() + " при " + index + " = " + std::to_string(scope.from) + " выходит за начало массива");
+		return new IndexedVariable(name, index, offset);
+	}
+
+	// dot(a, b): a и b — массивы-выражения из имён массивов, matvec(M, x), скобок и поэлементных
+	// + - * над массивами одной длины
+	Expression* parseDot() {
+		++pos_; // '('
+		ArrayExpression left, right;
+		if (!parseArraySum(left) || !expect(',') || !parseArraySum(right) || !expect(')'))
+			return nullptr;
+		return new Dot(left, right);
+	}
+
+	bool parseArraySum(ArrayExpression& result) {
+		if (!parseArrayProduct(result))
+			return false;
+		for (;;) {
+			skipSpaces();
+			if (pos_ >= text_.size() || (text_[pos_] != '+' && text_[pos_] != '-'))
+				return true;
+			int op = text_[pos_++];
+			ArrayExpression right;
+			if (!parseArrayProduct(right))
+				return false;
+			result = ArrayExpression::elementwise(op, result, right);
+		}
+	}
+
+	bool parseArrayProduct(ArrayExpression& result) {
+		if (!parseArrayPrimary(result))
+			return false;
+		for (;;) {
+			skipSpaces();
+			if (pos_ >= text_.size() || text_[pos_] != '*')
+				return true;
+			++pos_;
+			ArrayExpression right;
+			if (!parseArrayPrimary(right))
+				return false;
+			result = ArrayExpression::elementwise('*', result, right);
+		}
+	}
+
+	bool parseArrayPrimary(ArrayExpression& result) {
+		skipSpaces();
+		if (pos_ < text_.size() && text_[pos_] == '(') {
+			++pos_;
+			return parseArraySum(result) && expect(')');
+		}
+		std::string name = parseName();
+		if (name.empty()) {
+			fail("ожидалось имя массива");
+			return false;
+		}
+		skipSpaces();
+		if (name == "matvec" && pos_ < text_.size() && text_[pos_] == '(') {
+			++pos_;
+			std::string matrix = parseName();
+			if (matrix.empty()) {
+				fail("ожидалось имя матрицы");
+				return false;
+			}
+			ArrayExpression x;
+			if (!expect(',') || !parseArraySum(x) || !expect(')'))
+				return false;
+			result = ArrayExpression::matVec(matrix, x);
+			return true;
+		}
+		result = ArrayExpression::variable(name);
+		return true;
+	}
+
+	std::string parseName() { // имя переменной или индекса, пустое — если его нет
+		skipSpaces();
+		size_t start = pos_;
+		if (pos_ < text_.size() && (std::isalpha(static_cast<unsigned char>(text_[pos_])) || text_[pos_] == '_'))
+			while (pos_ < text_.size() && (std::isalnum(static_cast<unsigned char>(text_[pos_])) || text_[pos_] == '_'))
+				++pos_;
+		return text_.substr(start, pos_ - start);
+	}
+
+	bool parseInteger(long& value) { // целое со знаком, но не начало дробного числа
+		skipSpaces();
+		std::from_chars_result res = std::from_chars(text_.data() + pos_, text_.data() + text_.size(), value);
+		if (res.ec != std::errc() || (res.ptr < text_.data() + text_.size() && (*res.ptr == '.' || *res.ptr == 'e' || *res.ptr == 'E')))
+			return false;
+		pos_ = res.ptr - text_.data();
+		return true;
+	}
+
+	bool expect(char c) {
+		skipSpaces();
+		if (pos_ < text_.size() && text_[pos_] == c) {
+			++pos_;
+			return true;
+		}
+		fail(std::string("ожидался символ '") + c + "'");
+		return false;
+	}
+
+	void skipSpaces() {
+		while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_])))
+			++pos_;
+	}
+
+	Expression* fail(std::string const& message) { // запоминаем только первую ошибку
+		if (error_.empty())
+			error_ = message;
+		return nullptr;
+	}
+
+	struct SumScope { // сумма, тело которой сейчас разбирается
+		std::string index;
+		long from, to;
+	};
+
+	std::string const& text_; // разбираемая строка
+	size_t pos_; // текущая позиция
+	std::string error_; // текст первой ошибки
+	std::vector<SumScope> sums_; // объемлющие суммы, самая внутренняя — последняя
+};
+
+struct StridedColumn { // начало данных и шаг между соседними строками в элементах
+	double const* data;
+	size_t stride;
+};
+
+struct SpanBinding { // привязка переменной к памяти вызывающего
+	std::string name; // имя переменной
+	std::span<double const> values;
+	size_t stride; // шаг между строками в элементах
+};
+
+struct SpanOutput { // память вызывающего для результатов одной формулы
+	std::span<double> values;
+	size_t stride; // шаг между строками в элементах, больше нуля
+};
+
+// rows строк с шагом stride помещаются в size элементов; без переполнения (rows - 1) * stride
+inline bool spanFits(size_t rows, size_t stride, size_t size) {
+	return rows == 0 || (size > 0 && (stride == 0 || (rows - 1) <= (size - 1) / stride));
+}
+
+struct CacheSizes { // размеры кэшей данных в байтах
+	size_t l1;
+	size_t l2;
+};
+
+inline size_t parseCacheSize(std::string const& text) { // "32K", "1024K", "8M" из sysfs
+	size_t value = std::strtoul(text.c_str(), nullptr, 10);
+	if (text.find('K') != std::string::npos) value <<= 10;
+	if (text.find('M') != std::string::npos) value <<= 20;
+	return value;
+}
+
+inline CacheSizes detectCacheSizes() { // определяется один раз; 32 КБ и 256 КБ, если узнать не удалось
+	static CacheSizes const sizes = [] {
+		CacheSizes found = { 0, 0 };
+#ifdef _WIN32
+		DWORD length = 0;
+		GetLogicalProcessorInformation(nullptr, &length);
+		std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION) + 1);
+		if (GetLogicalProcessorInformation(info.data(), &length))
+			for (size_t i = 0; i < length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION); ++i) {
+				if (info[i].Relationship != RelationCache)
+					continue;
+				CACHE_DESCRIPTOR const& cache = info[i].Cache;
+				if (cache.Level == 1 && cache.Type != CacheInstruction && !found.l1) found.l1 = cache.Size;
+				if (cache.Level == 2 && !found.l2) found.l2 = cache.Size;
+			}
+#else
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+		long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE), l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+		found.l1 = l1 > 0 ? static_cast<size_t>(l1) : 0;
+		found.l2 = l2 > 0 ? static_cast<size_t>(l2) : 0;
+#endif
+		for (int index = 0; index < 8 && (!found.l1 || !found.l2); ++index) { // sysconf знает не везде, смотрим sysfs
+			std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+			char level[16] = {}, type[32] = {}, size[32] = {};
+			std::FILE* files[3] = { std::fopen((dir + "level").c_str(), "r"), std::fopen((dir + "type").c_str(), "r"), std::fopen((dir + "size").c_str(), "r") };
+			bool ok = files[0] && files[1] && files[2] && std::fgets(level, sizeof(level), files[0])
+				&& std::fgets(type, sizeof(type), files[1]) && std::fgets(size, sizeof(size), files[2]);
+			for (int i = 0; i < 3; ++i)
+				if (files[i]) std::fclose(files[i]);
+			if (!ok)
+				continue;
+			if (level[0] == '1' && std::strncmp(type, "Instruction", 11) != 0 && !found.l1) found.l1 = parseCacheSize(size);
+			if (level[0] == '2' && !found.l2) found.l2 = parseCacheSize(size);
+		}
+#endif
+		if (!found.l1) found.l1 = 32 << 10;
+		if (!found.l2) found.l2 = 256 << 10;
+		return found;
+	}();
+	return sizes;
+}
+
+// Политика точности задаётся для каждой формулы. APPROX разрешает ядра, которые не повторяют
+// вызов libm поэлементно (errno, ветки для особых значений) и обрабатывают сразу несколько чисел;
+// их относительная ошибка не больше оценки *_BOUND, это проверяет validateApprox
+// (LR6_TRPO --validate-approx). Сейчас такое ядро одно — atan2. sqrt и abs в обеих политиках
+// одинаковы: 1/sqrt из битов числа с шагами Ньютона оказался вдвое медленнее точного sqrtpd.
+enum Precision { PRECISE, APPROX };
+
+// atan2 без ветвлений: t = min/max по модулю, при t > tan(pi/8) вместо него u = (min - max) / (min + max)
+// и pi/4 — одно деление, |u| <= tan(pi/8); atan u = u + u z p(z), z = u^2, p — многочлен степени 10
+// (интерполяция Чебышёва, остаток около 1e-17). Затем четверть по знакам аргументов. Проверено
+// на 2e7 точек против atan2l: 1.42 DBL_EPSILON, у std::atan2 — 1 ulp. Парами SSE2 в 1.7 раза
+// быстрее std::atan2 из glibc.
+double const APPROX_ATAN2_BOUND = 2 * DBL_EPSILON;
+
+double const ATAN2_POLY[11] = { -0.33333333333333331, 0.19999999999995524, -0.14285714284666942, 0.11111111015285968,
+	-0.090909045792369733, 0.076921832153907341, -0.066645117842066365, 0.05858151808291976, -0.050854648731300266,
+	0.039232097065645691, -0.019177427268849623 }; // p(z), младший коэффициент первым
+double const TAN_PI_8 = 0.41421356237309503;
+// pi/4, pi/2, pi старшей частью и остатком: остаток прибавляется до округления к старшей
+double const PI_4 = 0x1.921fb54442d18p-1, PI_4_LOW = 3.061616997868383e-17;
+double const PI_2 = 0x1.921fb54442d18p0, PI_2_LOW = 6.123233995736766e-17;
+double const PI = 0x1.921fb54442d18p1, PI_LOW = 1.2246467991473532e-16;
+
+// результат на особых значениях (нули со знаком, бесконечности, NaN) тот же, что у std::atan2
+inline double approxAtan2(double y, double x) {
+	double ax = std::fabs(x), ay = std::fabs(y);
+	double high = ax > ay ? ax : ay, low = ax > ay ? ay : ax;
+	if (low == std::numeric_limits<double>::infinity()) // обе бесконечны: угол pi/4
+		low = high = 1.0;
+	// без переполнения min + max и без потери точности tan(pi/8) * max у денормализованных
+	double scale = high > 0x1p1022 ? 0.25 : high < 0x1p-900 ? 0x1p200 : 1.0;
+	low *= scale;
+	high *= scale;
+	bool reduced = low > TAN_PI_8 * high;
+	double numerator = reduced ? low - high : low, denominator = reduced ? low + high : high;
+	double u = denominator == 0.0 ? 0.0 : numerator / denominator;
+	double z = u * u, z2 = z * z, z4 = z2 * z2, z8 = z4 * z4; // схема Эстрина: цепочка короче, чем у Горнера
+	double const* c = ATAN2_POLY;
+	double p = ((c[0] + c[1] * z) + z2 * (c[2] + c[3] * z)) + z4 * ((c[4] + c[5] * z) + z2 * (c[6] + c[7] * z))
+		+ z8 * ((c[8] + c[9] * z) + z2 * c[10]);
+	double a = u + u * (z * p);
+	if (reduced)
+		a = (a + PI_4_LOW) + PI_4;
+	if (ay > ax)
+		a = (PI_2_LOW - a) + PI_2;
+	if (std::signbit(x))
+		a = (PI_LOW - a) + PI;
+	a = std::copysign(a, y);
+	return x != x || y != y ? x + y : a;
+}
+
+// r[k] = approxAtan2(y[k], x[k]) — те же действия парами, результаты совпадают побитово;
+// r может совпадать с y или x
+inline void approxAtan2Loop(double* r, double const* y, double const* x, size_t n) {
+	size_t k = 0;
+#ifdef LR6_SSE2
+	__m128d const sign = _mm_set1_pd(-0.0), one = _mm_set1_pd(1.0), zero = _mm_setzero_pd();
+	__m128d const inf = _mm_set1_pd(std::numeric_limits<double>::infinity());
+	auto blend = [](__m128d mask, __m128d a, __m128d b) { return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)); };
+	for (; k + 2 <= n; k += 2) {
+		__m128d vy = _mm_loadu_pd(y + k), vx = _mm_loadu_pd(x + k);
+		__m128d ax = _mm_andnot_pd(sign, vx), ay = _mm_andnot_pd(sign, vy);
+		__m128d high = _mm_max_pd(ax, ay), low = _mm_min_pd(ay, ax); // как ax > ay ? ... в скалярной
+		__m128d both = _mm_cmpeq_pd(low, inf);
+		low = blend(both, one, low);
+		high = blend(both, one, high);
+		__m128d scale = blend(_mm_cmpgt_pd(high, _mm_set1_pd(0x1p1022)), _mm_set1_pd(0.25),
+			blend(_mm_cmplt_pd(high, _mm_set1_pd(0x1p-900)), _mm_set1_pd(0x1p200), one));
+		low = _mm_mul_pd(low, scale);
+		high = _mm_mul_pd(high, scale);
+		__m128d reduced = _mm_cmpgt_pd(low, _mm_mul_pd(_mm_set1_pd(TAN_PI_8), high));
+		__m128d numerator = blend(reduced, _mm_sub_pd(low, high), low);
+		__m128d denominator = blend(reduced, _mm_add_pd(low, high), high);
+		__m128d u = _mm_and_pd(_mm_cmpneq_pd(denominator, zero), _mm_div_pd(numerator, denominator));
+		__m128d z = _mm_mul_pd(u, u), z2 = _mm_mul_pd(z, z), z4 = _mm_mul_pd(z2, z2), z8 = _mm_mul_pd(z4, z4);
+		auto pair = [z](int k) { return _mm_add_pd(_mm_set1_pd(ATAN2_POLY[k]), _mm_mul_pd(_mm_set1_pd(ATAN2_POLY[k + 1]), z)); };
+		__m128d p = _mm_add_pd(_mm_add_pd(_mm_add_pd(pair(0), _mm_mul_pd(z2, pair(2))), _mm_mul_pd(z4, _mm_add_pd(pair(4), _mm_mul_pd(z2, pair(6))))),
+			_mm_mul_pd(z8, _mm_add_pd(pair(8), _mm_mul_pd(z2, _mm_set1_pd(ATAN2_POLY[10])))));
+		__m128d a = _mm_add_pd(u, _mm_mul_pd(u, _mm_mul_pd(z, p)));
+		a = blend(reduced, _mm_add_pd(_mm_add_pd(a, _mm_set1_pd(PI_4_LOW)), _mm_set1_pd(PI_4)), a);
+		a = blend(_mm_cmpgt_pd(ay, ax), _mm_add_pd(_mm_sub_pd(_mm_set1_pd(PI_2_LOW), a), _mm_set1_pd(PI_2)), a);
+		__m128d negative = _mm_castsi128_pd(_mm_shuffle_epi32(_mm_srai_epi32(_mm_castpd_si128(vx), 31), _MM_SHUFFLE(3, 3, 1, 1)));
+		a = blend(negative, _mm_add_pd(_mm_sub_pd(_mm_set1_pd(PI_LOW), a), _mm_set1_pd(PI)), a);
+		a = _mm_or_pd(_mm_andnot_pd(sign, a), _mm_and_pd(sign, vy));
+		_mm_storeu_pd(r + k, blend(_mm_cmpunord_pd(vx, vy), _mm_add_pd(vx, vy), a));
+	}
+#endif
+	for (; k < n; ++k)
+		r[k] = approxAtan2(y[k], x[k]);
+}
+
+inline void approxAtan2Loop(float* r, float const* y, float const* x, size_t n) { // во float хватает округления double
+	for (size_t k = 0; k < n; ++k)
+		r[k] = static_cast<float>(approxAtan2(y[k], x[k]));
+}
+
+inline void sqrtLoop(double* r, double const* a, size_t n) { // результаты те же, что у std::sqrt
+	size_t k = 0;
+#ifdef LR6_SSE2
+	for (; k + 2 <= n; k += 2) // без errno: отрицательные дают NaN, как и sqrt
+		_mm_storeu_pd(r + k, _mm_sqrt_pd(_mm_loadu_pd(a + k)));
+#endif
+	for (; k < n; ++k)
+		r[k] = std::sqrt(a[k]);
+}
+
+inline void sqrtLoop(float* r, float const* a, size_t n) { // для поддеревьев во float
+	size_t k = 0;
+#ifdef LR6_SSE2
+	for (; k + 4 <= n; k += 4)
+		_mm_storeu_ps(r + k, _mm_sqrt_ps(_mm_loadu_ps(a + k)));
+#endif
+	for (; k < n; ++k)
+		r[k] = std::sqrt(a[k]);
+}
+
+struct OutputColumn { // куда писать результат: начало и шаг между строками в элементах
+	double* data;
+	size_t stride;
+};
+
+struct BatchEvaluator { // поблочное вычисление формул сразу для многих строк (по столбцам)
+	// tile — строк, проходящих через все инструкции за раз; 0 — подобрать по размеру кэша;
+	// liftConstants — числа формулы становятся параметрами, которые можно менять без перекомпиляции
+	// plan — поддеревья, которые считаются во float (planMixedPrecision), nullptr — всё в double;
+	// формула должна жить не меньше вычислителя: узлы сумм и dot читаются при вычислении
+	BatchEvaluator(Expression const* expr, size_t block = 4096, size_t tile = 0, bool liftConstants = false,
+		Precision precision = PRECISE, MixedPrecisionPlan const* plan = nullptr)
+		: block_(block), lift_(liftConstants), approx_(precision == APPROX), plan_(plan), single_(false) {
+		assert(expr && block_ > 0);
+		{
+			TraceSpan span("compile+CSE");
+			PerfScope perf("compile+CSE");
+			results_.push_back(compile(expr));
+		}
+		finish(tile);
+	}
+
+	// несколько формул над одними входами — одна общая программа: одинаковые поддеревья
+	// (в том числе из разных формул) вычисляются один раз, каждый тайл входа читается один раз
+	// precision — политика каждой формулы, пустой вектор — все PRECISE
+	BatchEvaluator(std::vector<Expression const*> const& exprs, size_t block = 4096, size_t tile = 0, bool liftConstants = false,
+		std::vector<Precision> const& precision = std::vector<Precision>(), MixedPrecisionPlan const* plan = nullptr)
+		: block_(block), lift_(liftConstants), approx_(false), plan_(plan), single_(false) {
+		assert(!exprs.empty() && block_ > 0 && (precision.empty() || precision.size() == exprs.size()));
+		{
+			TraceSpan span("compile+CSE");
+			PerfScope perf("compile+CSE");
+			for (size_t i = 0; i < exprs.size(); ++i) {
+				approx_ = !precision.empty() && precision[i] == APPROX; // приближённый atan2 — свой вид инструкции,
+				results_.push_back(compile(exprs[i])); // общим с точным CALL он не станет
+			}
+		}
+		finish(tile);
+	}
+
+	std::vector<std::string> const& inputs() const { return inputs_; } // имена переменных = входные столбцы
+	size_t outputs() const { return results_.size(); } // число формул = выходных столбцов
+	size_t instructions() const { return code_.size(); } // после удаления общих подвыражений
+	size_t block() const { return block_; } // наибольшее число строк за один вызов evaluate
+	size_t tile() const { return tile_; }
+	size_t registers() const { return registers_; } // одновременно живых промежуточных столбцов double
+	size_t singleRegisters() const { return singleRegisters_; } // и столбцов float
+	enum NodeClass { CONSTANT, UNIFORM, PER_ROW }; // от чего зависит значение узла
+
+	// класс каждой инструкции при последнем вычислении: CONSTANT — только числа, считается один раз
+	// при компиляции; UNIFORM — параметры и переменные с шагом 0, считается один раз на пакет и
+	// подставляется в циклы скаляром; PER_ROW — всё остальное, считается по тайлам
+	std::vector<int> const& classes() const { return class_; }
+	size_t parameters() const { return defaults_.size(); } // поднятых чисел (0 без liftConstants)
+	std::vector<double> const& defaults() const { return defaults_; } // числа исходной формулы
+
+	// значения параметров для следующих evaluate (parameters() чисел, память вызывающего);
+	// nullptr — вернуть числа исходной формулы
+	void setParameters(double const* params) { params_ = params ? params : defaults_.data(); }
+
+	// массивы, на элементы которых ссылаются суммы формул: имя -> наименьшая нужная длина;
+	// у массивов из dot длина 0, их формы проверяет checkArrays
+	std::map<std::string, size_t> const& arrays() const { return extents_; }
+
+	// значения массива для следующих evaluate (память вызывающего, values[k] — элемент k);
+	// до вычисления должен быть привязан каждый массив из arrays()
+	void bindArray(std::string const& name, std::span<double const> values) {
+		std::map<std::string, size_t>::const_iterator needed = extents_.find(name);
+		if (needed == extents_.end())
+			return; // лишние массивы просто не используются
+		assert(values.size() >= needed->second);
+		bound_[name] = values;
+		for (size_t r = 0; r < reductions_.size(); ++r) {
+			Reduction& sum = reductions_[r];
+			for (size_t i = 0; i < sum.inputs.size(); ++i)
+				if (sum.inputs[i].array == name)
+					sum.inputs[i].data = values.data();
+			sum.body->bindArray(name, values); // и суммам внутри тела
+		}
+	}
+
+	// согласованы ли длины массивов и матриц в dot при текущих привязках; иначе описание в error
+	bool checkArrays(std::string& error) const {
+		for (size_t d = 0; d < dots_.size(); ++d) {
+			size_t a, b;
+			if (!arrayLength(dots_[d]->left(), BoundArrays{ bound_ }, a, error) || !arrayLength(dots_[d]->right(), BoundArrays{ bound_ }, b, error))
+				return false;
+			if (a != b) {
+				error = "длины массивов в dot(" + dots_[d]->left().text() + "," + dots_[d]->right().text() + ") различаются: "
+					+ std::to_string(a) + " и " + std::to_string(b);
+				return false;
+			}
+		}
+		for (size_t r = 0; r < reductions_.size(); ++r)
+			if (!reductions_[r].body->checkArrays(error))
+				return false;
+		return true;
+	}
+
+	// одна формула с разными наборами параметров за один проход: всё, что от параметров
+	// не зависит (входы и их комбинации), вычисляется один раз на тайл, зависимая часть — для
+	// каждого набора. paramSets — sets наборов подряд, outs[s * outputs() + j] — n результатов
+	// формулы j для набора s
+	void evaluateSweep(double const* const* columns, size_t n, double const* paramSets, size_t sets, double* const* outs) {
+		assert(n <= block_);
+		double const* saved = params_;
+		strided_.resize(inputs_.size());
+		for (size_t i = 0; i < inputs_.size(); ++i)
+			strided_[i] = StridedColumn{ columns[i], 1 };
+		classify(strided_.data());
+		tileColumns_.resize(inputs_.size());
+		tileOuts_.resize(results_.size());
+		for (size_t start = 0; start < n; start += tile_) {
+			size_t m = n - start < tile_ ? n - start : tile_;
+			for (size_t i = 0; i < inputs_.size(); ++i)
+				tileColumns_[i] = StridedColumn{ columns[i] + start, 1 };
+			runRange(tileColumns_.data(), m, 0, firstDependent_);
+			for (size_t s = 0; s < sets; ++s) {
+				params_ = paramSets + s * defaults_.size();
+				computeUniform(tileColumns_.data(), firstDependent_, code_.size()); // скаляры, зависящие от параметров
+				runRange(tileColumns_.data(), m, firstDependent_, code_.size());
+				for (size_t j = 0; j < results_.size(); ++j)
+					tileOuts_[j] = OutputColumn{ outs[s * results_.size() + j] + start, 1 };
+				store(tileOuts_.data(), m);
+			}
+		}
+		params_ = saved;
+	}
+
+
+	// промежуточные столбцы тайла должны помещаться в L1 (или хотя бы в половину L2,
+	// оставляя место потокам входных данных), тогда между узлами они не вытесняются в память
+	static size_t chooseTile(size_t registers, CacheSizes const& cache) {
+		size_t bytesPerRow = (registers ? registers : 1) * sizeof(double);
+		size_t tile = cache.l1 / bytesPerRow;
+		if (tile < 256)
+			tile = cache.l2 / 2 / bytesPerRow;
+		tile -= tile % 16; // целое число векторов и строк кэша
+		return tile < 64 ? 64 : tile;
+	}
+
+	// columns[i] — n значений переменной inputs()[i], результат первой формулы пишется в out
+	void evaluate(double const* const* columns, size_t n, double* out) {
+		double* outs[1] = { out };
+		evaluate(columns, n, outs);
+	}
+
+	// outs[j] — n результатов формулы j
+	void evaluate(double const* const* columns, size_t n, double* const* outs) {
+		strided_.resize(inputs_.size());
+		for (size_t i = 0; i < inputs_.size(); ++i)
+			strided_[i] = StridedColumn{ columns[i], 1 };
+		outColumns_.resize(results_.size());
+		for (size_t j = 0; j < results_.size(); ++j)
+			outColumns_[j] = OutputColumn{ outs[j], 1 };
+		classify(strided_.data()); // один вызов — один пакет
+		run(strided_.data(), n, outColumns_.data());
+	}
+
+	// вычисление прямо над памятью вызывающего: каждая переменная — span с шагом в элементах
+	// (1 — столбец, размер структуры — поле массива структур, число столбцов — столбец матрицы,
+	// 0 — одно значение на все строки); результат пишется в out с шагом outStride.
+	// Привязки приходят от вызывающего, поэтому ошибки в них — false и текст в error, ничего не записано
+	bool evaluate(std::vector<SpanBinding> const& bindings, std::span<double> out, size_t outStride, std::string& error) {
+		if (outStride == 0) {
+			error = "шаг результата должен быть больше нуля";
+			return false;
+		}
+		return evaluate(bindings, (out.size() + outStride - 1) / outStride, std::vector<SpanOutput>(1, SpanOutput{ out, outStride }), error);
+	}
+
+	// то же для нескольких формул: outs[j] — rows результатов формулы j со своим шагом
+	bool evaluate(std::vector<SpanBinding> const& bindings, size_t rows, std::vector<SpanOutput> const& outs, std::string& error) {
+		if (outs.size() != results_.size()) {
+			error = "ожидается результатов: " + std::to_string(results_.size()) + ", передано: " + std::to_string(outs.size());
+			return false;
+		}
+		for (size_t j = 0; j < outs.size(); ++j) {
+			if (outs[j].stride == 0) {
+				error = "шаг результата должен быть больше нуля";
+				return false;
+			}
+			if (!spanFits(rows, outs[j].stride, outs[j].values.size())) {
+				error = "результату " + std::to_string(j + 1) + " не хватает места для " + std::to_string(rows) + " строк";
+				return false;
+			}
+		}
+		std::vector<StridedColumn> columns(inputs_.size(), StridedColumn{ nullptr, 0 });
+		for (size_t b = 0; b < bindings.size(); ++b) {
+			SpanBinding const& binding = bindings[b];
+			for (size_t i = 0; i < inputs_.size(); ++i)
+				if (inputs_[i] == binding.name) { // лишние привязки просто не используются
+					if (!spanFits(rows, binding.stride, binding.values.size())) {
+						error = "переменной " + binding.name + " не хватает значений для " + std::to_string(rows) + " строк";
+						return false;
+					}
+					columns[i] = StridedColumn{ binding.values.data(), binding.stride };
+				}
+		}
+		for (size_t i = 0; i < columns.size(); ++i)
+			if (!columns[i].data && rows > 0) {
+				error = "не привязана переменная " + inputs_[i];
+				return false;
+			}
+		if (rows == 0)
+			return true;
+		classify(columns.data()); // переменные с шагом 0 одинаковы во всех блоках вызова
+		std::vector<StridedColumn> shifted(columns);
+		std::vector<OutputColumn> shiftedOuts(outs.size());
+		for (size_t start = 0; start < rows; start += block_) {
+			size_t n = rows - start < block_ ? rows - start : block_;
+			for (size_t i = 0; i < columns.size(); ++i)
+				shifted[i].data = columns[i].data + start * columns[i].stride;
+			for (size_t j = 0; j < outs.size(); ++j)
+				shiftedOuts[j] = OutputColumn{ outs[j].values.data() + start * outs[j].stride, outs[j].stride };
+			run(shifted.data(), n, shiftedOuts.data());
+		}
+		return true;
+	}
+
+private:
+	enum { LOAD, CONST, PARAM, BINOP, SQRT, ABS, WIDEN, CMP, SELECT, MIN, MAX, CALL, NEG, SUM, DOT, ATAN2_APPROX }; // виды инструкций; WIDEN — float в double
+
+	struct Instr {
+		int kind; // вид инструкции
+		int op; // символ операции для BINOP, вид сравнения для CMP, номер функции для CALL
+		int a, b, c; // номера инструкций-операндов, c только у SELECT (условие в a) и fma
+		int input; // номер входного столбца для LOAD, параметра для PARAM, свёртки для SUM, произведения для DOT
+		double value; // значение для CONST
+		int reg; // регистр для результата
+		bool single; // считается во float, регистр из fregs_
+	};
+
+	typedef std::tuple<int, int, int, int, int, int, std::uint64_t, bool> InstrKey; // вид, операция, операнды, вход, константа, float
+
+	static size_t const SUM_BLOCK = 4096; // слагаемых за один проход тела суммы, кратно Summation::BLOCK
+
+	struct SumInput { // откуда берётся вход тела суммы
+		int outer; // номер входа этой программы — внешняя переменная, одна на все слагаемые; -1 — нет
+		std::string array; // массив для элемента; пусто у индекса и внешних переменных
+		long offset; // сдвиг элемента относительно индекса
+		double const* data; // значения массива из bindArray
+	};
+
+	struct Reduction { // сумма: тело — своя программа, слагаемые считаются столбцами по SUM_BLOCK
+		Sum const* sum; // узел формулы, одинаковые суммы — одна свёртка
+		std::unique_ptr<BatchEvaluator> body;
+		std::vector<SumInput> inputs; // по входам тела
+		std::vector<StridedColumn> columns; // столбцы тела для текущей строки
+		std::vector<StridedColumn> shifted; // они же, сдвинутые к началу прохода
+		std::vector<double> values; // значения внешних переменных в текущей строке
+		bool indexed; // тело использует сам индекс, а не только элементы массивов
+		bool uniform; // ни индекса, ни элементов: все слагаемые одинаковы
+		std::vector<double> index; // значения индекса в проходе
+		std::vector<double> terms; // слагаемые прохода
+	};
+
+	void finish(size_t tile) { // общая часть конструкторов
+		TraceSpan span("hoist+registers");
+		hoistParameterFree();
+		params_ = defaults_.data();
+		allocateRegisters();
+		tile_ = tile ? tile : chooseTile(registers_ + (singleRegisters_ + 1) / 2, detectCacheSizes());
+		if (tile_ > block_)
+			tile_ = block_;
+		regs_.resize(registers_ * tile_);
+		fregs_.resize(singleRegisters_ * tile_);
+		ptrs_.resize(code_.size());
+		fptrs_.resize(code_.size());
+		scratch_.resize(3 * tile_);
+		fscratch_.resize(3 * tile_);
+		memo_.clear(); // нужна только при компиляции
+		plan_ = nullptr;
+		constant_.assign(code_.size(), false);
+		scalars_.assign(code_.size(), 0.0);
+		class_.assign(code_.size(), PER_ROW);
+		for (size_t i = 0; i < code_.size(); ++i) { // поддеревья из одних чисел сворачиваем сразу
+			Instr const& in = code_[i];
+			constant_[i] = in.kind == CONST
+				|| (in.a >= 0 && constant_[in.a] && (in.b < 0 || constant_[in.b]) && (in.c < 0 || constant_[in.c]));
+			if (constant_[i]) {
+				class_[i] = CONSTANT;
+				scalars_[i] = scalar(in);
+			}
+		}
+	}
+
+	void classify(StridedColumn const* columns) { // классы инструкций и скаляры для очередного пакета
+		for (size_t i = 0; i < code_.size(); ++i) {
+			Instr const& in = code_[i];
+			if (constant_[i])
+				continue;
+			if (in.kind == LOAD)
+				class_[i] = columns[in.input].stride == 0 ? UNIFORM : PER_ROW;
+			else if (in.kind == PARAM || in.kind == DOT) // массивы одни на весь пакет
+				class_[i] = UNIFORM;
+			else if (in.kind == SUM) { // одна сумма на пакет, если внешние переменные тела одинаковы во всех строках
+				Reduction const& sum = reductions_[in.input];
+				class_[i] = UNIFORM;
+				for (size_t j = 0; j < sum.inputs.size(); ++j)
+					if (sum.inputs[j].outer >= 0 && columns[sum.inputs[j].outer].stride != 0)
+						class_[i] = PER_ROW;
+			}
+			else {
+				class_[i] = in.b >= 0 && class_[in.b] > class_[in.a] ? class_[in.b] : class_[in.a];
+				if (in.c >= 0 && class_[in.c] > class_[i])
+					class_[i] = class_[in.c];
+			}
+		}
+		computeUniform(columns, 0, code_.size());
+	}
+
+	void computeUniform(StridedColumn const* columns, size_t from, size_t to) { // один раз на пакет
+		for (size_t i = from; i < to; ++i)
+			if (class_[i] == UNIFORM)
+				scalars_[i] = code_[i].kind == LOAD && code_[i].single ? static_cast<float>(columns[code_[i].input].data[0])
+					: code_[i].kind == LOAD ? columns[code_[i].input].data[0]
+					: code_[i].kind == SUM ? reduce(reductions_[code_[i].input], columns, 0)
+					: code_[i].kind == DOT ? dots_[code_[i].input]->value<double>(BoundArrays{ bound_ }) : scalar(code_[i]);
+	}
+
+	struct BoundArrays { // значения привязанного массива, у непривязанного — пусто
+		std::map<std::string, std::span<double const> > const& bound;
+		std::span<double const> operator()(std::string const& name) const {
+			std::map<std::string, std::span<double const> >::const_iterator found = bound.find(name);
+			return found != bound.end() ? found->second : std::span<double const>();
+		}
+	};
+
+	// сумма для строки row: внешние переменные тела берутся из этой строки columns
+	double reduce(Reduction& sum, StridedColumn const* columns, size_t row) {
+		size_t count = sum.sum->count();
+		if (!count)
+			return 0.0;
+		BatchEvaluator& body = *sum.body;
+		for (size_t i = 0; i < sum.inputs.size(); ++i) {
+			SumInput const& source = sum.inputs[i];
+			if (source.outer >= 0) {
+				StridedColumn const& column = columns[source.outer];
+				sum.values[i] = column.data[row * column.stride];
+				sum.columns[i] = StridedColumn{ &sum.values[i], 0 };
+			}
+			else if (source.array.empty())
+				sum.columns[i] = StridedColumn{ sum.index.data(), 1 };
+			else {
+				assert(source.data); // массив не привязан через bindArray
+				sum.columns[i] = StridedColumn{ source.data + (sum.sum->from() + source.offset), 1 };
+			}
+		}
+		body.classify(sum.columns.data()); // скаляры тела — от внешних переменных этой строки
+		OutputColumn out = { sum.terms.data(), 1 };
+		if (sum.uniform) { // одно слагаемое, как в Sum::evaluate
+			body.run(sum.columns.data(), 1, &out);
+			return Sum::uniform(count, sum.terms[0]);
+		}
+		Summation<double> total(sum.sum->mode());
+		for (size_t start = 0; start < count; start += SUM_BLOCK) {
+			size_t n = count - start < SUM_BLOCK ? count - start : SUM_BLOCK;
+			for (size_t k = 0; sum.indexed && k < n; ++k)
+				sum.index[k] = static_cast<double>(sum.sum->from() + static_cast<long>(start + k));
+			for (size_t i = 0; i < sum.inputs.size(); ++i) {
+				sum.shifted[i] = sum.columns[i];
+				if (!sum.inputs[i].array.empty())
+					sum.shifted[i].data += start;
+			}
+			body.run(sum.shifted.data(), n, &out);
+			total.add(sum.terms.data(), n);
+		}
+		return total.result();
+	}
+
+	double scalar(Instr const& in) const { // значение инструкции со скалярными операндами
+		return in.single ? scalarAs<float>(in) : scalarAs<double>(in);
+	}
+
+	template<class T> T scalarAs(Instr const& in) const { // скаляры float хранятся в scalars_ точно
+		T a = static_cast<T>(in.a >= 0 ? scalars_[in.a] : 0.0);
+		T b = static_cast<T>(in.b >= 0 ? scalars_[in.b] : 0.0);
+		T c = static_cast<T>(in.c >= 0 ? scalars_[in.c] : 0.0);
+		switch (in.kind) {
+		case CONST: return static_cast<T>(in.value);
+		case PARAM: return static_cast<T>(params_[in.input]);
+		case SQRT: return std::sqrt(a);
+		case ABS: return std::fabs(a);
+		case NEG: return -a;
+		case WIDEN: return a;
+		case CMP: return Comparison::holds(in.op, a, b) ? T(1) : T(0);
+		case SELECT: return a != 0 ? b : c;
+		case MIN: return MinMax::apply(MinMax::MIN, a, b);
+		case MAX: return MinMax::apply(MinMax::MAX, a, b);
+		case CALL: {
+			T x[3] = { a, b, c };
+			return FunctionCall::apply(in.op, x);
+		}
+		case ATAN2_APPROX: return static_cast<T>(approxAtan2(a, b));
+		case BINOP:
+			switch (in.op) {
+			case BinaryOperation::PLUS: return a + b;
+			case BinaryOperation::MINUS: return a - b;
+			case BinaryOperation::MUL: return a * b;
+			case BinaryOperation::DIV: return a / b;
+			}
+		}
+		return 0;
+	}
+
+	// r = f(a, b), где один из операндов может быть скаляром (a или b равен nullptr)
+	template<class T, class F> static void binaryLoop(T* r, T const* a, T const* b, T sa, T sb, size_t n, F f) {
+		if (a && b)
+			for (size_t k = 0; k < n; ++k) r[k] = f(a[k], b[k]);
+		else if (a)
+			for (size_t k = 0; k < n; ++k) r[k] = f(a[k], sb);
+		else
+			for (size_t k = 0; k < n; ++k) r[k] = f(sa, b[k]);
+	}
+
+	// скалярный операнд размножается в буфер, чтобы цикл выбора был одним и без ветвлений
+	template<class T> static T const* spread(T const* v, T s, T* buffer, size_t n) {
+		if (v)
+			return v;
+		for (size_t k = 0; k < n; ++k) buffer[k] = s;
+		return buffer;
+	}
+
+	double* scratch(double*) { return scratch_.data(); }
+	float* scratch(float*) { return fscratch_.data(); }
+
+	void run(StridedColumn const* columns, size_t n, OutputColumn const* outs) { // n <= block_
+		TraceSpan span("evaluate");
+		PerfScope perf("evaluate");
+		assert(n <= block_);
+		tileColumns_.resize(inputs_.size());
+		tileOuts_.resize(results_.size());
+		for (size_t start = 0; start < n; start += tile_) { // все узлы всех формул над одним тайлом, затем следующий
+			for (size_t i = 0; i < inputs_.size(); ++i)
+				tileColumns_[i] = StridedColumn{ columns[i].data + start * columns[i].stride, columns[i].stride };
+			for (size_t j = 0; j < results_.size(); ++j)
+				tileOuts_[j] = OutputColumn{ outs[j].data + start * outs[j].stride, outs[j].stride };
+			runTile(tileColumns_.data(), n - start < tile_ ? n - start : tile_, tileOuts_.data());
+		}
+	}
+
+	void runTile(StridedColumn const* columns, size_t n, OutputColumn const* outs) { // n <= tile_
+		runRange(columns, n, 0, code_.size());
+		store(outs, n);
+	}
+
+	void runRange(StridedColumn const* columns, size_t n, size_t from, size_t to) { // инструкции [from, to)
+		for (size_t i = from; i < to; ++i) {
+			if (class_[i] != PER_ROW) // посчитано заранее в classify
+				continue;
+			Instr const& in = code_[i];
+			if (in.single) {
+				float* r = &fregs_[in.reg * tile_];
+				if (in.kind == LOAD) { // вход переводится во float при чтении
+					StridedColumn const& column = columns[in.input];
+					for (size_t k = 0; k < n; ++k)
+						r[k] = static_cast<float>(column.data[k * column.stride]);
+				}
+				else
+					compute(in, r, in.a >= 0 && class_[in.a] == PER_ROW ? fptrs_[in.a] : nullptr,
+						in.b >= 0 && class_[in.b] == PER_ROW ? fptrs_[in.b] : nullptr,
+						in.c >= 0 && class_[in.c] == PER_ROW ? fptrs_[in.c] : nullptr, n);
+				fptrs_[i] = r;
+				continue;
+			}
+			double* r = &regs_[in.reg * tile_];
+			if (in.kind == WIDEN) { // операнд — построчный float, иначе инструкция была бы скаляром
+				float const* a = fptrs_[in.a];
+				for (size_t k = 0; k < n; ++k) r[k] = a[k];
+				ptrs_[i] = r;
+				continue;
+			}
+			if (in.kind == SUM) { // слагаемые зависят от строки — своя свёртка для каждой
+				for (size_t k = 0; k < n; ++k)
+					r[k] = reduce(reductions_[in.input], columns, k);
+				ptrs_[i] = r;
+				continue;
+			}
+			if (in.kind == LOAD) {
+				StridedColumn const& column = columns[in.input];
+				if (column.stride == 1) { // сплошной столбец читаем прямо из памяти вызывающего
+					ptrs_[i] = column.data;
+					continue;
+				}
+				for (size_t k = 0; k < n; ++k) // иначе собираем значения с шагом в свой регистр
+					r[k] = column.data[k * column.stride];
+				ptrs_[i] = r;
+				continue;
+			}
+			// у построчной инструкции хотя бы один операнд построчный, остальные могут быть скалярами
+			compute(in, r, in.a >= 0 && class_[in.a] == PER_ROW ? ptrs_[in.a] : nullptr,
+				in.b >= 0 && class_[in.b] == PER_ROW ? ptrs_[in.b] : nullptr,
+				in.c >= 0 && class_[in.c] == PER_ROW ? ptrs_[in.c] : nullptr, n);
+			ptrs_[i] = r;
+		}
+	}
+
+	template<class T> void compute(Instr const& in, T* r, T const* a, T const* b, T const* c, size_t n) { // операции в типе T
+		T sa = static_cast<T>(in.a >= 0 ? scalars_[in.a] : 0.0);
+		T sb = static_cast<T>(in.b >= 0 ? scalars_[in.b] : 0.0);
+		T sc = static_cast<T>(in.c >= 0 ? scalars_[in.c] : 0.0);
+		switch (in.kind) {
+		case CMP: // результат 1 или 0, как у Comparison::evaluate
+			switch (in.op) {
+			case Comparison::LESS: binaryLoop(r, a, b, sa, sb, n, [](T x, T y) { return x < y ? T(1) : T(0); }); break;
+			case Comparison::LESS_EQUAL: binaryLoop(r, a, b, sa, sb, n, [](T x, T y) { return x <= y ? T(1) : T(0); }); break;
+			case Comparison::GREATER: binaryLoop(r, a, b, sa, sb, n, [](T x, T y) { return x > y ? T(1) : T(0); }); break;
+			case Comparison::GREATER_EQUAL: binaryLoop(r, a, b, sa, sb, n, [](T x, T y) { return x >= y ? T(1) : T(0); }); break;
+			case Comparison::EQUAL: binaryLoop(r, a, b, sa, sb, n, [](T x, T y) { return x == y ? T(1) : T(0); }); break;
+			case Comparison::NOT_EQUAL: binaryLoop(r, a, b, sa, sb, n, [](T x, T y) { return x != y ? T(1) : T(0); }); break;
+			}
+			break;
+		case SELECT: { // обе ветви уже посчитаны для всего тайла, выбор — маска вместо перехода
+			T* buffer = scratch(r);
+			T const* cond = spread(a, sa, buffer, n);
+			T const* then = spread(b, sb, buffer + tile_, n);
+			T const* otherwise = spread(c, sc, buffer + 2 * tile_, n);
+			for (size_t k = 0; k < n; ++k) r[k] = cond[k] != 0 ? then[k] : otherwise[k];
+			break;
+		}
+		case MIN:
+			binaryLoop(r, a, b, sa, sb, n, [](T x, T y) { return MinMax::apply(MinMax::MIN, x, y); });
+			break;
+		case MAX:
+			binaryLoop(r, a, b, sa, sb, n, [](T x, T y) { return MinMax::apply(MinMax::MAX, x, y); });
+			break;
+		case CALL: {
+			if (in.op == FunctionCall::POW && !b && FunctionCall::smallInteger(sb)) { // общий целый показатель
+				FunctionCall::powerLoop(r, a, static_cast<long>(sb), scratch(r), n);
+				break;
+			}
+			T* buffer = scratch(r);
+			T const* x[3] = { spread(a, sa, buffer, n), in.b >= 0 ? spread(b, sb, buffer + tile_, n) : nullptr,
+				in.c >= 0 ? spread(c, sc, buffer + 2 * tile_, n) : nullptr };
+			FunctionCall::applyLoop(in.op, r, x, n);
+			break;
+		}
+		case ATAN2_APPROX: {
+			T* buffer = scratch(r);
+			approxAtan2Loop(r, spread(a, sa, buffer, n), spread(b, sb, buffer + tile_, n), n);
+			break;
+		}
+		case SQRT:
+			sqrtLoop(r, a, n);
+			break;
+		case ABS:
+			for (size_t k = 0; k < n; ++k) r[k] = std::fabs(a[k]);
+			break;
+		case NEG:
+			for (size_t k = 0; k < n; ++k) r[k] = -a[k];
+			break;
+		case BINOP:
+			switch (in.op) { // простые циклы без ветвлений внутри, компилятор их векторизует
+			case BinaryOperation::PLUS: binaryLoop(r, a, b, sa, sb, n, [](T x, T y) { return x + y; }); break;
+			case BinaryOperation::MINUS: binaryLoop(r, a, b, sa, sb, n, [](T x, T y) { return x - y; }); break;
+			case BinaryOperation::MUL: binaryLoop(r, a, b, sa, sb, n, [](T x, T y) { return x * y; }); break;
+			case BinaryOperation::DIV: binaryLoop(r, a, b, sa, sb, n, [](T x, T y) { return x / y; }); break;
+			}
+			break;
+		}
+	}
+
+	void store(OutputColumn const* outs, size_t n) { // результаты тайла в выходные столбцы
+		for (size_t j = 0; j < results_.size(); ++j) {
+			if (class_[results_[j]] != PER_ROW) { // формула не зависит от строки — размножаем скаляр
+				for (size_t k = 0; k < n; ++k)
+					outs[j].data[k * outs[j].stride] = scalars_[results_[j]];
+				continue;
+			}
+			double const* result = ptrs_[results_[j]];
+			if (outs[j].stride == 1)
+				std::memcpy(outs[j].data, result, n * sizeof(double));
+			else
+				for (size_t k = 0; k < n; ++k)
+					outs[j].data[k * outs[j].stride] = result[k];
+		}
+	}
+
+	void allocateRegisters() { // регистр операнда освобождается после последнего использования
+		std::vector<size_t> lastUse(code_.size(), 0);
+		for (size_t i = 0; i < code_.size(); ++i) {
+			if (code_[i].a >= 0) lastUse[code_[i].a] = i;
+			if (code_[i].b >= 0) lastUse[code_[i].b] = i;
+			if (code_[i].c >= 0) lastUse[code_[i].c] = i;
+		}
+		for (size_t j = 0; j < results_.size(); ++j)
+			lastUse[results_[j]] = code_.size(); // результаты живут до конца тайла
+		for (size_t i = firstDependent_; i < code_.size(); ++i) { // в evaluateSweep независимая часть
+			if (code_[i].a >= 0 && static_cast<size_t>(code_[i].a) < firstDependent_) // нужна каждому набору
+				lastUse[code_[i].a] = code_.size();
+			if (code_[i].b >= 0 && static_cast<size_t>(code_[i].b) < firstDependent_)
+				lastUse[code_[i].b] = code_.size();
+			if (code_[i].c >= 0 && static_cast<size_t>(code_[i].c) < firstDependent_)
+				lastUse[code_[i].c] = code_.size();
+		}
+		std::vector<int> free[2]; // свободные регистры double и float распределяются отдельно
+		size_t* count[2] = { &registers_, &singleRegisters_ };
+		registers_ = singleRegisters_ = 0;
+		for (size_t i = 0; i < code_.size(); ++i) {
+			int operands[3] = { code_[i].a, code_[i].b, code_[i].c };
+			for (int k = 0; k < 3; ++k) // поэлементные циклы позволяют писать результат поверх операнда
+				if (operands[k] >= 0 && lastUse[operands[k]] == i
+					&& (k < 1 || operands[k] != operands[0]) && (k < 2 || operands[k] != operands[1]))
+					free[code_[operands[k]].single].push_back(code_[operands[k]].reg);
+			std::vector<int>& bank = free[code_[i].single];
+			if (bank.empty())
+				code_[i].reg = static_cast<int>((*count[code_[i].single])++);
+			else {
+				code_[i].reg = bank.back();
+				bank.pop_back();
+			}
+		}
+	}
+
+	void hoistParameterFree() { // инструкции, не зависящие от параметров, переносим в начало программы
+		std::vector<bool> dependent(code_.size(), false);
+		std::vector<int> order;
+		for (size_t i = 0; i < code_.size(); ++i) {
+			Instr const& in = code_[i];
+			dependent[i] = in.kind == PARAM || (in.a >= 0 && dependent[in.a]) || (in.b >= 0 && dependent[in.b])
+				|| (in.c >= 0 && dependent[in.c]);
+			if (!dependent[i])
+				order.push_back(static_cast<int>(i));
+		}
+		firstDependent_ = order.size();
+		for (size_t i = 0; i < code_.size(); ++i)
+			if (dependent[i])
+				order.push_back(static_cast<int>(i)); // порядок внутри частей сохраняется, операнды остаются раньше
+		std::vector<int> position(code_.size());
+		std::vector<Instr> moved;
+		for (size_t i = 0; i < order.size(); ++i) {
+			position[order[i]] = static_cast<int>(i);
+			moved.push_back(code_[order[i]]);
+		}
+		for (size_t i = 0; i < moved.size(); ++i) {
+			if (moved[i].a >= 0) moved[i].a = position[moved[i].a];
+			if (moved[i].b >= 0) moved[i].b = position[moved[i].b];
+			if (moved[i].c >= 0) moved[i].c = position[moved[i].c];
+		}
+		for (size_t j = 0; j < results_.size(); ++j)
+			results_[j] = position[results_[j]];
+		code_.swap(moved);
+	}
+
+	int compile(Expression const* expr) { // обход снизу вверх, возвращает номер инструкции
+		bool outer = single_;
+		if (plan_ && plan_->single.count(expr)) // поддерево из плана смешанной точности
+			single_ = true;
+		int result = compileNode(expr);
+		single_ = outer;
+		if (code_[result].single && !outer) { // на выходе из поддерева float значение расширяется
+			Instr widen = { WIDEN, 0, result, -1, -1, -1, 0.0, -1, false };
+			result = intern(widen);
+		}
+		return result;
+	}
+
+	int compileNode(Expression const* expr) {
+		Instr in = { CONST, 0, -1, -1, -1, -1, 0.0, -1, single_ };
+		if (const Number* numb = dynamic_cast<const Number*>(expr)) {
+			if (lift_) { // номер параметра — порядок числа при обходе слева направо, как в shapeKey
+				in.kind = PARAM;
+				in.input = static_cast<int>(defaults_.size());
+				defaults_.push_back(numb->value());
+			}
+			else
+				in.value = numb->value();
+		}
+		else if (const BinaryOperation* binop = dynamic_cast<const BinaryOperation*>(expr)) {
+			in.kind = BINOP;
+			in.op = binop->operation();
+			in.a = compile(binop->left());
+			in.b = compile(binop->right());
+		}
+		else if (const FunctionCall* fcall = dynamic_cast<const FunctionCall*>(expr)) {
+			if (fcall->id() == FunctionCall::SQRT || fcall->id() == FunctionCall::ABS)
+				in.kind = fcall->id() == FunctionCall::SQRT ? SQRT : ABS; // sqrt одинаков в обеих политиках
+			else if (fcall->id() == FunctionCall::ATAN2 && approx_)
+				in.kind = ATAN2_APPROX;
+			else { // остальные функции реестра — одна инструкция с ядром FunctionCall::applyLoop
+				in.kind = CALL;
+				in.op = fcall->id();
+			}
+			int* operands[3] = { &in.a, &in.b, &in.c };
+			for (size_t i = 0; i < fcall->arity(); ++i)
+				*operands[i] = compile(fcall->arg(i));
+		}
+		else if (const Comparison* cmp = dynamic_cast<const Comparison*>(expr)) {
+			in.kind = CMP;
+			in.op = cmp->operation();
+			in.a = compile(cmp->left());
+			in.b = compile(cmp->right());
+		}
+		else if (const Select* sel = dynamic_cast<const Select*>(expr)) { // обе ветви считаются для всех строк
+			in.kind = SELECT;
+			in.a = compile(sel->condition());
+			in.b = compile(sel->then());
+			in.c = compile(sel->otherwise());
+		}
+		else if (const MinMax* mm = dynamic_cast<const MinMax*>(expr)) {
+			in.kind = mm->kind() == MinMax::MIN ? MIN : MAX;
+			in.a = compile(mm->left());
+			in.b = compile(mm->right());
+		}
+		else if (const Negate* neg = dynamic_cast<const Negate*>(expr)) {
+			in.kind = NEG;
+			in.a = compile(neg->operand());
+		}
+		else if (const IntPower* power = dynamic_cast<const IntPower*>(expr)) { // цепочка умножений, как в IntPower::apply
+			std::vector<int> values(1, compile(power->base()));
+			IntPower::Chain const& steps = power->steps();
+			for (size_t k = 0; k < steps.size(); ++k) {
+				Instr mul = in;
+				mul.kind = BINOP;
+				mul.op = BinaryOperation::MUL;
+				mul.a = values[steps[k].first];
+				mul.b = values[steps[k].second];
+				values.push_back(intern(mul)); // одинаковые шаги разных степеней — одна инструкция
+			}
+			in.value = 1.0; // x^0 = 1, x^-n = 1 / x^n
+			if (power->exponent() > 0)
+				return values.back();
+			if (power->exponent() < 0) {
+				int one = intern(in);
+				in.kind = BINOP;
+				in.op = BinaryOperation::DIV;
+				in.a = one;
+				in.b = values.back();
+			}
+		}
+		else if (const Sum* sum = dynamic_cast<const Sum*>(expr)) {
+			assert(!single_); // planMixedPrecision не отдаёт суммы во float
+			in.kind = SUM;
+			in.input = reduction(sum);
+		}
+		else if (const Dot* dot = dynamic_cast<const Dot*>(expr)) {
+			assert(!single_); // и dot planMixedPrecision оставляет в double
+			in.kind = DOT;
+			in.input = dotIndex(dot);
+		}
+		else if (const IndexedVariable* element = dynamic_cast<const IndexedVariable*>(expr)) { // вход тела суммы, его подставляет свёртка
+			in.kind = LOAD;
+			in.input = inputIndex(element->element());
+		}
+		else {
+			const Variable* var = dynamic_cast<const Variable*>(expr);
+			assert(var);
+			in.kind = LOAD;
+			in.input = inputIndex(var->name());
+		}
+		return intern(in);
+	}
+
+	int intern(Instr const& in) { // новая инструкция или уже имеющаяся такая же
+		std::uint64_t bits;
+		std::memcpy(&bits, &in.value, sizeof(bits));
+		InstrKey key(in.kind, in.op, in.a, in.b, in.c, in.input, bits, in.single); // операнды уже без повторов, поэтому
+		std::map<InstrKey, int>::const_iterator found = memo_.find(key); // равные ключи — равные поддеревья
+		if (found != memo_.end())
+			return found->second;
+		code_.push_back(in);
+		memo_[key] = static_cast<int>(code_.size()) - 1;
+		return static_cast<int>(code_.size()) - 1;
+	}
+
+	int reduction(Sum const* sum) { // номер свёртки; одинаковые суммы считаются один раз
+		for (size_t r = 0; r < reductions_.size(); ++r)
+			if (sameTree(reductions_[r].sum, sum))
+				return static_cast<int>(r);
+		Reduction red;
+		red.sum = sum;
+		red.indexed = false;
+		red.body.reset(new BatchEvaluator(sum->body(), SUM_BLOCK, 0, false, approx_ ? APPROX : PRECISE));
+		std::map<std::string, IndexedVariable const*> elements; // элементы этого тела; у вложенных сумм — свои
+		std::vector<Expression const*> pending(1, sum->body());
+		while (!pending.empty()) {
+			Expression const* node = pending.back();
+			pending.pop_back();
+			if (const IndexedVariable* element = dynamic_cast<const IndexedVariable*>(node)) {
+				assert(element->index() == sum->index());
+				elements[element->element()] = element;
+			}
+			else if (!dynamic_cast<const Sum*>(node)) {
+				std::vector<Expression const*> operands = operandsOf(node);
+				pending.insert(pending.end(), operands.begin(), operands.end());
+			}
+		}
+		std::vector<std::string> const& names = red.body->inputs();
+		for (size_t i = 0; i < names.size(); ++i) {
+			SumInput source = { -1, std::string(), 0, nullptr };
+			std::map<std::string, IndexedVariable const*>::const_iterator found = elements.find(names[i]);
+			if (found != elements.end()) {
+				source.array = found->second->name();
+				source.offset = found->second->offset();
+				assert(sum->from() + source.offset >= 0 || !sum->count());
+				if (sum->count()) {
+					size_t& extent = extents_[source.array];
+					size_t last = static_cast<size_t>(sum->to() + source.offset) + 1;
+					extent = last > extent ? last : extent;
+				}
+			}
+			else if (names[i] != sum->index())
+				source.outer = inputIndex(names[i]);
+			else
+				red.indexed = true;
+			red.inputs.push_back(source);
+		}
+		std::map<std::string, size_t> const& inner = red.body->arrays();
+		for (std::map<std::string, size_t>::const_iterator it = inner.begin(); it != inner.end(); ++it)
+			extents_[it->first] = it->second > extents_[it->first] ? it->second : extents_[it->first];
+		red.uniform = !red.indexed;
+		for (size_t i = 0; i < red.inputs.size(); ++i)
+			red.uniform = red.uniform && red.inputs[i].array.empty();
+		red.columns.resize(names.size());
+		red.shifted.resize(names.size());
+		red.values.resize(names.size());
+		red.index.resize(SUM_BLOCK);
+		red.terms.resize(SUM_BLOCK);
+		reductions_.push_back(std::move(red));
+		return static_cast<int>(reductions_.size()) - 1;
+	}
+
+	int dotIndex(Dot const* dot) { // номер произведения; массивы попадают в arrays() с длиной 0
+		for (size_t d = 0; d < dots_.size(); ++d)
+			if (sameTree(dots_[d], dot))
+				return static_cast<int>(d);
+		std::set<std::string> names;
+		dot->left().arrays(names);
+		dot->right().arrays(names);
+		for (std::set<std::string>::const_iterator it = names.begin(); it != names.end(); ++it)
+			extents_.insert(std::make_pair(*it, size_t(0)));
+		dots_.push_back(dot);
+		return static_cast<int>(dots_.size()) - 1;
+	}
+
+	int inputIndex(std::string const& name) { // одна переменная — один входной столбец
+		for (size_t i = 0; i < inputs_.size(); ++i)
+			if (inputs_[i] == name) return static_cast<int>(i);
+		inputs_.push_back(name);
+		return static_cast<int>(inputs_.size()) - 1;
+	}
+
+	std::vector<Instr> code_; // инструкции в порядке вычисления
+	std::vector<std::string> inputs_; // имена входных переменных
+	std::vector<double> regs_; // registers_ регистров длиной tile_
+	std::vector<double const*> ptrs_; // откуда брать значения каждой инструкции
+	std::vector<float> fregs_; // singleRegisters_ регистров float длиной tile_
+	std::vector<float const*> fptrs_; // значения инструкций во float
+	std::vector<double> scratch_; // три буфера длиной tile_ для скалярных операндов SELECT и CALL
+	std::vector<float> fscratch_; // то же для float
+	std::vector<StridedColumn> strided_; // входные столбцы для evaluate по указателям
+	std::vector<StridedColumn> tileColumns_; // входные столбцы, сдвинутые к началу тайла
+	std::vector<OutputColumn> outColumns_; // выходные столбцы для evaluate по указателям
+	std::vector<OutputColumn> tileOuts_; // выходные столбцы, сдвинутые к началу тайла
+	std::map<InstrKey, int> memo_; // уже скомпилированные инструкции для поиска общих подвыражений
+	size_t block_; // размер блока в строках
+	size_t tile_; // размер тайла в строках
+	size_t registers_; // число регистров после распределения
+	size_t singleRegisters_; // то же для регистров float
+	std::vector<int> results_; // инструкция с итоговым значением каждой формулы
+	bool lift_; // числа компилируются в PARAM
+	bool approx_; // политика точности компилируемой формулы
+	MixedPrecisionPlan const* plan_; // нужен только при компиляции
+	bool single_; // компилируется поддерево во float
+	std::vector<double> defaults_; // числа исходной формулы по номерам параметров
+	double const* params_; // текущие значения параметров
+	size_t firstDependent_; // с этой инструкции начинается часть, зависящая от параметров
+	std::vector<bool> constant_; // инструкция зависит только от чисел формулы
+	std::vector<int> class_; // NodeClass каждой инструкции для текущего пакета
+	std::vector<double> scalars_; // значения инструкций CONSTANT и UNIFORM
+	std::vector<Reduction> reductions_; // суммы формул
+	std::map<std::string, size_t> extents_; // нужные длины массивов, с учётом вложенных сумм
+	std::vector<Dot const*> dots_; // скалярные произведения формул
+	std::map<std::string, std::span<double const> > bound_; // привязанные массивы для dot
+};
+
+// формула над комплексными числами для многих строк сразу. Регистр инструкции — tile
+// вещественных частей, за ними tile мнимых (структура массивов), поэтому + - * / и sqrt — циклы
+// по double без перестановок внутри векторов. Узлы без своего цикла (сравнения, выбор, min/max,
+// функции реестра кроме sqrt и abs, суммы и dot) считаются построчно через evaluateAs<Complex>
+struct ComplexBatchEvaluator {
+	explicit ComplexBatchEvaluator(Expression const* expr, size_t tile = 256) : tile_(tile) {
+		assert(expr && tile_ > 0);
+		TraceSpan span("compile complex");
+		result_ = compile(expr);
+		memo_.clear(); // нужна только при компиляции
+		regs_.resize(2 * tile_ * code_.size());
+	}
+
+	std::vector<std::string> const& inputs() const { return inputs_; } // имена переменных = пары входных столбцов
+	size_t instructions() const { return code_.size(); }
+
+	// значения массива для сумм и dot, которые считаются построчно (копия)
+	void bindArray(std::string const& name, std::span<double const> values) {
+		arrays_[name].assign(values.begin(), values.end());
+	}
+
+	// re[i], im[i] — n вещественных и мнимых частей переменной inputs()[i], im[i] == nullptr —
+	// вещественная переменная; результат — n пар в outRe, outIm
+	void evaluate(double const* const* re, double const* const* im, size_t n, double* outRe, double* outIm) {
+		TraceSpan span("evaluate complex");
+		for (size_t start = 0; start < n; start += tile_) {
+			size_t count = n - start < tile_ ? n - start : tile_;
+			run(re, im, start, count);
+			double const* r = part(result_, false);
+			double const* m = part(result_, true);
+			for (size_t k = 0; k < count; ++k) {
+				outRe[start + k] = r[k];
+				outIm[start + k] = m[k];
+			}
+		}
+	}
+
+private:
+	enum { LOAD, CONST, ADD, SUB, MUL, DIV, NEG, SQRT, ABS, ROW }; // ROW — узел, вычисляемый построчно
+
+	struct Instr {
+		int kind;
+		int a, b; // номера инструкций-операндов
+		int input; // номер входа для LOAD
+		double value; // число для CONST
+		Expression const* node; // поддерево для ROW
+	};
+
+	typedef std::tuple<int, int, int, int, std::uint64_t> InstrKey; // вид, операнды, вход, число
+
+	double* part(int i, bool imaginary) { return regs_.data() + (2 * static_cast<size_t>(i) + (imaginary ? 1 : 0)) * tile_; }
+
+	void run(double const* const* re, double const* const* im, size_t start, size_t n) {
+		for (size_t i = 0; i < code_.size(); ++i) {
+			Instr const& in = code_[i];
+			double* rr = part(static_cast<int>(i), false);
+			double* ri = part(static_cast<int>(i), true);
+			double const* ar = in.a >= 0 ? part(in.a, false) : nullptr;
+			double const* ai = in.a >= 0 ? part(in.a, true) : nullptr;
+			double const* br = in.b >= 0 ? part(in.b, false) : nullptr;
+			double const* bi = in.b >= 0 ? part(in.b, true) : nullptr;
+			switch (in.kind) {
+			case LOAD:
+				for (size_t k = 0; k < n; ++k) rr[k] = re[in.input][start + k];
+				for (size_t k = 0; k < n; ++k) ri[k] = im[in.input] ? im[in.input][start + k] : 0.0;
+				break;
+			case CONST:
+				for (size_t k = 0; k < n; ++k) { rr[k] = in.value; ri[k] = 0.0; }
+				break;
+			case ADD: for (size_t k = 0; k < n; ++k) { rr[k] = ar[k] + br[k]; ri[k] = ai[k] + bi[k]; } break;
+			case SUB: for (size_t k = 0; k < n; ++k) { rr[k] = ar[k] - br[k]; ri[k] = ai[k] - bi[k]; } break;
+			case MUL: for (size_t k = 0; k < n; ++k) Complex::multiply(ar[k], ai[k], br[k], bi[k], rr[k], ri[k]); break;
+			case DIV: for (size_t k = 0; k < n; ++k) Complex::divide(ar[k], ai[k], br[k], bi[k], rr[k], ri[k]); break;
+			case NEG: for (size_t k = 0; k < n; ++k) { rr[k] = -ar[k]; ri[k] = -ai[k]; } break;
+			case SQRT: for (size_t k = 0; k < n; ++k) Complex::root(ar[k], ai[k], rr[k], ri[k]); break;
+			case ABS: for (size_t k = 0; k < n; ++k) { rr[k] = FunctionCall::hypot(ar[k], ai[k]); ri[k] = 0.0; } break;
+			default: { // переменные строки — в map, как для evaluateAs
+				std::map<std::string, Complex> vars;
+				for (size_t k = 0; k < n; ++k) {
+					for (size_t v = 0; v < inputs_.size(); ++v)
+						vars[inputs_[v]] = Complex(re[v][start + k], im[v] ? im[v][start + k] : 0.0);
+					Complex value = evaluateAs<Complex>(in.node, vars, arrays_);
+					rr[k] = value.re;
+					ri[k] = value.im;
+				}
+			}
+			}
+		}
+	}
+
+	int compile(Expression const* expr) { // обход снизу вверх, возвращает номер инструкции
+		Instr in = { ROW, -1, -1, -1, 0.0, nullptr };
+		if (const Number* numb = dynamic_cast<const Number*>(expr)) {
+			in.kind = CONST;
+			in.value = numb->value();
+		}
+		else if (const BinaryOperation* binop = dynamic_cast<const BinaryOperation*>(expr)) {
+			in.a = compile(binop->left());
+			in.b = compile(binop->right());
+			in.kind = binop->operation() == BinaryOperation::PLUS ? ADD : binop->operation() == BinaryOperation::MINUS ? SUB
+				: binop->operation() == BinaryOperation::DIV ? DIV : MUL;
+		}
+		else if (const Negate* neg = dynamic_cast<const Negate*>(expr)) {
+			in.kind = NEG;
+			in.a = compile(neg->operand());
+		}
+		else if (const IntPower* power = dynamic_cast<const IntPower*>(expr)) { // цепочка умножений, как в IntPower::apply
+			std::vector<int> values(1, compile(power->base()));
+			IntPower::Chain const& steps = power->steps();
+			for (size_t k = 0; k < steps.size(); ++k) {
+				Instr step = { MUL, values[steps[k].first], values[steps[k].second], -1, 0.0, nullptr };
+				values.push_back(intern(step));
+			}
+			if (power->exponent() > 0)
+				return values.back();
+			Instr one = { CONST, -1, -1, -1, 1.0, nullptr };
+			if (power->exponent() == 0)
+				return intern(one);
+			in.kind = DIV;
+			in.a = intern(one);
+			in.b = values.back();
+		}
+		else if (const FunctionCall* funCall = dynamic_cast<const FunctionCall*>(expr)) {
+			if (funCall->id() == FunctionCall::SQRT || funCall->id() == FunctionCall::ABS) {
+				in.kind = funCall->id() == FunctionCall::SQRT ? SQRT : ABS;
+				in.a = compile(funCall->arg());
+			}
+			else
+				in.node = expr;
+		}
+		else if (const Variable* var = dynamic_cast<const Variable*>(expr)) {
+			in.kind = LOAD;
+			in.input = inputIndex(var->name());
+		}
+		else
+			in.node = expr;
+		if (in.kind == ROW) // построчному узлу нужны все переменные его поддерева
+			addInputs(expr, std::set<std::string>());
+		return intern(in);
+	}
+
+	void addInputs(Expression const* expr, std::set<std::string> const& indices) { // indices — индексы объемлющих сумм
+		if (const Variable* var = dynamic_cast<const Variable*>(expr)) {
+			if (!indices.count(var->name()))
+				inputIndex(var->name());
+		}
+		else if (const Sum* sum = dynamic_cast<const Sum*>(expr)) {
+			std::set<std::string> inner(indices);
+			inner.insert(sum->index());
+			addInputs(sum->body(), inner);
+		}
+		else {
+			std::vector<Expression const*> operands = operandsOf(expr);
+			for (size_t i = 0; i < operands.size(); ++i)
+				addInputs(operands[i], indices);
+		}
+	}
+
+	int intern(Instr const& in) { // одинаковые инструкции — одна; построчные узлы сравниваются по строению
+		if (in.kind == ROW) {
+			for (size_t i = 0; i < code_.size(); ++i)
+				if (code_[i].kind == ROW && sameTree(code_[i].node, in.node))
+					return static_cast<int>(i);
+		}
+		else {
+			std::uint64_t bits;
+			std::memcpy(&bits, &in.value, sizeof(bits));
+			InstrKey key(in.kind, in.a, in.b, in.input, bits);
+			std::map<InstrKey, int>::const_iterator found = memo_.find(key);
+			if (found != memo_.end())
+				return found->second;
+			memo_[key] = static_cast<int>(code_.size());
+		}
+		code_.push_back(in);
+		return static_cast<int>(code_.size()) - 1;
+	}
+
+	int inputIndex(std::string const& name) {
+		for (size_t i = 0; i < inputs_.size(); ++i)
+			if (inputs_[i] == name) return static_cast<int>(i);
+		inputs_.push_back(name);
+		return static_cast<int>(inputs_.size()) - 1;
+	}
+
+	size_t tile_;
+	std::vector<Instr> code_;
+	int result_;
+	std::vector<std::string> inputs_;
+	std::vector<double> regs_; // регистры: tile вещественных частей, tile мнимых
+	ArrayValues arrays_; // для построчных узлов
+	std::map<InstrKey, int> memo_; // одинаковые инструкции при компиляции
+};
+
+// Формула в целочисленной арифметике с фиксированной точкой для вычислителей без плавающей
+// точки. Значение узла — int32 x, означающее x * 2^-f; число дробных битов f у каждого узла своё
+// и выбирается по диапазону узла (интервальная арифметика от диапазонов переменных) так, чтобы
+// |x| < 2^30: один бит запаса на ошибки округления. + - * и смена знака насыщаются до
+// [INT32_MIN, INT32_MAX]; деление — умножение на обратное, найденное итерациями Ньютона без
+// команды деления; корень — поразрядный целочисленный, от отрицательного — 0. Плавающая точка
+// нужна только при компиляции и в toFixed/toDouble на границе с вызывающим.
+struct FixedPointEvaluator {
+	static int const MAX_FRACTION = 62; // у узлов с диапазоном около нуля
+
+	FixedPointEvaluator() : expr_(nullptr), result_(-1), tile_(1024) {}
+
+	// ranges — диапазоны всех переменных; false и описание в error, если формула не переводится
+	// в 32 бита (диапазон узла от 2^30, делитель может быть нулём, неподдерживаемый узел)
+	bool compile(Expression const* expr, std::map<std::string, Interval> const& ranges, std::string& error) {
+		assert(expr);
+		TraceSpan span("compile fixed");
+		code_.clear();
+		memo_.clear();
+		inputs_.clear();
+		formats_.clear();
+		ranges_ = &ranges;
+		error_.clear();
+		expr_ = expr;
+		result_ = compileNode(expr);
+		memo_.clear(); // нужна только при компиляции
+		ranges_ = nullptr;
+		if (result_ < 0) {
+			error = error_;
+			code_.clear();
+			return false;
+		}
+		regs_.resize(tile_ * code_.size());
+		return true;
+	}
+
+	std::vector<std::string> const& inputs() const { return inputs_; } // имена переменных = входные столбцы
+	int inputFraction(size_t i) const { return formats_[i]; } // дробных битов входа i
+	int outputFraction() const { return code_[result_].fraction; }
+	size_t instructions() const { return code_.size(); }
+
+	static std::int32_t toFixed(double value, int fraction) { // с округлением и насыщением
+		double scaled = std::nearbyint(std::ldexp(value, fraction));
+		return scaled >= 2147483647.0 ? INT32_MAX : scaled <= -2147483648.0 ? INT32_MIN
+			: scaled == scaled ? static_cast<std::int32_t>(scaled) : 0;
+	}
+	static double toDouble(std::int32_t value, int fraction) { return std::ldexp(static_cast<double>(value), -fraction); }
+
+	// columns[i] — n значений входа i в формате inputFraction(i), результат — в формате outputFraction()
+	void evaluate(std::int32_t const* const* columns, size_t n, std::int32_t* out) {
+		TraceSpan span("evaluate fixed");
+		assert(result_ >= 0);
+		for (size_t start = 0; start < n; start += tile_) {
+			size_t count = n - start < tile_ ? n - start : tile_;
+			run(columns, start, count);
+			std::int32_t const* r = reg(result_);
+			for (size_t k = 0; k < count; ++k)
+				out[start + k] = r[k];
+		}
+	}
+
+	struct Error { // отклонение от вычисления в double
+		double absolute; // наибольшая абсолютная ошибка
+		double relative; // наибольшая ошибка относительно max(|точное|, шаг результата)
+		size_t row; // строка с наибольшей абсолютной ошибкой
+	};
+
+	// columns[i] — n значений входа i в double: они переводятся в свои форматы, результат
+	// сравнивается с evaluateAs<double> над исходными значениями (ошибка перевода входов входит)
+	Error compare(double const* const* columns, size_t n) {
+		std::vector<std::vector<std::int32_t> > fixed(inputs_.size(), std::vector<std::int32_t>(n));
+		std::vector<std::int32_t const*> pointers(inputs_.size());
+		for (size_t i = 0; i < inputs_.size(); ++i) {
+			for (size_t k = 0; k < n; ++k)
+				fixed[i][k] = toFixed(columns[i][k], formats_[i]);
+			pointers[i] = fixed[i].data();
+		}
+		std::vector<std::int32_t> out(n);
+		evaluate(pointers.data(), n, out.data());
+		Error result = { 0.0, 0.0, 0 };
+		double step = std::ldexp(1.0, -outputFraction());
+		std::map<std::string, double> vars;
+		for (size_t k = 0; k < n; ++k) {
+			for (size_t i = 0; i < inputs_.size(); ++i)
+				vars[inputs_[i]] = columns[i][k];
+			double exact = evaluateAs<double>(expr_, vars);
+			double error = std::fabs(toDouble(out[k], outputFraction()) - exact);
+			if (error > result.absolute) {
+				result.absolute = error;
+				result.row = k;
+			}
+			double relative = error / (std::fabs(exact) > step ? std::fabs(exact) : step);
+			result.relative = relative > result.relative ? relative : result.relative;
+		}
+		return result;
+	}
+
+	void printReport(Error const& error) const { // форматы Qm.f (m — целых битов без знака) и ошибка
+		for (size_t i = 0; i < inputs_.size(); ++i)
+			std::cout << inputs_[i] << ": Q" << 31 - formats_[i] << "." << formats_[i] << std::endl;
+		std::cout << "результат: Q" << 31 - outputFraction() << "." << outputFraction() << ", инструкций " << code_.size() << std::endl;
+		std::cout << "ошибка: абсолютная " << error.absolute << ", относительная " << error.relative
+			<< " (строка " << error.row << ")" << std::endl;
+	}
+
+	// примитивы над значениями; пакетные ядра SSE2 дают те же биты
+	static std::int32_t saturate(std::int64_t x) {
+		return x > INT32_MAX ? INT32_MAX : x < INT32_MIN ? INT32_MIN : static_cast<std::int32_t>(x);
+	}
+	// x * 2^-s: при s > 0 с округлением половины вверх, при s < 0 — сдвиг влево с насыщением
+	static std::int64_t shift(std::int64_t x, int s) {
+		if (s > 0) {
+			s = s < 63 ? s : 63;
+			return (x >> s) + ((x >> (s - 1)) & 1);
+		}
+		if (s == 0 || x == 0)
+			return x;
+		s = -s < 63 ? -s : 63;
+		if (x > (INT64_MAX >> s) || x < (INT64_MIN >> s))
+			return x > 0 ? INT64_MAX : INT64_MIN;
+		return x * (std::int64_t(1) << s);
+	}
+	// a / b, base = 61 + fa - fb - f. |b| = m 2^-lz, m из [2^30, 2^31); y ~ 2^61 / m в Q30
+	// (то есть 1 / (m 2^-31)) — три шага Ньютона y(2 - xy) от y0 = 48/17 - 32/17 x, ошибка (1/17)^8
+	static std::int32_t divide(std::int32_t a, std::int32_t b, int base) {
+		if (b == 0)
+			return a > 0 ? INT32_MAX : a < 0 ? INT32_MIN : 0;
+		std::uint32_t magnitude = b < 0 ? 0u - static_cast<std::uint32_t>(b) : static_cast<std::uint32_t>(b);
+		int lz = std::countl_zero(magnitude) - 1;
+		std::int64_t m = lz >= 0 ? static_cast<std::int64_t>(magnitude) << lz : magnitude >> 1;
+		std::int64_t y = 3031741621LL - ((2021161081LL * m) >> 31);
+		for (int k = 0; k < 3; ++k)
+			y = (y * ((std::int64_t(1) << 32) - ((m * y) >> 30))) >> 31;
+		std::int64_t q = shift(static_cast<std::int64_t>(a) * y, base - lz);
+		return saturate(b < 0 ? -q : q);
+	}
+	static std::int32_t root(std::int32_t a, int k) { // sqrt(a 2^k), k <= 32, поразрядно с округлением
+		if (a <= 0)
+			return 0;
+		std::uint64_t x = k >= 0 ? static_cast<std::uint64_t>(a) << k : static_cast<std::uint64_t>(shift(a, -k));
+		std::uint64_t result = 0, bit = std::uint64_t(1) << 62;
+		while (bit > x)
+			bit >>= 2;
+		while (bit) {
+			if (x >= result + bit) {
+				x -= result + bit;
+				result = (result >> 1) + bit;
+			}
+			else
+				result >>= 1;
+			bit >>= 2;
+		}
+		return saturate(static_cast<std::int64_t>(x > result ? result + 1 : result));
+	}
+
+private:
+	enum { LOAD, CONST, ADD, SUB, MUL, DIV, NEG, ABS, SQRT, MIN, MAX, CMP, SELECT }; // виды инструкций
+
+	struct Instr {
+		int kind;
+		int op; // вид сравнения для CMP
+		int a, b, c; // номера инструкций-операндов, c — условие SELECT
+		int input; // номер входа для LOAD
+		std::int32_t value; // CONST; у CMP — единица в формате узла
+		int shiftA, shiftB; // сдвиги операндов к формату узла; у MUL, DIV, SQRT — см. apply
+		int fraction; // дробных битов результата
+		Interval range; // диапазон значений узла
+	};
+
+	typedef std::tuple<int, int, int, int, int, int, std::int32_t, int> InstrKey; // вид, операция, операнды, вход, число, формат
+
+	static std::int32_t align(std::int32_t x, int s) { return static_cast<std::int32_t>(shift(x, s)); } // s >= 0
+
+	static std::int32_t apply(Instr const& in, std::int32_t a, std::int32_t b, std::int32_t c) { // одна строка
+		switch (in.kind) {
+		case ADD: return saturate(static_cast<std::int64_t>(align(a, in.shiftA)) + align(b, in.shiftB));
+		case SUB: return saturate(static_cast<std::int64_t>(align(a, in.shiftA)) - align(b, in.shiftB));
+		case MUL: return saturate(shift(static_cast<std::int64_t>(a) * b, in.shiftA)); // shiftA = fa + fb - f
+		case DIV: return divide(a, b, in.shiftA);
+		case NEG: return a == INT32_MIN ? INT32_MAX : -a;
+		case ABS: return a == INT32_MIN ? INT32_MAX : a < 0 ? -a : a;
+		case SQRT: return root(a, in.shiftA); // shiftA = 2f - fa
+		case MIN: a = align(a, in.shiftA); b = align(b, in.shiftB); return a < b ? a : b;
+		case MAX: a = align(a, in.shiftA); b = align(b, in.shiftB); return a > b ? a : b;
+		case CMP: return Comparison::holds(in.op, align(a, in.shiftA), align(b, in.shiftB)) ? in.value : 0;
+		default: return c != 0 ? align(a, in.shiftA) : align(b, in.shiftB);
+		}
+	}
+
+	std::int32_t* reg(int i) { return regs_.data() + static_cast<size_t>(i) * tile_; }
+
+	void run(std::int32_t const* const* columns, size_t start, size_t n) {
+		for (size_t i = 0; i < code_.size(); ++i) {
+			Instr const& in = code_[i];
+			std::int32_t* r = reg(static_cast<int>(i));
+			if (in.kind == LOAD) {
+				for (size_t k = 0; k < n; ++k) r[k] = columns[in.input][start + k];
+				continue;
+			}
+			if (in.kind == CONST) {
+				for (size_t k = 0; k < n; ++k) r[k] = in.value;
+				continue;
+			}
+			std::int32_t const* a = reg(in.a);
+			std::int32_t const* b = in.b >= 0 ? reg(in.b) : a;
+			std::int32_t const* c = in.c >= 0 ? reg(in.c) : a;
+			size_t k = 0;
+#ifdef LR6_SSE2
+			k = runVector(in, r, a, b, c, n);
+#endif
+			for (; k < n; ++k)
+				r[k] = apply(in, a[k], b[k], c[k]);
+		}
+	}
+
+#ifdef LR6_SSE2
+	// x 2^-s с округлением, как align: сдвиг больше 31 заполняет знаком, как и в int64
+	static __m128i align4(__m128i x, int s) {
+		if (s == 0)
+			return x;
+		__m128i shifted = _mm_sra_epi32(x, _mm_cvtsi32_si128(s));
+		__m128i half = _mm_sra_epi32(x, _mm_cvtsi32_si128(s - 1));
+		return _mm_add_epi32(shifted, _mm_and_si128(half, _mm_set1_epi32(1)));
+	}
+	static __m128i blend4(__m128i mask, __m128i a, __m128i b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+
+	// по 4 строки для инструкций без умножения; возвращает, сколько строк посчитано. Умножение,
+	// деление и корень остаются скалярными: в SSE2 нет знакового 32x32 -> 64 и сравнения int64
+	static size_t runVector(Instr const& in, std::int32_t* r, std::int32_t const* a, std::int32_t const* b,
+		std::int32_t const* c, size_t n) {
+		if (in.kind == MUL || in.kind == DIV || in.kind == SQRT)
+			return 0;
+		__m128i const maximum = _mm_set1_epi32(INT32_MAX), minimum = _mm_set1_epi32(INT32_MIN);
+		size_t k = 0;
+		for (; k + 4 <= n; k += 4) {
+			__m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a + k));
+			__m128i y = _mm_loadu_si128(reinterpret_cast<__m128i const*>(b + k));
+			__m128i result;
+			switch (in.kind) {
+			case ADD: case SUB: { // переполнение — у операндов и результата разные знаки; насыщение — по знаку x
+				x = align4(x, in.shiftA);
+				y = align4(y, in.shiftB);
+				__m128i sum = in.kind == ADD ? _mm_add_epi32(x, y) : _mm_sub_epi32(x, y);
+				__m128i overflow = in.kind == ADD ? _mm_and_si128(_mm_xor_si128(x, sum), _mm_xor_si128(y, sum))
+					: _mm_and_si128(_mm_xor_si128(x, y), _mm_xor_si128(x, sum));
+				__m128i saturated = _mm_xor_si128(_mm_srai_epi32(x, 31), maximum);
+				result = blend4(_mm_srai_epi32(overflow, 31), saturated, sum);
+				break;
+			}
+			case NEG: // -INT32_MIN переполняется в INT32_MIN, минус единица даёт INT32_MAX
+				result = _mm_sub_epi32(_mm_setzero_si128(), x);
+				result = _mm_add_epi32(result, _mm_cmpeq_epi32(x, minimum));
+				break;
+			case ABS: {
+				__m128i sign = _mm_srai_epi32(x, 31);
+				result = _mm_sub_epi32(_mm_xor_si128(x, sign), sign);
+				result = _mm_add_epi32(result, _mm_cmpeq_epi32(x, minimum));
+				break;
+			}
+			case MIN: case MAX: {
+				x = align4(x, in.shiftA);
+				y = align4(y, in.shiftB);
+				__m128i greater = _mm_cmpgt_epi32(x, y);
+				result = in.kind == MAX ? blend4(greater, x, y) : blend4(greater, y, x);
+				break;
+			}
+			case CMP: {
+				x = align4(x, in.shiftA);
+				y = align4(y, in.shiftB);
+				__m128i holds;
+				switch (in.op) {
+				case Comparison::LESS: holds = _mm_cmpgt_epi32(y, x); break;
+				case Comparison::LESS_EQUAL: holds = _mm_xor_si128(_mm_cmpgt_epi32(x, y), _mm_set1_epi32(-1)); break;
+				case Comparison::GREATER: holds = _mm_cmpgt_epi32(x, y); break;
+				case Comparison::GREATER_EQUAL: holds = _mm_xor_si128(_mm_cmpgt_epi32(y, x), _mm_set1_epi32(-1)); break;
+				case Comparison::EQUAL: holds = _mm_cmpeq_epi32(x, y); break;
+				default: holds = _mm_xor_si128(_mm_cmpeq_epi32(x, y), _mm_set1_epi32(-1)); break;
+				}
+				result = _mm_and_si128(holds, _mm_set1_epi32(in.value));
+				break;
+			}
+			default: { // SELECT
+				__m128i condition = _mm_loadu_si128(reinterpret_cast<__m128i const*>(c + k));
+				__m128i zero = _mm_cmpeq_epi32(condition, _mm_setzero_si128());
+				result = blend4(zero, align4(y, in.shiftB), align4(x, in.shiftA));
+				break;
+			}
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(r + k), result);
+		}
+		return k;
+	}
+#endif
+
+	// дробных битов для диапазона: |x| < 2^30; -1 — диапазон не помещается
+	static int fraction(Interval const& range) {
+		double m = std::fmax(std::fabs(range.lo), std::fabs(range.hi));
+		if (!(m < 1073741824.0)) // и NaN
+			return -1;
+		if (m == 0.0)
+			return MAX_FRACTION;
+		int e;
+		std::frexp(m, &e); // m < 2^e
+		int f = 30 - e;
+		return f < MAX_FRACTION ? f : MAX_FRACTION;
+	}
+
+	static std::string text(double value) { // кратчайшая точная запись
+		char buffer[32];
+		std::to_chars_result res = std::to_chars(buffer, buffer + sizeof(buffer), value);
+		return std::string(buffer, res.ptr);
+	}
+
+	int fail(std::string const& message) {
+		if (error_.empty())
+			error_ = message;
+		return -1;
+	}
+
+	// инструкция с диапазоном range: формат узла — не больше min(limit, формат по диапазону)
+	int emit(Instr in, Interval const& range, int limit = MAX_FRACTION) {
+		int f = fraction(range);
+		if (f < 0)
+			return fail("значения узла в [" + text(range.lo) + ", " + text(range.hi) + "] не помещаются в 32-битную фиксированную точку");
+		in.fraction = f < limit ? f : limit;
+		in.range = range;
+		int fa = in.a >= 0 ? code_[in.a].fraction : 0, fb = in.b >= 0 ? code_[in.b].fraction : 0;
+		switch (in.kind) {
+		case CONST: in.value = toFixed(range.lo, in.fraction); break;
+		case MUL: in.shiftA = fa + fb - in.fraction; break;
+		case DIV: in.shiftA = 61 + fa - fb - in.fraction; break;
+		case SQRT: in.shiftA = 2 * in.fraction - fa; break;
+		case NEG: case ABS: case LOAD: break;
+		default: // операнды сдвигаются вправо к общему формату
+			in.shiftA = fa - in.fraction;
+			in.shiftB = fb - in.fraction;
+			if (in.kind == CMP)
+				in.value = toFixed(1.0, in.fraction);
+		}
+		std::uint32_t bits = static_cast<std::uint32_t>(in.value);
+		InstrKey key(in.kind, in.op, in.a, in.b, in.c, in.input, static_cast<std::int32_t>(bits), in.fraction);
+		std::map<InstrKey, int>::const_iterator found = memo_.find(key);
+		if (found != memo_.end())
+			return found->second;
+		code_.push_back(in);
+		memo_[key] = static_cast<int>(code_.size()) - 1;
+		return static_cast<int>(code_.size()) - 1;
+	}
+
+	int binary(int kind, int a, int b) { // + - * / над готовыми инструкциями
+		if (a < 0 || b < 0)
+			return -1;
+		Instr in = instr(kind, a, b);
+		Interval const& x = code_[a].range;
+		Interval const& y = code_[b].range;
+		switch (kind) {
+		case ADD: return emit(in, x + y, std::min(code_[a].fraction, code_[b].fraction));
+		case SUB: return emit(in, x - y, std::min(code_[a].fraction, code_[b].fraction));
+		case MUL: return emit(in, a == b ? abs(x) * abs(x) : x * y); // квадрат неотрицателен
+		default:
+			if (y.lo <= 0.0 && y.hi >= 0.0)
+				return fail("делитель может быть равен нулю — частное не ограничено");
+			return emit(in, x / y);
+		}
+	}
+
+	int unary(int kind, int a) {
+		if (a < 0)
+			return -1;
+		Interval const& x = code_[a].range;
+		switch (kind) {
+		case NEG: return emit(instr(NEG, a), -x, code_[a].fraction);
+		case ABS: return emit(instr(ABS, a), abs(x), code_[a].fraction);
+		default: { // корень: 2f - fa <= 32, чтобы a 2^(2f - fa) помещалось в 64 бита
+			Interval r = sqrt(x);
+			if (r.lo != r.lo)
+				return fail("корень из отрицательного диапазона");
+			return emit(instr(SQRT, a), r, (code_[a].fraction + 32) / 2);
+		}
+		}
+	}
+
+	static Instr instr(int kind, int a = -1, int b = -1, int c = -1) {
+		Instr in = { kind, 0, a, b, c, -1, 0, 0, 0, 0, Interval() };
+		return in;
+	}
+
+	int number(double value) { return emit(instr(CONST), Interval(value)); }
+
+	int compileNode(Expression const* expr) { // обход снизу вверх, -1 — ошибка в error_
+		if (const Number* numb = dynamic_cast<const Number*>(expr))
+			return number(numb->value());
+		if (const BinaryOperation* binop = dynamic_cast<const BinaryOperation*>(expr)) {
+			int a = compileNode(binop->left());
+			int b = a < 0 ? -1 : compileNode(binop->right());
+			switch (binop->operation()) {
+			case BinaryOperation::PLUS: return binary(ADD, a, b);
+			case BinaryOperation::MINUS: return binary(SUB, a, b);
+			case BinaryOperation::DIV: return binary(DIV, a, b);
+			default: return binary(MUL, a, b);
+			}
+		}
+		if (const Negate* neg = dynamic_cast<const Negate*>(expr))
+			return unary(NEG, compileNode(neg->operand()));
+		if (const IntPower* power = dynamic_cast<const IntPower*>(expr)) { // цепочка умножений, как в IntPower::apply
+			std::vector<int> values(1, compileNode(power->base()));
+			IntPower::Chain const& steps = power->steps();
+			for (size_t k = 0; k < steps.size() && values.back() >= 0; ++k)
+				values.push_back(binary(MUL, values[steps[k].first], values[steps[k].second]));
+			if (power->exponent() == 0)
+				return values.back() < 0 ? -1 : number(1.0);
+			return power->exponent() > 0 ? values.back() : binary(DIV, number(1.0), values.back());
+		}
+		if (const FunctionCall* funCall = dynamic_cast<const FunctionCall*>(expr)) {
+			std::vector<int> args;
+			for (size_t i = 0; i < funCall->arity(); ++i) {
+				args.push_back(compileNode(funCall->arg(i)));
+				if (args.back() < 0)
+					return -1;
+			}
+			switch (funCall->id()) {
+			case FunctionCall::SQRT: return unary(SQRT, args[0]);
+			case FunctionCall::ABS: return unary(ABS, args[0]);
+			case FunctionCall::HYPOT: return unary(SQRT, binary(ADD, binary(MUL, args[0], args[0]), binary(MUL, args[1], args[1])));
+			case FunctionCall::FMA: return binary(ADD, binary(MUL, args[0], args[1]), args[2]);
+			default: return fail("функция " + funCall->name() + " не поддерживается в фиксированной точке");
+			}
+		}
+		if (const MinMax* mm = dynamic_cast<const MinMax*>(expr)) {
+			int a = compileNode(mm->left());
+			int b = a < 0 ? -1 : compileNode(mm->right());
+			if (b < 0)
+				return -1;
+			return emit(instr(mm->kind() == MinMax::MIN ? MIN : MAX, a, b), minMaxValue(mm->kind(), code_[a].range, code_[b].range),
+				std::min(code_[a].fraction, code_[b].fraction));
+		}
+		if (const Comparison* cmp = dynamic_cast<const Comparison*>(expr)) {
+			int a = compileNode(cmp->left());
+			int b = a < 0 ? -1 : compileNode(cmp->right());
+			if (b < 0)
+				return -1;
+			Instr in = instr(CMP, a, b);
+			in.op = cmp->operation();
+			int common = std::min(code_[a].fraction, code_[b].fraction); // сравниваются в общем формате,
+			in.shiftA = code_[a].fraction - common; // а результат 0 или 1 — в своём
+			in.shiftB = code_[b].fraction - common;
+			int f = fraction(Interval(0.0, 1.0));
+			in.fraction = f;
+			in.value = toFixed(1.0, f);
+			in.range = compareValues(in.op, code_[a].range, code_[b].range);
+			code_.push_back(in);
+			return static_cast<int>(code_.size()) - 1;
+		}
+		if (const Select* sel = dynamic_cast<const Select*>(expr)) {
+			int c = compileNode(sel->condition());
+			int a = c < 0 ? -1 : compileNode(sel->then());
+			int b = a < 0 ? -1 : compileNode(sel->otherwise());
+			if (b < 0)
+				return -1;
+			return emit(instr(SELECT, a, b, c), selectValue(code_[c].range, code_[a].range, code_[b].range),
+				std::min(code_[a].fraction, code_[b].fraction));
+		}
+		if (const Variable* var = dynamic_cast<const Variable*>(expr)) {
+			std::map<std::string, Interval>::const_iterator range = ranges_->find(var->name());
+			if (range == ranges_->end())
+				return fail("не задан диапазон переменной " + var->name());
+			Instr in = instr(LOAD);
+			for (in.input = 0; in.input < static_cast<int>(inputs_.size()) && inputs_[in.input] != var->name(); ++in.input) {}
+			bool added = in.input == static_cast<int>(inputs_.size());
+			int index = emit(in, range->second);
+			if (index >= 0 && added) {
+				inputs_.push_back(var->name());
+				formats_.push_back(code_[index].fraction);
+			}
+			return index;
+		}
+		return fail("суммы, массивы и dot не поддерживаются в фиксированной точке");
+	}
+
+	Expression const* expr_; // формула для compare
+	std::vector<Instr> code_;
+	int result_;
+	size_t tile_;
+	std::vector<std::string> inputs_;
+	std::vector<int> formats_; // дробных битов входов
+	std::vector<std::int32_t> regs_; // tile значений на инструкцию
+	std::map<InstrKey, int> memo_; // одинаковые инструкции при компиляции
+	std::map<std::string, Interval> const* ranges_; // диапазоны переменных при компиляции
+	std::string error_; // первая ошибка компиляции
+};
+
+// структура формулы, где каждое число заменено на '#'; сами числа дописываются в params
+// в порядке обхода слева направо — том же, в котором BatchEvaluator нумерует параметры
+void shapeKey(Expression const* expr, std::string& key, std::vector<double>& params) {
+	if (const Number* numb = dynamic_cast<const Number*>(expr)) {
+		key += '#';
+		params.push_back(numb->value());
+	}
+	else if (const BinaryOperation* binop = dynamic_cast<const BinaryOperation*>(expr)) {
+		key += '(';
+		shapeKey(binop->left(), key, params);
+		key += static_cast<char>(binop->operation());
+		shapeKey(binop->right(), key, params);
+		key += ')';
+	}
+	else if (const FunctionCall* fcall = dynamic_cast<const FunctionCall*>(expr)) {
+		key += fcall->name() + "(";
+		for (size_t i = 0; i < fcall->arity(); ++i) {
+			if (i)
+				key += ',';
+			shapeKey(fcall->arg(i), key, params);
+		}
+		key += ')';
+	}
+	else if (const Comparison* cmp = dynamic_cast<const Comparison*>(expr)) {
+		key += '(';
+		shapeKey(cmp->left(), key, params);
+		key += Comparison::symbol(cmp->operation());
+		shapeKey(cmp->right(), key, params);
+		key += ')';
+	}
+	else if (const Select* sel = dynamic_cast<const Select*>(expr)) {
+		key += "select(";
+		shapeKey(sel->condition(), key, params);
+		key += ',';
+		shapeKey(sel->then(), key, params);
+		key += ',';
+		shapeKey(sel->otherwise(), key, params);
+		key += ')';
+	}
+	else if (const MinMax* mm = dynamic_cast<const MinMax*>(expr)) {
+		key += std::string(mm->name()) + "(";
+		shapeKey(mm->left(), key, params);
+		key += ',';
+		shapeKey(mm->right(), key, params);
+		key += ')';
+	}
+	else if (const Negate* neg = dynamic_cast<const Negate*>(expr)) {
+		key += "-(";
+		shapeKey(neg->operand(), key, params);
+		key += ')';
+	}
+	else if (const IntPower* power = dynamic_cast<const IntPower*>(expr)) { // показатель — часть формы, не параметр
+		key += '(';
+		shapeKey(power->base(), key, params);
+		key += ")^" + std::to_string(power->exponent());
+	}
+	else if (const Sum* sum = dynamic_cast<const Sum*>(expr)) { // тело компилируется без параметров, его числа — часть формы
+		std::string body;
+		std::vector<double> numbers;
+		shapeKey(sum->body(), body, numbers);
+		key += std::string(Sum::name(sum->mode())) + "(" + sum->index() + "," + std::to_string(sum->from()) + ","
+			+ std::to_string(sum->to()) + "," + body + "{";
+		for (size_t k = 0; k < numbers.size(); ++k) {
+			char text[32];
+			std::to_chars_result res = std::to_chars(text, text + sizeof(text), numbers[k], std::chars_format::hex);
+			key.append(text, res.ptr);
+			key += ';';
+		}
+		key += "})";
+	}
+	else if (const IndexedVariable* element = dynamic_cast<const IndexedVariable*>(expr)) {
+		key += '$' + element->element() + ' ';
+	}
+	else if (const Dot* dot = dynamic_cast<const Dot*>(expr)) {
+		key += "dot(" + dot->left().text() + "," + dot->right().text() + ")";
+	}
+	else {
+		const Variable* var = dynamic_cast<const Variable*>(expr);
+		assert(var);
+		key += '$' + var->name() + ' ';
+	}
+}
+
+struct KernelCache { // формулы одной формы, различающиеся только числами, делят одно ядро
+	KernelCache(size_t block = 4096) : block_(block) {}
+
+	// ядро для формы expr; params получает числа expr — вектор параметров для setParameters
+	BatchEvaluator& kernel(Expression const* expr, std::vector<double>& params) {
+		std::string key;
+		params.clear();
+		{
+			TraceSpan span("canonicalize");
+			shapeKey(expr, key, params);
+		}
+		Kernel& kernel = kernels_[key];
+		if (!kernel.evaluator) { // ядро ссылается на узлы сумм и dot своего дерева: дерево — копия,
+			CopySyntaxTree copy; // вызывающий может удалить expr сразу после вызова
+			kernel.tree.reset(runPass("CopySyntaxTree", expr, &copy));
+			kernel.evaluator.reset(new BatchEvaluator(kernel.tree.get(), block_, 0, true));
+		}
+		assert(kernel.evaluator->parameters() == params.size());
+		return *kernel.evaluator;
+	}
+
+	size_t size() const { return kernels_.size(); } // число различных форм
+
+private:
+	struct Kernel {
+		std::unique_ptr<Expression const> tree; // формула, по которой скомпилировано ядро
+		std::unique_ptr<BatchEvaluator> evaluator;
+	};
+
+	size_t block_;
+	std::map<std::string, Kernel> kernels_; // форма -> ядро
+};
+
+struct MappedFile { // файл, отображаемый в память окнами
+	MappedFile() {}
+	MappedFile(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile const&) = delete;
+	~MappedFile() {
+		unmap();
+#ifdef _WIN32
+		if (mapping_) CloseHandle(mapping_);
+		if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+		if (fd_ >= 0) ::close(fd_);
+#endif
+	}
+
+	bool open(std::string const& path, bool writable = false) { // существующий файл; writable — для записи на месте
+		writable_ = writable;
+#ifdef _WIN32
+		file_ = writable
+			? CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr)
+			: CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file_ == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file_, &size))
+			return false;
+		size_ = static_cast<std::uint64_t>(size.QuadPart);
+		if (size_ == 0) // пустой файл отобразить нельзя, но и читать в нём нечего
+			return true;
+		mapping_ = CreateFileMappingA(file_, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+		return mapping_ != nullptr;
+#else
+		fd_ = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+		if (fd_ < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd_, &st) != 0)
+			return false;
+		size_ = static_cast<std::uint64_t>(st.st_size);
+		return true;
+#endif
+	}
+
+	bool create(std::string const& path, std::uint64_t size) { // новый файл заданного размера для записи
+		assert(size > 0);
+		writable_ = true;
+		size_ = size;
+#ifdef _WIN32
+		file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file_ == INVALID_HANDLE_VALUE)
+			return false;
+		mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+		return mapping_ != nullptr; // отображение само увеличивает файл до size
+#else
+		fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		return fd_ >= 0 && ftruncate(fd_, static_cast<off_t>(size)) == 0;
+#endif
+	}
+
+	std::uint64_t size() const { return size_; }
+
+	// отображает [offset, offset + length), предыдущее окно освобождается, поэтому
+	// в памяти одновременно находится не больше одного окна независимо от размера файла
+	char const* map(std::uint64_t offset, size_t length) {
+		return static_cast<char const*>(mapRange(offset, length));
+	}
+
+	char* mapForWrite(std::uint64_t offset, size_t length) { // только для файлов из create или open(path, true)
+		assert(writable_);
+		return static_cast<char*>(mapRange(offset, length));
+	}
+
+private:
+	void* mapRange(std::uint64_t offset, size_t length) {
+		assert(offset + length <= size_);
+		unmap();
+		std::uint64_t aligned = offset - offset % granularity();
+		size_t delta = static_cast<size_t>(offset - aligned);
+#ifdef _WIN32
+		view_ = MapViewOfFile(mapping_, writable_ ? FILE_MAP_WRITE : FILE_MAP_READ, static_cast<DWORD>(aligned >> 32), static_cast<DWORD>(aligned), length + delta);
+		if (!view_)
+			return nullptr;
+#else
+		view_ = mmap(nullptr, length + delta, writable_ ? PROT_READ | PROT_WRITE : PROT_READ, writable_ ? MAP_SHARED : MAP_PRIVATE, fd_, static_cast<off_t>(aligned));
+		if (view_ == MAP_FAILED) {
+			view_ = nullptr;
+			return nullptr;
+		}
+		madvise(view_, length + delta, MADV_SEQUENTIAL); // файл обходится строго по порядку
+#endif
+		viewLength_ = length + delta;
+		return static_cast<char*>(view_) + delta;
+	}
+
+	void unmap() {
+		if (!view_)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(view_);
+#else
+		munmap(view_, viewLength_);
+#endif
+		view_ = nullptr;
+	}
+
+	static std::uint64_t granularity() { // смещение окна должно быть кратно этой величине
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwAllocationGranularity;
+#else
+		return static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+#ifdef _WIN32
+	HANDLE file_ = INVALID_HANDLE_VALUE;
+	HANDLE mapping_ = nullptr;
+#else
+	int fd_ = -1;
+#endif
+	bool writable_ = false; // файл создан для записи
+	std::uint64_t size_ = 0; // размер файла в байтах
+	void* view_ = nullptr; // текущее окно
+	size_t viewLength_ = 0;
+};
+
+struct OutputBuffer { // запись чисел в файл крупными порциями, форматирование через std::to_chars
+	OutputBuffer(std::FILE* file, size_t capacity = 1 << 20) : file_(file), buf_(capacity), used_(0), ok_(true) {}
+	~OutputBuffer() { flush(); }
+
+	void put(double value) {
+		if (buf_.size() - used_ < 32) // кратчайшая точная запись double короче 32 символов
+			flush();
+		std::to_chars_result res = std::to_chars(buf_.data() + used_, buf_.data() + buf_.size(), value);
+		used_ = res.ptr - buf_.data();
+	}
+
+	void put(char c) {
+		if (used_ == buf_.size())
+			flush();
+		buf_[used_++] = c;
+	}
+
+	void put(std::string const& text) {
+		for (size_t i = 0; i < text.size(); ++i)
+			put(text[i]);
+	}
+
+	bool flush() { // false, если хотя бы одна запись не удалась
+		if (used_ && std::fwrite(buf_.data(), 1, used_, file_) != used_)
+			ok_ = false;
+		used_ = 0;
+		return ok_;
+	}
+
+private:
+	std::FILE* file_;
+	std::vector<char> buf_;
+	size_t used_; // занято байт в буфере
+	bool ok_;
+};
+
+inline int lowestBit(std::uint64_t mask) { // номер младшего единичного бита, mask != 0
+#ifdef _MSC_VER
+	unsigned long index;
+	if (_BitScanForward(&index, static_cast<unsigned long>(mask)))
+		return static_cast<int>(index);
+	_BitScanForward(&index, static_cast<unsigned long>(mask >> 32));
+	return static_cast<int>(index) + 32;
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+// битовая маска позиций ',' и '\n' среди первых length <= 64 байт
+inline std::uint64_t delimiterMask(char const* p, size_t length) {
+	std::uint64_t mask = 0;
+#ifdef LR6_SSE2
+	if (length == 64) { // полный кусок: 4 сравнения по 16 байт вместо 64 побайтовых
+		__m128i const comma = _mm_set1_epi8(',');
+		__m128i const newline = _mm_set1_epi8('\n');
+		for (int i = 0; i < 4; ++i) {
+			__m128i chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + 16 * i));
+			__m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, comma), _mm_cmpeq_epi8(chunk, newline));
+			mask |= static_cast<std::uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(hits))) << (16 * i);
+		}
+		return mask;
+	}
+#endif
+	for (size_t i = 0; i < length; ++i)
+		if (p[i] == ',' || p[i] == '\n')
+			mask |= std::uint64_t(1) << i;
+	return mask;
+}
+
+inline std::vector<std::string> outputNames(size_t count) { // result или result1..resultN
+	std::vector<std::string> names;
+	for (size_t j = 0; j < count; ++j)
+		names.push_back(count == 1 ? std::string("result") : "result" + std::to_string(j + 1));
+	return names;
+}
+
+struct CsvEvaluator { // потоковое вычисление формул над CSV-файлом с заголовком, по столбцу на формулу
+	CsvEvaluator(std::vector<Expression const*> const& exprs, size_t block = 4096, size_t window = size_t(1) << 26,
+		std::vector<Precision> const& precision = std::vector<Precision>(), MixedPrecisionPlan const* plan = nullptr)
+		: evaluator_(exprs, block, 0, false, precision, plan), window_(window), columns_(evaluator_.inputs().size() * block),
+		  pointers_(evaluator_.inputs().size()), results_(evaluator_.outputs() * block), outPointers_(evaluator_.outputs()),
+		  out_(nullptr), column_(0), rows_(0), line_(1) {
+		for (size_t i = 0; i < pointers_.size(); ++i)
+			pointers_[i] = &columns_[i * block];
+		for (size_t j = 0; j < outPointers_.size(); ++j)
+			outPointers_[j] = &results_[j * block];
+	}
+
+	BatchEvaluator& evaluator() { return evaluator_; } // для привязки массивов сумм до run
+
+	// память ограничена окном отображения и буферами одного блока, от размера файла не зависит
+	bool run(std::string const& inPath, std::string const& outPath, std::string& error) {
+		MappedFile in;
+		if (!in.open(inPath)) {
+			error = "не удалось открыть " + inPath;
+			return false;
+		}
+		std::FILE* file = std::fopen(outPath.c_str(), "wb");
+		if (!file) {
+			error = "не удалось создать " + outPath;
+			return false;
+		}
+		bool ok = process(in, file, error);
+		if (std::fclose(file) != 0 && ok) {
+			error = "ошибка записи в " + outPath;
+			ok = false;
+		}
+		if (!ok) // оборванный результат с одним заголовком не должен выглядеть готовым
+			std::remove(outPath.c_str());
+		return ok;
+	}
+
+private:
+	bool process(MappedFile& in, std::FILE* file, std::string& error) {
+		OutputBuffer out(file);
+		out_ = &out;
+		std::vector<std::string> names = outputNames(evaluator_.outputs());
+		for (size_t j = 0; j < names.size(); ++j) {
+			out.put(names[j]);
+			out.put(j + 1 < names.size() ? ',' : '\n');
+		}
+		bool header = true;
+		std::uint64_t pos = 0;
+		while (pos < in.size()) {
+			size_t length = static_cast<size_t>(in.size() - pos < window_ ? in.size() - pos : window_);
+			char const* begin = in.map(pos, length);
+			if (!begin) {
+				error = "не удалось отобразить файл в память";
+				return false;
+			}
+			char const* end = begin + length;
+			if (pos + length < in.size()) { // окно кончается посреди файла: берём только целые строки
+				while (end > begin && end[-1] != '\n')
+					--end;
+				if (end == begin) {
+					error = "строка " + std::to_string(line_) + " длиннее окна чтения";
+					return false;
+				}
+			}
+			char const* p = begin;
+			if (header) {
+				char const* newline = static_cast<char const*>(std::memchr(p, '\n', end - p));
+				char const* headerEnd = newline ? newline : end;
+				if (!bindHeader(p, headerEnd, error))
+					return false;
+				p = newline ? newline + 1 : end;
+				header = false;
+				++line_;
+			}
+			if (!scanRows(p, end, error))
+				return false;
+			pos += end - begin;
+		}
+		if (header) {
+			error = "во входном файле нет заголовка";
+			return false;
+		}
+		if (rows_)
+			flushBlock(out);
+		if (!out.flush()) {
+			error = "ошибка записи результата";
+			return false;
+		}
+		return true;
+	}
+
+	bool bindHeader(char const* begin, char const* end, std::string& error) { // имена столбцов -> переменные
+		std::vector<std::string> const& inputs = evaluator_.inputs();
+		std::vector<bool> found(inputs.size(), false);
+		while (true) {
+			char const* comma = static_cast<char const*>(std::memchr(begin, ',', end - begin));
+			char const* fieldEnd = comma ? comma : end;
+			std::string name = trim(begin, fieldEnd);
+			int input = -1;
+			for (size_t i = 0; i < inputs.size(); ++i)
+				if (inputs[i] == name && !found[i]) {
+					input = static_cast<int>(i);
+					found[i] = true;
+				}
+			binding_.push_back(input);
+			if (!comma)
+				break;
+			begin = comma + 1;
+		}
+		for (size_t i = 0; i < inputs.size(); ++i)
+			if (!found[i]) {
+				error = "в заголовке нет столбца для переменной " + inputs[i];
+				return false;
+			}
+		while (!binding_.empty() && binding_.back() < 0) // хвостовые столбцы можно не разбирать
+			binding_.pop_back();
+		return true;
+	}
+
+	bool scanRows(char const* p, char const* end, std::string& error) { // разбор целых строк
+		char const* fieldStart = p;
+		for (char const* chunk = p; chunk < end; chunk += 64) {
+			size_t length = end - chunk < 64 ? static_cast<size_t>(end - chunk) : 64;
+			std::uint64_t mask = delimiterMask(chunk, length);
+			while (mask) {
+				char const* delim = chunk + lowestBit(mask);
+				mask &= mask - 1;
+				if (*delim == '\n' && column_ == 0 && trim(fieldStart, delim).empty()) { // пустая строка
+					fieldStart = delim + 1;
+					++line_;
+					continue;
+				}
+				if (!field(fieldStart, delim, error))
+					return false;
+				fieldStart = delim + 1;
+				if (*delim == '\n' && !endRow(error))
+					return false;
+			}
+		}
+		if (fieldStart < end && !trim(fieldStart, end).empty()) { // последняя строка без '\n'
+			if (!field(fieldStart, end, error) || !endRow(error))
+				return false;
+		}
+		return true;
+	}
+
+	bool field(char const* begin, char const* end, std::string& error) {
+		if (column_ < binding_.size() && binding_[column_] >= 0) {
+			while (begin < end && (*begin == ' ' || *begin == '+'))
+				++begin;
+			while (end > begin && (end[-1] == ' ' || end[-1] == '\r'))
+				--end;
+			double value;
+			std::from_chars_result res = std::from_chars(begin, end, value);
+			if (res.ec != std::errc() || res.ptr != end) {
+				error = "строка " + std::to_string(line_) + ", столбец " + std::to_string(column_ + 1) + ": не число";
+				return false;
+			}
+			pointers_[binding_[column_]][rows_] = value;
+		}
+		++column_;
+		return true;
+	}
+
+	bool endRow(std::string& error) {
+		if (column_ < binding_.size()) {
+			error = "в строке " + std::to_string(line_) + " не хватает столбцов";
+			return false;
+		}
+		column_ = 0;
+		++line_;
+		if (++rows_ == evaluator_.block())
+			flushBlock(*out_);
+		return true;
+	}
+
+	void flushBlock(OutputBuffer& out) { // вычисляем накопленный блок и дописываем результат
+		evaluator_.evaluate(pointers_.data(), rows_, outPointers_.data());
+		size_t outputs = outPointers_.size();
+		for (size_t i = 0; i < rows_; ++i)
+			for (size_t j = 0; j < outputs; ++j) {
+				out.put(outPointers_[j][i]);
+				out.put(j + 1 < outputs ? ',' : '\n');
+			}
+		rows_ = 0;
+	}
+
+	static std::string trim(char const* begin, char const* end) {
+		while (begin < end && std::isspace(static_cast<unsigned char>(*begin)))
+			++begin;
+		while (end > begin && std::isspace(static_cast<unsigned char>(end[-1])))
+			--end;
+		return std::string(begin, end);
+	}
+
+	BatchEvaluator evaluator_;
+	size_t window_; // размер окна отображения в байтах
+	std::vector<double> columns_; // значения входных столбцов текущего блока
+	std::vector<double*> pointers_; // начало каждого столбца в columns_
+	std::vector<double> results_; // результаты текущего блока, по столбцу на формулу
+	std::vector<double*> outPointers_; // начало каждого столбца в results_
+	std::vector<int> binding_; // для каждого столбца файла — номер переменной или -1
+	OutputBuffer* out_; // куда пишутся результаты во время process
+	size_t column_; // номер текущего столбца в строке
+	size_t rows_; // строк накоплено в блоке
+	size_t line_; // номер строки файла для сообщений об ошибках
+};
+
+// Двоичный столбцовый формат LR6C: заголовок, таблица столбцов, затем массивы чисел
+// little-endian, каждый с начала строки кэша (смещение кратно 64). Читается и пишется
+// через отображение в память без преобразования в текст.
+enum { COLUMN_F64 = 0, COLUMN_F32 = 1 }; // типы элементов столбца
+
+struct ColumnFileHeader {
+	char magic[4]; // "LR6C"
+	std::uint32_t version; // 1
+	std::uint32_t columnCount;
+	std::uint32_t headerSize; // заголовок вместе с таблицей столбцов, кратно 64
+	std::uint64_t rowCount; // одинаково для всех столбцов
+};
+
+struct ColumnFileEntry {
+	char name[32]; // имя столбца, дополненное нулями
+	std::uint32_t type; // COLUMN_F64 или COLUMN_F32
+	std::uint32_t reserved;
+	std::uint64_t offset; // смещение массива от начала файла
+};
+
+static_assert(sizeof(ColumnFileHeader) == 24 && sizeof(ColumnFileEntry) == 48, "формат LR6C не должен зависеть от компилятора");
+
+struct ColumnInfo { // описание столбца, прочитанное из заголовка
+	std::string name;
+	std::uint32_t type;
+	std::uint64_t offset;
+};
+
+inline bool littleEndianHost() {
+	std::uint32_t one = 1;
+	unsigned char first;
+	std::memcpy(&first, &one, 1);
+	return first == 1;
+}
+
+inline bool isColumnFile(std::string const& path) { // файл начинается с сигнатуры LR6C
+	std::FILE* file = std::fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+	char magic[4] = {};
+	bool ok = std::fread(magic, 1, 4, file) == 4 && std::memcmp(magic, "LR6C", 4) == 0;
+	std::fclose(file);
+	return ok;
+}
+
+inline std::uint64_t columnFileAlign(std::uint64_t offset) { return (offset + 63) / 64 * 64; }
+
+inline size_t columnTypeSize(std::uint32_t type) { return type == COLUMN_F64 ? sizeof(double) : sizeof(float); }
+
+bool readColumnFileHeader(MappedFile& file, std::vector<ColumnInfo>& columns, std::uint64_t& rows, std::string& error) {
+	ColumnFileHeader header;
+	if (file.size() < sizeof(header)) {
+		error = "файл LR6C слишком короткий";
+		return false;
+	}
+	char const* start = file.map(0, sizeof(header));
+	if (!start) {
+		error = "не удалось отобразить заголовок LR6C";
+		return false;
+	}
+	std::memcpy(&header, start, sizeof(header));
+	std::uint64_t tableEnd = sizeof(header) + std::uint64_t(header.columnCount) * sizeof(ColumnFileEntry);
+	if (std::memcmp(header.magic, "LR6C", 4) != 0 || header.version != 1 || header.headerSize < tableEnd || header.headerSize > file.size()) {
+		error = "повреждён заголовок файла LR6C";
+		return false;
+	}
+	char const* table = file.map(sizeof(header), static_cast<size_t>(tableEnd - sizeof(header)));
+	if (!table) {
+		error = "не удалось отобразить заголовок LR6C";
+		return false;
+	}
+	rows = header.rowCount;
+	for (std::uint32_t i = 0; i < header.columnCount; ++i) {
+		ColumnFileEntry entry;
+		std::memcpy(&entry, table + i * sizeof(entry), sizeof(entry));
+		ColumnInfo info;
+		info.name.assign(entry.name, strnlen(entry.name, sizeof(entry.name)));
+		info.type = entry.type;
+		info.offset = entry.offset;
+		// rows * размер элемента может переполниться, поэтому делим свободное место после offset
+		if ((info.type != COLUMN_F64 && info.type != COLUMN_F32) || info.offset % 64 != 0 || info.offset < header.headerSize
+			|| info.offset > file.size() || rows > (file.size() - info.offset) / columnTypeSize(info.type)) {
+			error = "неверное описание столбца " + info.name + " в файле LR6C";
+			return false;
+		}
+		columns.push_back(info);
+	}
+	return true;
+}
+
+// раскладка файла LR6C из столбцов double: байты заголовка, смещения столбцов и полный размер
+bool columnFileLayout(std::vector<std::string> const& names, std::uint64_t rows, std::vector<char>& bytes,
+	std::vector<std::uint64_t>& offsets, std::uint64_t& size, std::string& error) {
+	ColumnFileHeader header;
+	std::memcpy(header.magic, "LR6C", 4);
+	header.version = 1;
+	header.columnCount = static_cast<std::uint32_t>(names.size());
+	header.headerSize = static_cast<std::uint32_t>(columnFileAlign(sizeof(header) + names.size() * sizeof(ColumnFileEntry)));
+	header.rowCount = rows;
+	if (rows > (std::numeric_limits<std::uint64_t>::max() / 2 - header.headerSize) / sizeof(double) / (names.size() + 1)) { // размер — в 64 бита с запасом
+		error = "слишком много строк для файла LR6C: " + std::to_string(rows);
+		return false;
+	}
+	bytes.assign(header.headerSize, 0);
+	std::memcpy(&bytes[0], &header, sizeof(header));
+	std::uint64_t offset = header.headerSize;
+	for (size_t i = 0; i < names.size(); ++i) {
+		ColumnFileEntry entry = {};
+		if (names[i].size() >= sizeof(entry.name)) {
+			error = "имя столбца " + names[i] + " длиннее 31 символа";
+			return false;
+		}
+		std::memcpy(entry.name, names[i].data(), names[i].size());
+		entry.type = COLUMN_F64;
+		entry.offset = offset;
+		std::memcpy(&bytes[sizeof(header) + i * sizeof(entry)], &entry, sizeof(entry));
+		offsets.push_back(offset);
+		offset = columnFileAlign(offset + rows * sizeof(double));
+	}
+	size = offset;
+	return true;
+}
+
+// создаёт файл LR6C и записывает заголовок; offsets — куда писать данные столбцов
+bool createColumnFile(MappedFile& file, std::string const& path, std::vector<std::string> const& names,
+	std::uint64_t rows, std::vector<std::uint64_t>& offsets, std::string& error) {
+	std::vector<char> bytes;
+	std::uint64_t size;
+	if (!columnFileLayout(names, rows, bytes, offsets, size, error))
+		return false;
+	char* dst = nullptr;
+	if (!file.create(path, size) || !(dst = file.mapForWrite(0, bytes.size()))) {
+		error = "не удалось создать " + path;
+		return false;
+	}
+	std::memcpy(dst, &bytes[0], bytes.size());
+	return true;
+}
+
+struct RawFile { // файл для позиционного чтения и записи без общего указателя позиции
+	RawFile() {}
+	RawFile(RawFile const&) = delete;
+	RawFile& operator=(RawFile const&) = delete;
+	~RawFile() {
+#ifdef _WIN32
+		if (handle_ != INVALID_HANDLE_VALUE) CloseHandle(handle_);
+#else
+		if (fd_ >= 0) ::close(fd_);
+#endif
+	}
+
+	bool open(std::string const& path, bool write) { // write: создать (или очистить) файл для записи
+#ifdef _WIN32
+		handle_ = write
+			? CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr)
+			: CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		return handle_ != INVALID_HANDLE_VALUE;
+#else
+		fd_ = write ? ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) : ::open(path.c_str(), O_RDONLY);
+		return fd_ >= 0;
+#endif
+	}
+
+	// переносит length байт по смещению offset; вызывается из нескольких потоков одновременно
+	bool transfer(bool write, char* buffer, size_t length, std::uint64_t offset) {
+		while (length > 0) { // короткие чтения и записи дочитываем/дописываем
+#ifdef _WIN32
+			OVERLAPPED where = {};
+			where.Offset = static_cast<DWORD>(offset);
+			where.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			DWORD chunk = length > (1u << 30) ? (1u << 30) : static_cast<DWORD>(length);
+			DWORD done = 0;
+			BOOL ok = write ? WriteFile(handle_, buffer, chunk, &done, &where) : ReadFile(handle_, buffer, chunk, &done, &where);
+			if (!ok || done == 0)
+				return false;
+#else
+			ssize_t done = write ? pwrite(fd_, buffer, length, static_cast<off_t>(offset)) : pread(fd_, buffer, length, static_cast<off_t>(offset));
+			if (done < 0 && errno == EINTR)
+				continue;
+			if (done <= 0)
+				return false;
+#endif
+			buffer += done;
+			length -= done;
+			offset += done;
+		}
+		return true;
+	}
+
+#ifndef _WIN32
+	int fd() const { return fd_; }
+#endif
+
+private:
+#ifdef _WIN32
+	HANDLE handle_ = INVALID_HANDLE_VALUE;
+#else
+	int fd_ = -1;
+#endif
+};
+
+struct IoRequest { // одна операция асинхронного ввода-вывода
+	RawFile* file;
+	bool write; // запись или чтение
+	char* buffer;
+	size_t length;
+	std::uint64_t offset;
+	size_t tag; // возвращается из wait по завершении
+};
+
+struct AsyncIO { // очередь асинхронных операций чтения и записи по смещению
+	virtual ~AsyncIO() {}
+	virtual void submit(IoRequest const& request) = 0; // операция начинается не позже следующего wait
+	virtual bool wait(size_t& tag) = 0; // ждёт завершения любой операции; false при ошибке ввода-вывода
+	virtual void drain() = 0; // после ошибки: ни одна операция больше не обращается к своему буферу
+	virtual char const* name() const = 0;
+};
+
+struct ThreadedIO : AsyncIO { // запасной вариант: pread/pwrite в отдельных потоках
+	ThreadedIO(unsigned threads) : active_(0), stop_(false), failed_(false) {
+		for (unsigned i = 0; i < threads; ++i)
+			workers_.push_back(std::thread(&ThreadedIO::work, this));
+	}
+	~ThreadedIO() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		queued_.notify_all();
+		for (size_t i = 0; i < workers_.size(); ++i)
+			workers_[i].join();
+	}
+
+	void submit(IoRequest const& request) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			requests_.push_back(request);
+		}
+		queued_.notify_one();
+	}
+
+	bool wait(size_t& tag) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (done_.empty() && !failed_)
+			completed_.wait(lock);
+		if (failed_)
+			return false;
+		tag = done_.front();
+		done_.pop_front();
+		return true;
+	}
+
+	void drain() { // ещё не начатые операции отменяются, начатые дожидаются
+		std::unique_lock<std::mutex> lock(mutex_);
+		requests_.clear();
+		while (active_)
+			completed_.wait(lock);
+		done_.clear();
+	}
+
+	char const* name() const { return "threads"; }
+
+private:
+	void work() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true) {
+			while (requests_.empty() && !stop_)
+				queued_.wait(lock);
+			if (stop_)
+				return;
+			IoRequest request = requests_.front();
+			requests_.pop_front();
+			++active_;
+			lock.unlock();
+			bool ok = request.file->transfer(request.write, request.buffer, request.length, request.offset);
+			lock.lock();
+			--active_;
+			if (ok)
+				done_.push_back(request.tag);
+			else
+				failed_ = true;
+			completed_.notify_one();
+		}
+	}
+
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable queued_; // появились новые запросы
+	std::condition_variable completed_; // операция завершилась
+	std::deque<IoRequest> requests_; // ещё не начатые операции
+	std::deque<size_t> done_; // метки завершённых операций
+	size_t active_; // операций, которые сейчас выполняют потоки
+	bool stop_;
+	bool failed_;
+};
+
+#ifdef LR6_IO_URING
+struct UringIO : AsyncIO { // io_uring через системные вызовы напрямую, без liburing
+	UringIO() : ring_(-1), sq_(nullptr), cq_(nullptr), sqes_(nullptr), sqLength_(0), cqLength_(0), unsubmitted_(0), inflight_(0) {}
+	~UringIO() {
+		if (sq_ && cq_ && sqes_) // закрытие кольца не дожидается операций, а буферы вызывающего сейчас освободятся
+			drain();
+		if (sqes_) munmap(sqes_, params_.sq_entries * sizeof(io_uring_sqe));
+		if (cq_ && cq_ != sq_) munmap(cq_, cqLength_);
+		if (sq_) munmap(sq_, sqLength_);
+		if (ring_ >= 0) ::close(ring_);
+	}
+
+	bool init(unsigned entries) { // false, если ядро не даёт создать кольцо
+		std::memset(&params_, 0, sizeof(params_));
+		ring_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params_));
+		if (ring_ < 0)
+			return false;
+		sqLength_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+		cqLength_ = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+		bool single = (params_.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single)
+			sqLength_ = cqLength_ = sqLength_ > cqLength_ ? sqLength_ : cqLength_;
+		sq_ = mmapRing(sqLength_, IORING_OFF_SQ_RING);
+		cq_ = single ? sq_ : mmapRing(cqLength_, IORING_OFF_CQ_RING);
+		sqes_ = static_cast<io_uring_sqe*>(mmapRing(params_.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+		return sq_ && cq_ && sqes_;
+	}
+
+	void submit(IoRequest const& request) {
+		size_t slot;
+		if (free_.empty()) {
+			slot = pending_.size();
+			pending_.push_back(Pending());
+		}
+		else {
+			slot = free_.back();
+			free_.pop_back();
+		}
+		pending_[slot].request = request;
+		push(slot);
+	}
+
+	bool wait(size_t& tag) {
+		io_uring_cqe cqe;
+		while (next(cqe)) {
+			Pending& p = pending_[cqe.user_data];
+			if (cqe.res <= 0) {
+				free_.push_back(cqe.user_data);
+				return false;
+			}
+			p.request.buffer += cqe.res;
+			p.request.offset += cqe.res;
+			p.request.length -= cqe.res;
+			if (p.request.length > 0) { // короткая операция: продолжаем с того же места
+				push(cqe.user_data);
+				continue;
+			}
+			tag = p.request.tag;
+			free_.push_back(cqe.user_data);
+			return true;
+		}
+		return false;
+	}
+
+	void drain() { // результаты отбрасываются, короткие операции не продолжаются
+		io_uring_cqe cqe;
+		while (inflight_ > 0 && next(cqe))
+			free_.push_back(cqe.user_data);
+	}
+
+	char const* name() const { return "io_uring"; }
+
+private:
+	struct Pending {
+		IoRequest request; // оставшаяся часть операции
+		iovec vec;
+	};
+
+	void* mmapRing(size_t length, off_t offset) {
+		void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_, offset);
+		return p == MAP_FAILED ? nullptr : p;
+	}
+
+	bool next(io_uring_cqe& cqe) { // следующее завершение; false, если ядро не принимает вызов
+		char* cq = static_cast<char*>(cq_);
+		unsigned* head = reinterpret_cast<unsigned*>(cq + params_.cq_off.head);
+		unsigned* tail = reinterpret_cast<unsigned*>(cq + params_.cq_off.tail);
+		unsigned mask = *reinterpret_cast<unsigned*>(cq + params_.cq_off.ring_mask);
+		io_uring_cqe* cqes = reinterpret_cast<io_uring_cqe*>(cq + params_.cq_off.cqes);
+		while (true) {
+			unsigned h = *head;
+			if (h == __atomic_load_n(tail, __ATOMIC_ACQUIRE)) { // отправляем накопленное и спим до завершения
+				if (enter(unsubmitted_, 1, IORING_ENTER_GETEVENTS) < 0)
+					return false;
+				unsubmitted_ = 0;
+				continue;
+			}
+			cqe = cqes[h & mask];
+			__atomic_store_n(head, h + 1, __ATOMIC_RELEASE);
+			--inflight_;
+			return true;
+		}
+	}
+
+	int enter(unsigned submit, unsigned minComplete, unsigned flags) {
+		int res;
+		do
+			res = static_cast<int>(syscall(__NR_io_uring_enter, ring_, submit, minComplete, flags, nullptr, 0));
+		while (res < 0 && errno == EINTR);
+		return res;
+	}
+
+	void push(size_t slot) { // кладёт READV/WRITEV в очередь отправки, сам вызов ядра — в wait
+		char* sq = static_cast<char*>(sq_);
+		unsigned* head = reinterpret_cast<unsigned*>(sq + params_.sq_off.head);
+		unsigned* tail = reinterpret_cast<unsigned*>(sq + params_.sq_off.tail);
+		unsigned mask = *reinterpret_cast<unsigned*>(sq + params_.sq_off.ring_mask);
+		unsigned* array = reinterpret_cast<unsigned*>(sq + params_.sq_off.array);
+		unsigned t = *tail;
+		if (t - __atomic_load_n(head, __ATOMIC_ACQUIRE) == params_.sq_entries) { // очередь полна
+			enter(unsubmitted_, 0, 0);
+			unsubmitted_ = 0;
+		}
+		Pending& p = pending_[slot];
+		p.vec.iov_base = p.request.buffer;
+		p.vec.iov_len = p.request.length;
+		io_uring_sqe* sqe = &sqes_[t & mask];
+		std::memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = p.request.write ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe->fd = p.request.file->fd();
+		sqe->addr = reinterpret_cast<std::uint64_t>(&p.vec);
+		sqe->len = 1;
+		sqe->off = p.request.offset;
+		sqe->user_data = slot;
+		array[t & mask] = t & mask;
+		__atomic_store_n(tail, t + 1, __ATOMIC_RELEASE);
+		++unsubmitted_;
+		++inflight_;
+	}
+
+	int ring_;
+	io_uring_params params_;
+	void* sq_; // кольцо отправки
+	void* cq_; // кольцо завершений
+	io_uring_sqe* sqes_;
+	size_t sqLength_, cqLength_;
+	unsigned unsubmitted_; // запросов в кольце, о которых ядро ещё не знает
+	size_t inflight_; // запросов в кольце без завершения, вместе с неотправленными
+	std::deque<Pending> pending_; // deque: адреса iovec не меняются при росте
+	std::vector<size_t> free_; // свободные места в pending_
+};
+#endif
+
+// io_uring, если он собран и доступен, иначе потоки с pread/pwrite
+inline std::unique_ptr<AsyncIO> makeAsyncIO(unsigned queueDepth, bool allowUring = true) {
+#ifdef LR6_IO_URING
+	if (allowUring) {
+		UringIO* uring = new UringIO;
+		if (uring->init(queueDepth < 8 ? 8 : queueDepth))
+			return std::unique_ptr<AsyncIO>(uring);
+		delete uring;
+	}
+#else
+	(void)allowUring;
+#endif
+	return std::unique_ptr<AsyncIO>(new ThreadedIO(queueDepth < 4 ? queueDepth : 4));
+}
+
+struct ColumnFileEvaluator { // вычисление формул над файлом LR6C с записью результатов в LR6C
+	ColumnFileEvaluator(std::vector<Expression const*> const& exprs, size_t block = 4096, size_t chunkRows = size_t(1) << 20,
+		std::vector<Precision> const& precision = std::vector<Precision>(), MixedPrecisionPlan const* plan = nullptr)
+		: evaluator_(exprs, block, 0, false, precision, plan), chunkRows_(chunkRows), converted_(evaluator_.inputs().size() * block),
+		  pointers_(evaluator_.inputs().size()), outPointers_(evaluator_.outputs()) {
+		assert(chunkRows_ >= block);
+	}
+
+	BatchEvaluator& evaluator() { return evaluator_; } // для привязки массивов сумм до run
+
+	bool run(std::string const& inPath, std::string const& outPath, std::string& error) { // через отображение в память
+		std::vector<ColumnInfo> bound;
+		std::uint64_t rows = 0;
+		if (!bindColumns(inPath, bound, rows, error))
+			return false;
+		std::vector<std::string> const& inputs = evaluator_.inputs();
+		std::vector<std::unique_ptr<MappedFile> > files; // по окну отображения на столбец
+		for (size_t i = 0; i < inputs.size(); ++i) {
+			files.push_back(std::unique_ptr<MappedFile>(new MappedFile));
+			if (!files.back()->open(inPath)) {
+				error = "не удалось открыть " + inPath;
+				return false;
+			}
+		}
+		MappedFile header;
+		std::vector<std::uint64_t> offsets;
+		if (!createColumnFile(header, outPath, outputNames(evaluator_.outputs()), rows, offsets, error))
+			return false;
+		std::vector<std::unique_ptr<MappedFile> > outs; // по окну отображения на выходной столбец
+		for (size_t j = 0; j < offsets.size(); ++j) {
+			outs.push_back(std::unique_ptr<MappedFile>(new MappedFile));
+			if (!outs.back()->open(outPath, true)) {
+				error = "не удалось открыть " + outPath + " для записи";
+				return false;
+			}
+		}
+		size_t block = evaluator_.block();
+		for (std::uint64_t start = 0; start < rows; start += chunkRows_) {
+			size_t count = static_cast<size_t>(rows - start < chunkRows_ ? rows - start : chunkRows_);
+			std::vector<char const*> sources(inputs.size());
+			for (size_t i = 0; i < inputs.size(); ++i) {
+				size_t width = columnTypeSize(bound[i].type);
+				sources[i] = files[i]->map(bound[i].offset + start * width, count * width);
+			}
+			std::vector<double*> targets(offsets.size());
+			bool mapped = true;
+			for (size_t j = 0; j < offsets.size(); ++j) {
+				targets[j] = reinterpret_cast<double*>(outs[j]->mapForWrite(offsets[j] + start * sizeof(double), count * sizeof(double)));
+				mapped = mapped && targets[j];
+			}
+			for (size_t i = 0; i < inputs.size(); ++i)
+				mapped = mapped && sources[i];
+			if (!mapped) {
+				error = "не удалось отобразить файл в память";
+				return false;
+			}
+			for (size_t k = 0; k < count; k += block) {
+				size_t n = count - k < block ? count - k : block;
+				for (size_t i = 0; i < inputs.size(); ++i)
+					pointers_[i] = widen(sources[i] + k * columnTypeSize(bound[i].type), bound[i].type, n, i);
+				for (size_t j = 0; j < targets.size(); ++j)
+					outPointers_[j] = targets[j] + k;
+				evaluator_.evaluate(pointers_.data(), n, outPointers_.data()); // результаты сразу в отображение выходного файла
+			}
+		}
+		return true;
+	}
+
+	// то же через явное чтение и запись блоков: пока вычисляется блок N, блоки N+1..N+depth-1
+	// читаются, а предыдущие результаты пишутся, так что процессор не простаивает на вводе-выводе
+	bool runAsync(std::string const& inPath, std::string const& outPath, unsigned queueDepth, bool allowUring, std::string& error) {
+		assert(queueDepth >= 2);
+		std::vector<ColumnInfo> bound;
+		std::uint64_t rows = 0;
+		if (!bindColumns(inPath, bound, rows, error))
+			return false;
+		std::vector<char> header;
+		std::vector<std::uint64_t> offsets;
+		std::uint64_t size;
+		RawFile in, out;
+		if (!columnFileLayout(outputNames(evaluator_.outputs()), rows, header, offsets, size, error))
+			return false;
+		if (!in.open(inPath, false) || !out.open(outPath, true) || !out.transfer(true, &header[0], header.size(), 0)) {
+			error = "не удалось открыть " + inPath + " или создать " + outPath;
+			return false;
+		}
+		size_t block = evaluator_.block();
+		size_t columns = bound.size();
+		size_t outputs = offsets.size();
+		std::uint64_t blocks = (rows + block - 1) / block;
+		std::vector<IoSlot> slots(queueDepth);
+		for (size_t s = 0; s < slots.size(); ++s) {
+			slots[s].input.resize(columns * block * sizeof(double));
+			slots[s].output.resize(outputs * block);
+		}
+		std::unique_ptr<AsyncIO> io = makeAsyncIO(static_cast<unsigned>(queueDepth * (columns + outputs)), allowUring);
+		for (std::uint64_t b = 0; b < blocks && b < queueDepth; ++b)
+			readBlock(*io, in, bound, slots, b, rows);
+		for (std::uint64_t b = 0; b < blocks; ++b) {
+			IoSlot& slot = slots[b % queueDepth];
+			while (slot.reads > 0 || slot.writes > 0) // входные данные готовы, прошлый результат записан
+				if (!complete(*io, slots, error))
+					return false;
+			size_t n = blockRows(b, rows);
+			for (size_t i = 0; i < columns; ++i)
+				pointers_[i] = widen(&slot.input[i * block * sizeof(double)], bound[i].type, n, i);
+			for (size_t j = 0; j < outputs; ++j)
+				outPointers_[j] = &slot.output[j * block];
+			evaluator_.evaluate(pointers_.data(), n, outPointers_.data());
+			for (size_t j = 0; j < outputs; ++j) {
+				IoRequest write = { &out, true, reinterpret_cast<char*>(outPointers_[j]), n * sizeof(double),
+					offsets[j] + b * block * sizeof(double), static_cast<size_t>(b % queueDepth) * 2 + 1 };
+				io->submit(write);
+			}
+			slot.writes = outputs;
+			if (b + queueDepth < blocks) // входной буфер уже свободен, читаем в него следующий блок
+				readBlock(*io, in, bound, slots, b + queueDepth, rows);
+		}
+		for (size_t s = 0; s < slots.size(); ++s)
+			while (slots[s].writes > 0)
+				if (!complete(*io, slots, error))
+					return false;
+		std::uint64_t end = offsets.back() + rows * sizeof(double);
+		if (end < size) { // выравнивающий хвост, чтобы размер совпал с раскладкой
+			char zero[64] = {};
+			if (!out.transfer(true, zero, static_cast<size_t>(size - end), end)) {
+				error = "ошибка записи в " + outPath;
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	struct IoSlot { // буферы одного блока, находящегося в конвейере
+		IoSlot() : reads(0), writes(0) {}
+		std::vector<char> input; // сырые данные входных столбцов
+		std::vector<double> output; // результат
+		size_t reads; // незавершённых чтений
+		size_t writes; // незавершённых записей
+	};
+
+	size_t blockRows(std::uint64_t b, std::uint64_t rows) const {
+		std::uint64_t start = b * evaluator_.block();
+		return static_cast<size_t>(rows - start < evaluator_.block() ? rows - start : evaluator_.block());
+	}
+
+	void readBlock(AsyncIO& io, RawFile& in, std::vector<ColumnInfo> const& bound, std::vector<IoSlot>& slots, std::uint64_t b, std::uint64_t rows) {
+		size_t s = static_cast<size_t>(b % slots.size());
+		size_t n = blockRows(b, rows);
+		for (size_t i = 0; i < bound.size(); ++i) {
+			size_t width = columnTypeSize(bound[i].type);
+			IoRequest read = { &in, false, &slots[s].input[i * evaluator_.block() * sizeof(double)], n * width,
+				bound[i].offset + b * evaluator_.block() * width, s * 2 };
+			io.submit(read);
+		}
+		slots[s].reads = bound.size();
+	}
+
+	bool complete(AsyncIO& io, std::vector<IoSlot>& slots, std::string& error) { // ждёт одну операцию
+		size_t tag;
+		if (!io.wait(tag)) {
+			io.drain(); // остальные операции ещё пишут в slots, которые runAsync сейчас освободит
+			error = std::string("ошибка асинхронного ввода-вывода (") + io.name() + ")";
+			return false;
+		}
+		if (tag % 2)
+			--slots[tag / 2].writes;
+		else
+			--slots[tag / 2].reads;
+		return true;
+	}
+
+	bool bindColumns(std::string const& inPath, std::vector<ColumnInfo>& bound, std::uint64_t& rows, std::string& error) {
+		if (!littleEndianHost()) {
+			error = "формат LR6C поддерживается только на little-endian платформах";
+			return false;
+		}
+		MappedFile header;
+		std::vector<ColumnInfo> columns;
+		if (!header.open(inPath) || !readColumnFileHeader(header, columns, rows, error)) {
+			if (error.empty())
+				error = "не удалось открыть " + inPath;
+			return false;
+		}
+		std::vector<std::string> const& inputs = evaluator_.inputs();
+		for (size_t i = 0; i < inputs.size(); ++i) { // столбец для каждой переменной
+			size_t c = 0;
+			while (c < columns.size() && columns[c].name != inputs[i])
+				++c;
+			if (c == columns.size()) {
+				error = "в файле нет столбца для переменной " + inputs[i];
+				return false;
+			}
+			bound.push_back(columns[c]);
+		}
+		return true;
+	}
+
+	double const* widen(char const* src, std::uint32_t type, size_t n, size_t input) { // double отдаём как есть
+		if (type == COLUMN_F64)
+			return reinterpret_cast<double const*>(src);
+		float const* values = reinterpret_cast<float const*>(src);
+		double* buf = &converted_[input * evaluator_.block()];
+		for (size_t r = 0; r < n; ++r)
+			buf[r] = values[r];
+		return buf;
+	}
+
+	BatchEvaluator evaluator_;
+	size_t chunkRows_; // строк в одном окне отображения
+	std::vector<double> converted_; // столбцы float, переведённые в double для текущего блока
+	std::vector<double const*> pointers_; // входные столбцы текущего блока
+	std::vector<double*> outPointers_; // выходные столбцы текущего блока
+};
+
+struct PoolTask { // задание пула потоков; хранится внутри ожидающего объекта, без выделения памяти
+	PoolTask* next = nullptr;
+	void (*run)(PoolTask* task, size_t worker) = nullptr; // worker — номер потока пула
+};
+
+struct ThreadPool { // фиксированное число потоков и общая очередь заданий
+	ThreadPool(unsigned threads) : head_(nullptr), tail_(nullptr), stop_(false) {
+		assert(threads > 0);
+		for (unsigned i = 0; i < threads; ++i)
+			workers_.push_back(std::thread(&ThreadPool::work, this, static_cast<size_t>(i)));
+	}
+	~ThreadPool() { shutdown(); }
+
+	void shutdown() { // уже поставленные задания выполняются до конца, затем потоки завершаются
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		ready_.notify_all();
+		for (size_t i = 0; i < workers_.size(); ++i)
+			workers_[i].join();
+		workers_.clear();
+	}
+
+	size_t size() const { return workers_.size(); }
+
+	void post(PoolTask* task) {
+		task->next = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (tail_)
+				tail_->next = task;
+			else
+				head_ = task;
+			tail_ = task;
+		}
+		ready_.notify_one();
+	}
+
+	bool remove(PoolTask* task) { // снимает ещё не начатое задание; false, если поток его уже взял
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (PoolTask** link = &head_, * previous = nullptr; *link; previous = *link, link = &(*link)->next)
+			if (*link == task) {
+				*link = task->next;
+				if (tail_ == task)
+					tail_ = previous;
+				return true;
+			}
+		return false;
+	}
+
+private:
+	void work(size_t worker) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true) {
+			while (!head_ && !stop_)
+				ready_.wait(lock);
+			if (!head_)
+				return;
+			PoolTask* task = head_;
+			head_ = task->next;
+			if (!head_)
+				tail_ = nullptr;
+			lock.unlock();
+			task->run(task, worker);
+			lock.lock();
+		}
+	}
+
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable ready_;
+	PoolTask* head_; // очередь заданий — односвязный список
+	PoolTask* tail_;
+	bool stop_;
+};
+
+struct CancelToken { // общий флаг отмены; копии токена видят один и тот же флаг
+	CancelToken() : flag_(std::make_shared<std::atomic<bool> >(false)) {}
+	void cancel() const { flag_->store(true, std::memory_order_relaxed); }
+	bool cancelled() const { return flag_->load(std::memory_order_relaxed); }
+private:
+	std::shared_ptr<std::atomic<bool> > flag_;
+};
+
+enum EvalStatus { EVAL_OK, EVAL_CANCELLED, EVAL_DEADLINE_EXCEEDED };
+
+struct BindingsBatch { // пакет строк для одной формулы
+	std::vector<double const*> columns; // в порядке EvalEngine::inputs(formula)
+	size_t rows = 0;
+	double* out = nullptr; // rows результатов
+	CancelToken cancel; // отмена проверяется перед каждым блоком
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
+// Запросы ждут в общей очереди пула. Отменённые и просроченные снимает с очереди поток-наблюдатель,
+// не дожидаясь их очереди: отмену он замечает за cancelPoll(), срок — вовремя. При разрушении
+// движка начатые запросы останавливаются на границе блока, ждущие завершаются с EVAL_CANCELLED.
+struct EvalEngine { // общий движок вычисления формул на пуле потоков для асинхронного кода
+	EvalEngine(unsigned threads = std::thread::hardware_concurrency(), size_t block = 4096)
+		: block_(block), pool_(threads ? threads : 1), evaluators_(pool_.size()), stopping_(false),
+		  watcher_(&EvalEngine::watch, this) {}
+	~EvalEngine() { // сначала останавливаются потоки, затем освобождается то, что они читают
+		{
+			std::lock_guard<std::mutex> lock(waitMutex_);
+			stopping_ = true;
+		}
+		wake_.notify_one();
+		watcher_.join();
+		pool_.shutdown();
+		for (size_t i = 0; i < formulas_.size(); ++i)
+			delete formulas_[i];
+	}
+
+	int addFormula(Expression const* expr, Precision precision = PRECISE) { // движок хранит свою копию дерева
+		CopySyntaxTree copy;
+		Expression* own = runPass("CopySyntaxTree", expr, &copy);
+		BatchEvaluator probe(own, 1); // только чтобы узнать порядок входных столбцов
+		std::lock_guard<std::mutex> lock(mutex_);
+		formulas_.push_back(own);
+		precision_.push_back(precision);
+		inputs_.push_back(probe.inputs());
+		return static_cast<int>(formulas_.size()) - 1;
+	}
+
+	std::vector<std::string> inputs(int formula) const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return inputs_[formula];
+	}
+
+	struct Awaiter : PoolTask { // co_await engine.evaluate(...) возвращает EvalStatus
+		Awaiter(EvalEngine* engine, int formula, BindingsBatch const* batch)
+			: engine_(engine), formula_(formula), batch_(batch), status_(EVAL_OK) {
+			run = &Awaiter::execute;
+		}
+		bool await_ready() const { return false; }
+		void await_suspend(std::coroutine_handle<> handle) {
+			handle_ = handle;
+			engine_->submit(this);
+		}
+		EvalStatus await_resume() const { return status_; }
+
+	private:
+		friend struct EvalEngine;
+
+		static void execute(PoolTask* task, size_t worker) { // продолжение сопрограммы — прямо в потоке пула
+			Awaiter* self = static_cast<Awaiter*>(task);
+			self->engine_->started(self);
+			self->status_ = self->engine_->compute(self->formula_, *self->batch_, worker);
+			self->handle_.resume();
+		}
+
+		EvalEngine* engine_;
+		int formula_;
+		BindingsBatch const* batch_;
+		EvalStatus status_;
+		std::coroutine_handle<> handle_;
+	};
+
+	// batch должен жить до возобновления сопрограммы
+	Awaiter evaluate(int formula, BindingsBatch const& batch) { return Awaiter(this, formula, &batch); }
+
+private:
+	static std::chrono::milliseconds cancelPoll() { return std::chrono::milliseconds(1); }
+
+	EvalStatus verdict(BindingsBatch const& batch) const { // можно ли продолжать запрос
+		if (batch.cancel.cancelled() || stopping_.load(std::memory_order_relaxed))
+			return EVAL_CANCELLED;
+		return std::chrono::steady_clock::now() > batch.deadline ? EVAL_DEADLINE_EXCEEDED : EVAL_OK;
+	}
+
+	void submit(Awaiter* awaiter) { // наблюдатель видит запрос раньше, чем его может взять поток пула
+		bool idle;
+		{
+			std::lock_guard<std::mutex> lock(waitMutex_);
+			idle = waiting_.empty();
+			waiting_.push_back(awaiter);
+		}
+		if (idle) // с непустой очередью наблюдатель и так просыпается каждые cancelPoll()
+			wake_.notify_one();
+		pool_.post(awaiter);
+	}
+
+	void started(Awaiter* awaiter) { // запрос взят потоком пула, дальше его проверяет compute
+		std::lock_guard<std::mutex> lock(waitMutex_);
+		std::vector<Awaiter*>::iterator found = std::find(waiting_.begin(), waiting_.end(), awaiter);
+		if (found != waiting_.end()) {
+			*found = waiting_.back();
+			waiting_.pop_back();
+		}
+	}
+
+	void watch() { // поток-наблюдатель; сопрограммы снятых запросов продолжаются в нём
+		std::unique_lock<std::mutex> lock(waitMutex_);
+		while (!stopping_) {
+			std::chrono::steady_clock::time_point wake = std::chrono::steady_clock::now() + cancelPoll();
+			std::vector<Awaiter*> finished;
+			for (size_t i = 0; i < waiting_.size(); ) {
+				Awaiter* awaiter = waiting_[i];
+				EvalStatus status = verdict(*awaiter->batch_);
+				if (status != EVAL_OK && pool_.remove(awaiter)) { // не снят — значит, уже начат
+					awaiter->status_ = status;
+					finished.push_back(awaiter);
+					waiting_[i] = waiting_.back();
+					waiting_.pop_back();
+					continue;
+				}
+				if (awaiter->batch_->deadline < wake)
+					wake = awaiter->batch_->deadline;
+				++i;
+			}
+			if (!finished.empty()) { // сопрограмма может сразу отправить новый запрос
+				lock.unlock();
+				for (size_t i = 0; i < finished.size(); ++i)
+					finished[i]->handle_.resume();
+				lock.lock();
+			}
+			else if (waiting_.empty())
+				wake_.wait(lock);
+			else
+				wake_.wait_until(lock, wake);
+		}
+	}
+
+	EvalStatus compute(int formula, BindingsBatch const& batch, size_t worker) {
+		EvalStatus status = verdict(batch);
+		if (status != EVAL_OK)
+			return status;
+		std::vector<std::unique_ptr<BatchEvaluator> >& own = evaluators_[worker]; // у каждого потока свои регистры
+		if (own.size() <= static_cast<size_t>(formula))
+			own.resize(formula + 1);
+		if (!own[formula]) {
+			Expression const* expr;
+			Precision precision;
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				expr = formulas_[formula];
+				precision = precision_[formula];
+			}
+			own[formula].reset(new BatchEvaluator(expr, block_, 0, false, precision));
+		}
+		BatchEvaluator& evaluator = *own[formula];
+		std::vector<double const*> columns(batch.columns);
+		for (size_t start = 0; start < batch.rows; start += block_) {
+			if ((status = verdict(batch)) != EVAL_OK)
+				return status;
+			size_t n = batch.rows - start < block_ ? batch.rows - start : block_;
+			for (size_t i = 0; i < columns.size(); ++i)
+				columns[i] = batch.columns[i] + start;
+			evaluator.evaluate(columns.empty() ? nullptr : &columns[0], n, batch.out + start);
+		}
+		return EVAL_OK;
+	}
+
+	size_t block_;
+	ThreadPool pool_;
+	mutable std::mutex mutex_; // защищает formulas_ и inputs_
+	std::vector<Expression*> formulas_; // id формулы — индекс
+	std::vector<Precision> precision_;
+	std::vector<std::vector<std::string> > inputs_;
+	std::vector<std::vector<std::unique_ptr<BatchEvaluator> > > evaluators_; // [поток][формула]
+	std::mutex waitMutex_; // защищает waiting_ и ожидание наблюдателя
+	std::condition_variable wake_;
+	std::vector<Awaiter*> waiting_; // отправленные в пул и ещё не начатые запросы
+	std::atomic<bool> stopping_; // движок разрушается: новые блоки не считаются
+	std::thread watcher_; // последним: поток запускается, когда остальные поля готовы
+};
+
+struct ApproxCheck { // приближённая функция двух аргументов, независимый эталон и заявленная ошибка
+	char const* name;
+	double (*approx)(double, double);
+	long double (*exact)(long double, long double);
+	double bound;
+};
+
+// Проверка оценок точности APPROX: эталон считается в long double библиотекой, а не ядром. Точки —
+// по 64 случайные мантиссы для каждой степени двойки от денормализованных чисел до DBL_MAX,
+// второй аргумент в пределах 2^60 от первого или любой, пары почти равных по модулю и особые
+// значения со всеми знаками. Ошибка относительная, ниже DBL_MIN — в долях DBL_MIN. Проверяется
+// и сама функция, и векторный путь BatchEvaluator с политикой APPROX (он должен совпасть с ней
+// побитово). Где long double не длиннее double (MSVC), к оценке прибавляется 1 ulp эталона.
+// Новые приближения добавляются строкой в checks.
+bool validateApprox(std::ostream& out) {
+	ApproxCheck const checks[] = {
+		{ "atan2", approxAtan2, [](long double y, long double x) { return std::atan2(y, x); }, APPROX_ATAN2_BOUND },
+	};
+	double const inf = std::numeric_limits<double>::infinity(), nan = std::numeric_limits<double>::quiet_NaN();
+	double const reference = std::numeric_limits<long double>::digits > std::numeric_limits<double>::digits ? 0.0 : DBL_EPSILON;
+	std::vector<double> ys, xs;
+	double const special[] = { 0.0, -0.0, 1.0, -1.0, inf, -inf, nan, DBL_TRUE_MIN, -DBL_TRUE_MIN, DBL_MIN, DBL_MAX, -DBL_MAX };
+	for (double y : special)
+		for (double x : special) {
+			ys.push_back(y);
+			xs.push_back(x);
+		}
+	std::uint64_t state = 88172645463325252ull; // xorshift64 — одинаковые точки при каждом запуске
+	auto next = [&state] { state ^= state << 13; state ^= state >> 7; state ^= state << 17; return state; };
+	auto mantissa = [&next] { return 1.0 + static_cast<double>(next() >> 11) * 0x1p-53; };
+	for (int e = -1074; e <= 1023; ++e)
+		for (int k = 0; k < 64; ++k) {
+			int ex = k % 2 ? e + static_cast<int>(next() % 121) - 60 : static_cast<int>(next() % 2098) - 1074;
+			double y = std::ldexp(mantissa(), e);
+			double x = k % 8 == 7 ? y * (1.0 + static_cast<double>(static_cast<int>(next() % 2001) - 1000) * 0x1p-40)
+				: std::ldexp(mantissa(), ex < -1074 ? -1074 : ex > 1023 ? 1023 : ex);
+			ys.push_back(next() & 1 ? -y : y);
+			xs.push_back(next() & 1 ? -x : x);
+		}
+	bool ok = true;
+	for (size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); ++c) {
+		ApproxCheck const& check = checks[c];
+		FunctionCall call(check.name, std::vector<Expression const*>{ new Variable("y"), new Variable("x") });
+		BatchEvaluator batch(&call, 4096, 0, false, APPROX);
+		bool yFirst = batch.inputs()[0] == "y";
+		std::vector<double> vectorized(xs.size());
+		for (size_t start = 0; start < xs.size(); start += batch.block()) {
+			double const* columns[2] = { yFirst ? &ys[start] : &xs[start], yFirst ? &xs[start] : &ys[start] };
+			size_t n = xs.size() - start < batch.block() ? xs.size() - start : batch.block();
+			batch.evaluate(columns, n, &vectorized[start]);
+		}
+		double worst = 0.0, worstY = 0.0, worstX = 0.0;
+		size_t wrong = 0, mismatched = 0; // неверные особые значения, расхождения векторного пути со скалярным
+		for (size_t i = 0; i < xs.size(); ++i) {
+			double got = check.approx(ys[i], xs[i]);
+			if (std::memcmp(&got, &vectorized[i], sizeof(got)) != 0 && !(std::isnan(got) && std::isnan(vectorized[i])))
+				++mismatched;
+			long double exact = check.exact(ys[i], xs[i]);
+			if (std::isnan(exact) || exact == 0) { // NaN и нули со знаком должны совпасть точно
+				if (!(std::isnan(exact) ? std::isnan(got) : got == 0 && std::signbit(got) == std::signbit(exact)))
+					++wrong;
+				continue;
+			}
+			long double scale = std::fabs(exact) > DBL_MIN ? std::fabs(exact) : static_cast<long double>(DBL_MIN);
+			double error = static_cast<double>(std::fabs(got - exact) / scale);
+			if (!(error <= worst)) { // NaN тоже попадает сюда
+				worst = error;
+				worstY = ys[i];
+				worstX = xs[i];
+			}
+		}
+		bool passed = worst <= check.bound + reference && wrong == 0 && mismatched == 0;
+		out << check.name << ": " << xs.size() << " точек, наибольшая относительная ошибка " << worst
+			<< " при y = " << worstY << ", x = " << worstX << ", оценка " << check.bound;
+		if (reference)
+			out << " + " << reference << " (эталон)";
+		out << ", неверных особых значений " << wrong << ", расхождений с BatchEvaluator " << mismatched
+			<< (passed ? " — OK" : " — ОШИБКА") << std::endl;
+		ok = ok && passed;
+	}
+	return ok;
+}
+
+// LR6_TRPO [параметры] <формулы через ;> <вход> <выход>, вход — CSV с заголовком или файл LR6C
+// массив для --array: числа через пробелы или переводы строк, values[k] — k-е число файла
+bool readArrayFile(std::string const& path, std::vector<double>& values, std::string& error) {
+	std::FILE* file = std::fopen(path.c_str(), "rb");
+	if (!file) {
+		error = "не удалось открыть " + path;
+		return false;
+	}
+	std::string text;
+	char buffer[1 << 16];
+	for (size_t got; (got = std::fread(buffer, 1, sizeof(buffer), file)) > 0; )
+		text.append(buffer, got);
+	std::fclose(file);
+	char const* p = text.data();
+	char const* end = p + text.size();
+	values.clear();
+	for (;;) {
+		while (p < end && std::isspace(static_cast<unsigned char>(*p)))
+			++p;
+		if (p == end)
+			return true;
+		double value;
+		std::from_chars_result res = std::from_chars(p, end, value);
+		if (res.ec != std::errc()) {
+			error = "неверная запись числа " + std::to_string(values.size() + 1) + " в " + path;
+			return false;
+		}
+		values.push_back(value);
+		p = res.ptr;
+	}
+}
+
+// каждый массив, нужный суммам и dot формул, должен быть задан и быть не короче нужного,
+// формы массивов в dot — согласованы
+bool bindArrays(BatchEvaluator& evaluator, ArrayValues const& arrays, std::string& error) {
+	std::map<std::string, size_t> const& needed = evaluator.arrays();
+	for (std::map<std::string, size_t>::const_iterator it = needed.begin(); it != needed.end(); ++it) {
+		ArrayValues::const_iterator found = arrays.find(it->first);
+		if (found == arrays.end()) {
+			error = "не задан массив " + it->first + " (--array " + it->first + "=файл)";
+			return false;
+		}
+		if (found->second.size() < it->second) {
+			error = "в массиве " + it->first + " " + std::to_string(found->second.size()) + " чисел, формулам нужно "
+				+ std::to_string(it->second);
+			return false;
+		}
+		evaluator.bindArray(it->first, found->second);
+	}
+	return evaluator.checkArrays(error);
+}
+
+int runCommandLine(int argc, char* argv[]) {
+	char const* usage =
+		"использование: LR6_TRPO [параметры] <формула>[;<формула>...] <вход> <выход>\n"
+		"  --block N        строк в блоке вычисления (4096)\n"
+		"  --queue-depth N  для LR6C: асинхронный ввод-вывод, N блоков в конвейере (N >= 2)\n"
+		"  --io threads     не использовать io_uring, читать и писать потоками pread/pwrite\n"
+		"  --precision approx  приближённый atan2 без libm, до 2 DBL_EPSILON (проверка: --validate-approx)\n"
+		"  --range X=A:B    значения переменной X лежат в [A, B]\n"
+		"  --tolerance E    считать во float поддеревья, если по диапазонам --range ошибка формулы <= E\n"
+		"  --strength-reduce  степени — кратчайшими цепочками умножений, смена знака — внутрь + и -\n"
+		"  --array W=FILE   значения массива W для сумм sum(i, 0, N, W[i]*x) и dot(W, matvec(M, V)): числа из\n"
+		"                   текстового файла, матрица — по строкам\n"
+		"  --alloc-report   вывести в stderr выделения узлов деревьев: всего и по проходам\n"
+		"  --trace FILE     записать этапы (разбор, проходы, компиляция, блоки) в FILE для chrome://tracing\n"
+		"  --perf           вывести в stderr аппаратные счётчики (perf_event_open) по формулам и этапам\n"
+		"LR6_TRPO --validate-approx  проверить оценки ошибки приближённых функций\n";
+	size_t block = 4096;
+	unsigned long queueDepth = 0; // 0 — читать через отображение в память
+	bool allowUring = true;
+	Precision precision = PRECISE;
+	std::map<std::string, Interval> ranges;
+	double tolerance = 0.0; // 0 — всё в double
+	bool reduce = false;
+	bool allocReport = false;
+	std::string tracePath;
+	bool perfReport = false;
+	ArrayValues arrays;
+	std::string error;
+	std::vector<std::string> args;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--block" && i + 1 < argc)
+			block = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--queue-depth" && i + 1 < argc)
+			queueDepth = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--io" && i + 1 < argc)
+			allowUring = std::string(argv[++i]) != "threads";
+		else if (arg == "--precision" && i + 1 < argc)
+			precision = std::string(argv[++i]) == "approx" ? APPROX : PRECISE;
+		else if (arg == "--range" && i + 1 < argc) {
+			std::string range = argv[++i];
+			size_t equal = range.find('='), colon = range.find(':', equal);
+			if (equal == std::string::npos || colon == std::string::npos) {
+				std::cerr << usage;
+				return 2;
+			}
+			ranges[range.substr(0, equal)] = Interval(std::strtod(range.c_str() + equal + 1, nullptr),
+				std::strtod(range.c_str() + colon + 1, nullptr));
+		}
+		else if (arg == "--tolerance" && i + 1 < argc)
+			tolerance = std::strtod(argv[++i], nullptr);
+		else if (arg == "--strength-reduce")
+			reduce = true;
+		else if (arg == "--alloc-report")
+			allocReport = true;
+		else if (arg == "--trace" && i + 1 < argc)
+			tracePath = argv[++i];
+		else if (arg == "--perf")
+			perfReport = true;
+		else if (arg == "--array" && i + 1 < argc) {
+			std::string array = argv[++i];
+			size_t equal = array.find('=');
+			if (equal == std::string::npos || equal == 0) {
+				std::cerr << usage;
+				return 2;
+			}
+			if (!readArrayFile(array.substr(equal + 1), arrays[array.substr(0, equal)], error)) {
+				std::cerr << error << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--validate-approx" && argc == 2)
+			return validateApprox(std::cout) ? 0 : 1;
+		else
+			args.push_back(arg);
+	}
+	if (args.size() != 3 || block == 0 || queueDepth == 1) {
+		std::cerr << usage;
+		return 2;
+	}
+	if (!tracePath.empty())
+		Trace::enable();
+	PerfCounters counters;
+	if (perfReport)
+		counters.activate();
+	std::vector<Expression const*> exprs; // формулы через ';' — один общий проход по входу
+	for (size_t start = 0; start <= args[0].size(); ) {
+		size_t end = args[0].find(';', start);
+		if (end == std::string::npos)
+			end = args[0].size();
+		counters.setLabel("формула " + std::to_string(exprs.size() + 1));
+		AllocationScope parse;
+		Expression* expr = Parser(args[0].substr(start, end - start)).parse(error);
+		passAllocations()["Parser"].add(parse.delta());
+		if (!expr) {
+			std::cerr << "ошибка в формуле " << exprs.size() + 1 << ": " << error << std::endl;
+			for (size_t i = 0; i < exprs.size(); ++i)
+				delete exprs[i];
+			return 1;
+		}
+		if (reduce) {
+			StrengthReduce pass;
+			Expression* reduced = runPass("StrengthReduce", expr, &pass);
+			delete expr;
+			expr = reduced;
+		}
+		exprs.push_back(expr);
+		start = end + 1;
+	}
+	counters.setLabel(exprs.size() > 1 ? "все формулы" : "формула 1"); // формулы вычисляются одной общей программой
+	bool ok;
+	std::vector<Precision> precisions(exprs.size(), precision);
+	MixedPrecisionPlan plan;
+	if (tolerance > 0.0)
+		for (size_t i = 0; i < exprs.size(); ++i)
+			planMixedPrecision(exprs[i], ranges, tolerance, plan);
+	if (isColumnFile(args[1])) { // двоичный вход — двоичный выход, без преобразования в текст
+		PerfScope run("весь файл"); // с компиляцией, чтением и записью
+		ColumnFileEvaluator columns(exprs, block, size_t(1) << 20, precisions, &plan);
+		ok = bindArrays(columns.evaluator(), arrays, error) && (queueDepth
+			? columns.runAsync(args[1], args[2], static_cast<unsigned>(queueDepth), allowUring, error)
+			: columns.run(args[1], args[2], error));
+	}
+	else {
+		PerfScope run("весь файл");
+		CsvEvaluator csv(exprs, block, size_t(1) << 26, precisions, &plan);
+		ok = bindArrays(csv.evaluator(), arrays, error) && csv.run(args[1], args[2], error);
+	}
+	for (size_t i = 0; i < exprs.size(); ++i)
+		delete exprs[i];
+	if (allocReport)
+		printAllocationReport(std::cerr);
+	if (perfReport)
+		printPerfReport(std::cerr, counters);
+	if (!tracePath.empty() && !writeChromeTrace(tracePath, error) && ok) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+	if (!ok) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+#ifndef LR6_TESTS // у тестов (LR6_TRPO_Tests.cpp) своя main
+int main(int argc, char* argv[])
+{
+	setlocale(LC_ALL, "Russian");
+	if (argc > 1) // с аргументами работаем как этап конвейера обработки файлов
+		return runCommandLine(argc, argv);
+	/*std::cout << "Hello World!\n";
 	Expression* e1 = new Number(1.234);
 	Expression* e2 = new Number(-1.234);
 	Expression* e3 = new BinaryOperation(e1, BinaryOperation::DIV, e2);
@@ -267,6 +7068,19 @@ int main()
 	printExpr(callAbs);
 	std::cout << std::endl;
 	FoldConstants FC;
-	Expression* newExpr = callAbs->transform(&FC);
+	Expression* newExpr = runPass("FoldConstants", callAbs, &FC);
 	printExpr(newExpr);
-}
\ No newline at end of file
+#ifdef LR6_INSTRUMENT
+	std::cout << std::endl << callAbs->evaluate() << " " << newExpr->evaluate() << std::endl;
+	printEvaluationProfile();
+	std::cout << "дерево: ";
+	printAllocations(std::cout, treeAllocation(callAbs));
+	std::cout << std::endl;
+#endif
+	delete callAbs; // вместе с поддеревьями n32, n16, minus, callSqrt, var, mult
+	delete newExpr;
+#ifdef LR6_INSTRUMENT
+	printAllocationReport(std::cout);
+#endif
+}
+#endif
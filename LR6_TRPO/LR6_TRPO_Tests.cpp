@@ -0,0 +1,680 @@
+﻿// Тесты ЛР6: программа подключается целиком, вместо её main — main тестов.
+// Код возврата 0, если все проверки прошли; непрошедшие печатаются в stderr со строкой.
+#define LR6_TESTS
+#include "LR6_TRPO.cpp"
+#include <filesystem>
+#include <random>
+#include <sstream>
+
+static int checks = 0, failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static void check(bool ok, char const* text, int line) {
+	++checks;
+	if (!ok) {
+		++failures;
+		std::cerr << "LR6_TRPO_Tests.cpp:" << line << ": не выполнено " << text << std::endl;
+	}
+}
+
+static std::string tempPath(std::string const& name) { // файлы тестов — во временном каталоге
+	return (std::filesystem::temp_directory_path() / ("lr6_test_" + name)).string();
+}
+
+static void writeText(std::string const& path, std::string const& text) {
+	std::FILE* file = std::fopen(path.c_str(), "wb");
+	assert(file);
+	std::fwrite(text.data(), 1, text.size(), file);
+	std::fclose(file);
+}
+
+static std::string readText(std::string const& path) { // пустая строка, если файла нет
+	std::string text;
+	std::FILE* file = std::fopen(path.c_str(), "rb");
+	if (!file)
+		return text;
+	char buffer[1 << 16];
+	for (size_t got; (got = std::fread(buffer, 1, sizeof(buffer), file)) > 0; )
+		text.append(buffer, got);
+	std::fclose(file);
+	return text;
+}
+
+static Expression* formula(std::string const& text) { // формулы тестов всегда разбираются
+	std::string error;
+	Expression* expr = Parser(text).parse(error);
+	if (!expr)
+		std::cerr << text << ": " << error << std::endl;
+	assert(expr);
+	return expr;
+}
+
+static bool sameDouble(double a, double b) { // побитовое равенство: -0 не равен 0, NaN равен NaN
+	return std::memcmp(&a, &b, sizeof(a)) == 0 || (std::isnan(a) && std::isnan(b));
+}
+
+// файл LR6C из столбцов double одинаковой длины
+static void writeColumnFile(std::string const& path, std::vector<std::string> const& names, std::vector<std::vector<double> > const& columns) {
+	MappedFile file;
+	std::vector<std::uint64_t> offsets;
+	std::string error;
+	bool created = createColumnFile(file, path, names, columns[0].size(), offsets, error);
+	assert(created);
+	(void)created;
+	for (size_t i = 0; i < columns.size(); ++i) {
+		char* dst = file.mapForWrite(offsets[i], columns[i].size() * sizeof(double));
+		assert(dst);
+		std::memcpy(dst, columns[i].data(), columns[i].size() * sizeof(double));
+	}
+}
+
+// столбец name файла LR6C; пустой, если файла или столбца нет
+static std::vector<double> readColumn(std::string const& path, std::string const& name) {
+	MappedFile file;
+	std::vector<ColumnInfo> columns;
+	std::uint64_t rows = 0;
+	std::string error;
+	std::vector<double> values;
+	if (!file.open(path) || !readColumnFileHeader(file, columns, rows, error))
+		return values;
+	for (size_t c = 0; c < columns.size(); ++c)
+		if (columns[c].name == name && columns[c].type == COLUMN_F64 && rows) {
+			values.resize(static_cast<size_t>(rows));
+			std::memcpy(values.data(), file.map(columns[c].offset, values.size() * sizeof(double)), values.size() * sizeof(double));
+		}
+	return values;
+}
+
+// CSV: пробелы, '+', CRLF, пустая строка и последняя строка без перевода, блок меньше числа строк;
+// ошибки разбора не оставляют выходного файла
+void testCsv() {
+	std::string in = tempPath("in.csv"), out = tempPath("out.csv");
+	writeText(in, "x, y,unused\n1,2,a\n-3.5, 4e-3,b\n\n0.1,+7,c\r\n5,6,d");
+	double const x[] = { 1, -3.5, 0.1, 5 }, y[] = { 2, 4e-3, 7, 6 };
+	std::vector<Expression const*> exprs = { formula("x*y+1"), formula("sqrt(abs(x))-y/3") };
+	std::string error;
+	{
+		CsvEvaluator csv(exprs, 3);
+		CHECK(csv.run(in, out, error));
+	}
+	std::string text = readText(out);
+	CHECK(text.compare(0, 16, "result1,result2\n") == 0);
+	char const* p = text.c_str() + (text.size() < 16 ? text.size() : 16);
+	for (size_t row = 0; row < 4; ++row)
+		for (size_t j = 0; j < exprs.size(); ++j) {
+			char* end;
+			double value = std::strtod(p, &end); // запись кратчайшая, но точная
+			CHECK(end != p && *end == (j + 1 < exprs.size() ? ',' : '\n'));
+			CHECK(value == evaluateAs<double>(exprs[j], { { "x", x[row] }, { "y", y[row] } }));
+			p = *end ? end + 1 : end;
+		}
+	CHECK(*p == '\0');
+
+	struct { char const* input; char const* message; } const broken[] = {
+		{ "x,y\n1,2\n3\n4,5\n", "в строке 3 не хватает столбцов" },
+		{ "x,y\n1,2\n3,abc\n", "строка 3, столбец 2: не число" },
+		{ "x,z\n1,2\n", "в заголовке нет столбца для переменной y" },
+		{ "", "во входном файле нет заголовка" },
+	};
+	for (size_t k = 0; k < sizeof(broken) / sizeof(broken[0]); ++k) {
+		writeText(in, broken[k].input);
+		writeText(out, "старый результат");
+		CsvEvaluator csv(exprs, 3);
+		error.clear();
+		CHECK(!csv.run(in, out, error));
+		CHECK(error == broken[k].message);
+		CHECK(!std::filesystem::exists(out));
+	}
+	for (size_t j = 0; j < exprs.size(); ++j)
+		delete exprs[j];
+	std::remove(in.c_str());
+}
+
+// LR6C: отображение в память, потоки pread/pwrite и io_uring (если есть) дают одинаковые файлы
+void testColumnFile() {
+	std::string in = tempPath("in.lr6c"), mapped = tempPath("mapped.lr6c"), threads = tempPath("threads.lr6c"), uring = tempPath("uring.lr6c");
+	size_t const rows = 10007; // не кратно блоку
+	std::mt19937 random(1);
+	std::uniform_real_distribution<double> value(-10.0, 10.0);
+	std::vector<std::vector<double> > columns(2, std::vector<double>(rows));
+	for (size_t r = 0; r < rows; ++r) {
+		columns[0][r] = value(random);
+		columns[1][r] = value(random);
+	}
+	writeColumnFile(in, { "y", "x" }, columns);
+	std::vector<Expression const*> exprs = { formula("x*y-x/3"), formula("hypot(x,y)+min(x,0)") };
+	std::string error;
+	{
+		ColumnFileEvaluator evaluator(exprs, 256, 1024);
+		CHECK(evaluator.run(in, mapped, error));
+	}
+	{
+		ColumnFileEvaluator evaluator(exprs, 256, 1024);
+		CHECK(evaluator.runAsync(in, threads, 4, false, error));
+	}
+	{
+		ColumnFileEvaluator evaluator(exprs, 256, 1024);
+		CHECK(evaluator.runAsync(in, uring, 3, true, error));
+	}
+	std::string expected = readText(mapped);
+	CHECK(!expected.empty() && readText(threads) == expected && readText(uring) == expected);
+	std::vector<double> result1 = readColumn(mapped, "result1"), result2 = readColumn(mapped, "result2");
+	CHECK(result1.size() == rows && result2.size() == rows);
+	for (size_t r = 0; r < result1.size() && r < result2.size(); r += 97) {
+		std::map<std::string, double> vars = { { "x", columns[1][r] }, { "y", columns[0][r] } };
+		CHECK(result1[r] == evaluateAs<double>(exprs[0], vars));
+		CHECK(result2[r] == evaluateAs<double>(exprs[1], vars));
+	}
+	for (size_t j = 0; j < exprs.size(); ++j)
+		delete exprs[j];
+	std::remove(in.c_str());
+	std::remove(mapped.c_str());
+	std::remove(threads.c_str());
+	std::remove(uring.c_str());
+}
+
+// заголовок LR6C, записанный вручную: один столбец x с offset 128 в файле из size байт
+static std::string craftedColumnFile(std::uint64_t rows, std::uint64_t offset, std::uint32_t type, size_t size) {
+	std::string bytes(size, '\0');
+	ColumnFileHeader header = { { 'L', 'R', '6', 'C' }, 1, 1, 128, rows };
+	ColumnFileEntry entry = { { 'x' }, type, 0, offset };
+	std::memcpy(&bytes[0], &header, sizeof(header));
+	std::memcpy(&bytes[sizeof(header)], &entry, sizeof(entry));
+	return bytes;
+}
+
+// повреждённые заголовки отвергаются до отображения данных, в том числе при переполнении
+// rows * размер элемента; целый файл с тем же заголовком вычисляется
+void testColumnFileHeader() {
+	std::string in = tempPath("crafted.lr6c"), out = tempPath("crafted_out.lr6c");
+	struct { std::string bytes; char const* message; } const broken[] = {
+		{ craftedColumnFile(std::uint64_t(1) << 61, 128, COLUMN_F64, 192), "неверное описание столбца x в файле LR6C" },
+		{ craftedColumnFile(std::uint64_t(1) << 62, 128, COLUMN_F32, 192), "неверное описание столбца x в файле LR6C" },
+		{ craftedColumnFile(1, std::uint64_t(1) << 63, COLUMN_F64, 192), "неверное описание столбца x в файле LR6C" },
+		{ craftedColumnFile(9, 128, COLUMN_F64, 192), "неверное описание столбца x в файле LR6C" },
+		{ craftedColumnFile(8, 128, 7, 192), "неверное описание столбца x в файле LR6C" },
+		{ craftedColumnFile(8, 128, COLUMN_F64, 100), "повреждён заголовок файла LR6C" },
+		{ std::string("LR6C\1\0\0\0", 8), "файл LR6C слишком короткий" },
+	};
+	Expression* expr = formula("x*2");
+	for (size_t k = 0; k < sizeof(broken) / sizeof(broken[0]); ++k) {
+		writeText(in, broken[k].bytes);
+		std::string error;
+		ColumnFileEvaluator mapped(std::vector<Expression const*>(1, expr), 4, 4);
+		CHECK(!mapped.run(in, out, error));
+		CHECK(error == broken[k].message);
+		ColumnFileEvaluator async(std::vector<Expression const*>(1, expr), 4, 4);
+		error.clear();
+		CHECK(!async.runAsync(in, out, 2, false, error));
+		CHECK(error == broken[k].message);
+	}
+	std::string whole = craftedColumnFile(8, 128, COLUMN_F64, 192);
+	for (int r = 0; r < 8; ++r) {
+		double x = r - 2.5;
+		std::memcpy(&whole[128 + r * sizeof(double)], &x, sizeof(x));
+	}
+	writeText(in, whole);
+	std::string error;
+	ColumnFileEvaluator evaluator(std::vector<Expression const*>(1, expr), 4, 4);
+	CHECK(evaluator.run(in, out, error));
+	std::vector<double> result = readColumn(out, "result");
+	CHECK(result.size() == 8 && result[0] == -5.0 && result[7] == 9.0);
+	std::vector<char> bytes;
+	std::vector<std::uint64_t> offsets;
+	std::uint64_t size;
+	CHECK(!columnFileLayout({ "a", "b" }, std::uint64_t(1) << 61, bytes, offsets, size, error));
+	delete expr;
+	std::remove(in.c_str());
+	std::remove(out.c_str());
+}
+
+// чтение через конец файла: короткая операция продолжается с того же места, следующая часть
+// (0 байт) — ошибка. После drain ни одна операция не пишет в буферы: io_uring дожидается всех,
+// потоки — начатых, не начатые отменяются
+void testAsyncIO() {
+	std::string path = tempPath("async.bin");
+	std::string data(9000, '\0');
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = static_cast<char>(i * 7 + i / 251);
+	writeText(path, data);
+	RawFile file;
+	CHECK(file.open(path, false));
+	for (int uring = 0; uring < 2; ++uring) {
+		std::unique_ptr<AsyncIO> io = makeAsyncIO(8, uring != 0);
+		std::vector<std::vector<char> > buffers(9, std::vector<char>(1000, 'x'));
+		buffers[8].resize(4096, 'x');
+		for (size_t k = 0; k < buffers.size(); ++k) { // последнее чтение — 4096 байт с 8000, в файле 1000
+			IoRequest read = { &file, false, buffers[k].data(), buffers[k].size(), k * 1000, k };
+			io->submit(read);
+		}
+		size_t tag, done = 0;
+		while (io->wait(tag))
+			CHECK(tag < 8 && ++done <= 8);
+		io->drain();
+		bool torn = false, missing = false;
+		for (size_t k = 0; k < 8; ++k) {
+			bool whole = std::memcmp(buffers[k].data(), &data[k * 1000], 1000) == 0;
+			torn = torn || (!whole && std::count(buffers[k].begin(), buffers[k].end(), 'x') != 1000);
+			missing = missing || !whole;
+		}
+		CHECK(!torn);
+		CHECK(std::string(io->name()) == "threads" || !missing);
+		CHECK(std::memcmp(buffers[8].data(), &data[8000], 1000) == 0 && buffers[8][1000] == 'x');
+	}
+	std::remove(path.c_str());
+}
+
+// Interval содержит точное значение, Dual даёт производную, Complex — главную ветвь
+void testScalarTypes() {
+	char const* const texts[] = { "x*y+x/y-sqrt(y)", "(x-y)*(x+y)/3", "hypot(x,y)-abs(x)", "x^5-2*x^-2", "fma(x,y,-1)+atan2(y,x)",
+		"min(x,y)*max(x,0.5)+select(x>y,x,y)", "pow(y,0.75)-x" };
+	std::mt19937 random(2);
+	std::uniform_real_distribution<double> xs(-3.0, 3.0), ys(0.25, 4.0);
+	for (size_t t = 0; t < sizeof(texts) / sizeof(texts[0]); ++t) {
+		Expression* expr = formula(texts[t]);
+		Interval wide = evaluateAs<Interval>(expr, { { "x", Interval(-3.0, 3.0) }, { "y", Interval(0.25, 4.0) } });
+		for (int k = 0; k < 200; ++k) {
+			double x = xs(random), y = ys(random);
+			if (std::string(texts[t]).find("x^-2") != std::string::npos && std::fabs(x) < 0.01)
+				continue;
+			Interval point = evaluateAs<Interval>(expr, { { "x", Interval(x) }, { "y", Interval(y) } });
+			long double exact = evaluateAs<long double>(expr, { { "x", x }, { "y", y } });
+			double value = evaluateAs<double>(expr, { { "x", x }, { "y", y } });
+			CHECK(point.lo <= exact && exact <= point.hi);
+			CHECK(point.lo <= value && value <= point.hi);
+			CHECK(wide.lo <= point.lo && point.hi <= wide.hi);
+		}
+		delete expr;
+	}
+
+	struct { char const* text; double x, derivative; } const derivatives[] = {
+		{ "x*x+3*x", 2.0, 7.0 }, { "sqrt(x)", 4.0, 0.25 }, { "pow(x,3)", 2.0, 12.0 }, { "x^3", 2.0, 12.0 },
+		{ "atan2(x,1)", 0.0, 1.0 }, { "fma(x,x,x)", 3.0, 7.0 }, { "select(x>0,x*x,-x)", -2.0, -1.0 },
+		{ "min(x,2*x)", 1.0, 1.0 }, { "abs(x)", -3.0, -1.0 }, { "1/x", 0.5, -4.0 }, { "hypot(x,4)", 3.0, 0.6 },
+	};
+	for (size_t k = 0; k < sizeof(derivatives) / sizeof(derivatives[0]); ++k) {
+		Expression* expr = formula(derivatives[k].text);
+		Dual d = evaluateAs<Dual>(expr, { { "x", Dual(derivatives[k].x, 1.0) } });
+		CHECK(d.value == evaluateAs<double>(expr, { { "x", derivatives[k].x } }));
+		CHECK(std::fabs(d.derivative - derivatives[k].derivative) <= 4 * DBL_EPSILON * std::fabs(derivatives[k].derivative));
+		delete expr;
+	}
+
+	struct { char const* text; Complex x, y; std::complex<double> expected; } const complexes[] = {
+		{ "sqrt(x)", Complex(-4.0), Complex(), std::complex<double>(0.0, 2.0) },
+		{ "x*y", Complex(1.0, 2.0), Complex(3.0, 4.0), std::complex<double>(-5.0, 10.0) },
+		{ "x/y", Complex(1.0, 2.0), Complex(3.0, 4.0), std::complex<double>(0.44, 0.08) },
+		{ "abs(y)", Complex(), Complex(3.0, 4.0), std::complex<double>(5.0) },
+		{ "x*x-y+1", Complex(0.0, 1.0), Complex(2.0, -1.0), std::complex<double>(-2.0, 1.0) },
+		{ "x^3", Complex(1.0, 1.0), Complex(), std::complex<double>(-2.0, 2.0) },
+	};
+	for (size_t k = 0; k < sizeof(complexes) / sizeof(complexes[0]); ++k) {
+		Expression* expr = formula(complexes[k].text);
+		Complex z = evaluateAs<Complex>(expr, { { "x", complexes[k].x }, { "y", complexes[k].y } });
+		CHECK(std::abs(std::complex<double>(z.re, z.im) - complexes[k].expected) <= 4 * DBL_EPSILON * std::abs(complexes[k].expected));
+		delete expr;
+	}
+}
+
+static double foldExact(std::string const& text) {
+	Expression* expr = formula(text);
+	FoldConstantsExact fold;
+	Expression* folded = runPass("FoldConstantsExact", expr, &fold);
+	Number const* number = dynamic_cast<Number const*>(folded);
+	double value = number ? number->value() : std::numeric_limits<double>::quiet_NaN();
+	delete expr;
+	delete folded;
+	return value;
+}
+
+// точная свёртка округляет один раз, sqrt иррационального числа переводит её в double
+void testFoldConstantsExact() {
+	CHECK(foldExact("0.1+0.2-0.3") == 0x1p-55); // в double было бы 2^-54
+	CHECK(foldExact("1e16+1-1e16") == 1.0); // в double было бы 0
+	CHECK(foldExact("1/3+1/3+1/3") == 1.0);
+	CHECK(foldExact("sqrt(1/4)*2") == 1.0);
+	CHECK(foldExact("sqrt(2)*sqrt(2)") == std::sqrt(2.0) * std::sqrt(2.0));
+	CHECK(std::isnan(foldExact("0/0+1")));
+	std::mt19937_64 random(3);
+	for (int k = 0; k < 200; ++k) { // a*b - c*d: точное целое до 2^60, в double произведения округляются
+		std::int64_t v[4];
+		for (int i = 0; i < 4; ++i)
+			v[i] = static_cast<std::int64_t>(random() >> 34) - (std::int64_t(1) << 29);
+		std::string text = std::to_string(v[0]) + "*" + std::to_string(v[1]) + "-" + std::to_string(v[2]) + "*" + std::to_string(v[3]);
+		CHECK(foldExact(text) == static_cast<double>(v[0] * v[1] - v[2] * v[3]));
+	}
+}
+
+// оценка errorBound не меньше фактической ошибки double относительно long double
+void testErrorBound() {
+	char const* const texts[] = { "x*y+x/y-sqrt(y)", "(x-y)*(x+y)", "x^3-3*x+1", "hypot(x,y)*x-1",
+		"min(x,y)*max(x,1)+select(x>0,x,y)", "sum(i,1,50,x/i)", "abs(x-0.1)*1e3/y" };
+	std::map<std::string, Interval> ranges = { { "x", Interval(-2.0, 3.0) }, { "y", Interval(0.5, 4.0) } };
+	std::mt19937 random(4);
+	std::uniform_real_distribution<double> xs(-2.0, 3.0), ys(0.5, 4.0);
+	for (size_t t = 0; t < sizeof(texts) / sizeof(texts[0]); ++t) {
+		Expression* expr = formula(texts[t]);
+		ErrorBound bound = errorBound(expr, ranges);
+		CHECK(std::isfinite(bound.absolute));
+		for (int k = 0; k < 2000; ++k) {
+			double x = k ? xs(random) : -2.0, y = k ? ys(random) : 4.0;
+			double value = evaluateAs<double>(expr, { { "x", x }, { "y", y } });
+			long double exact = evaluateAs<long double>(expr, { { "x", x }, { "y", y } });
+			CHECK(std::fabs(value - exact) <= bound.absolute);
+			CHECK(bound.range.lo - bound.absolute <= value && value <= bound.range.hi + bound.absolute);
+		}
+		delete expr;
+	}
+}
+
+// сравнения, select, min и max: пакетное вычисление совпадает с построчным бит в бит,
+// в том числе для -0, NaN и одинаковых аргументов; y — и столбец, и одно значение на все строки
+void testSelectMinMax() {
+	char const* const texts[] = { "select(x<y,x,y*2)", "min(x,y)", "max(x,0)", "min(max(x,-1),1)", "select(x>=0,sqrt(x),-x)",
+		"(x==y)+(x!=y)*2+(x<=y)*4", "max(min(x,y),select(y>x,-0,0))", "min(y,0.5)*x+max(y,-1)" };
+	double const nan = std::numeric_limits<double>::quiet_NaN();
+	std::vector<double> x = { 0.0, -0.0, 1.0, -1.0, 2.5, nan, 3.0, -7.0, 0.5 }, y = { -0.0, 0.0, 1.0, nan, -2.5, 1.0, 3.0, 0.25, -0.5 };
+	std::mt19937 random(5);
+	std::uniform_real_distribution<double> value(-2.0, 2.0);
+	for (int k = 0; k < 1000; ++k) {
+		x.push_back(value(random));
+		y.push_back(k % 7 ? value(random) : x.back());
+	}
+	for (size_t t = 0; t < sizeof(texts) / sizeof(texts[0]); ++t) {
+		Expression* expr = formula(texts[t]);
+		BatchEvaluator batch(expr, 128);
+		for (int uniform = 0; uniform < 2; ++uniform) {
+			std::vector<SpanBinding> bindings = { { "x", x, 1 }, { "y", y, uniform ? 0u : 1u } };
+			std::vector<double> out(x.size());
+			std::string error;
+			CHECK(batch.evaluate(bindings, std::span<double>(out), 1, error));
+			size_t wrong = 0;
+			for (size_t r = 0; r < x.size(); ++r)
+				wrong += !sameDouble(out[r], evaluateAs<double>(expr, { { "x", x[r] }, { "y", y[uniform ? 0 : r] } }));
+			CHECK(wrong == 0);
+		}
+		delete expr;
+	}
+}
+
+// вычисление над памятью вызывающего: поля массива структур и шаги результатов дают то же, что
+// скалярное вычисление; ошибки в привязках возвращаются текстом и ничего не записывают
+void testSpanEvaluate() {
+	struct Point { double x, y, w; };
+	size_t const rows = 1000;
+	std::vector<Point> points(rows);
+	for (size_t r = 0; r < rows; ++r)
+		points[r] = Point{ r * 0.25 - 50.0, std::sin(r * 0.1), 0.0 };
+	std::span<double const> all(&points[0].x, rows * 3);
+	std::vector<SpanBinding> bindings = { { "x", all, 3 }, { "y", all.subspan(1), 3 }, { "k", std::span<double const>(&points[7].y, 1), 0 } };
+	Expression* first = formula("x*k+y");
+	Expression* second = formula("sqrt(abs(x))-y");
+	BatchEvaluator single(first, 64);
+	std::string error;
+	CHECK(single.evaluate(bindings, std::span<double>(&points[0].w, rows * 3 - 2), 3, error));
+	BatchEvaluator pair(std::vector<Expression const*>{ first, second }, 64);
+	std::vector<double> a(rows * 2, -1.0), b(rows, -1.0);
+	CHECK(pair.evaluate(bindings, rows, { { a, 2 }, { b, 1 } }, error));
+	size_t wrong = 0;
+	for (size_t r = 0; r < rows; ++r) {
+		std::map<std::string, double> row = { { "x", points[r].x }, { "y", points[r].y }, { "k", points[7].y } };
+		wrong += !sameDouble(points[r].w, evaluateAs<double>(first, row)) || !sameDouble(a[2 * r], points[r].w)
+			|| a[2 * r + 1] != -1.0 || !sameDouble(b[r], evaluateAs<double>(second, row));
+	}
+	CHECK(wrong == 0);
+
+	std::vector<double> out(rows, -1.0), values(rows, 1.0);
+	struct { std::vector<SpanBinding> bindings; size_t rows; std::vector<SpanOutput> outs; char const* message; } const rejected[] = {
+		{ { { "x", values, 1 }, { "y", values, 1 } }, rows, { { out, 1 } }, "ожидается результатов: 2, передано: 1" },
+		{ { { "x", values, 1 }, { "y", values, 1 } }, rows, { { out, 1 }, { out, 0 } }, "шаг результата должен быть больше нуля" },
+		{ { { "x", values, 1 }, { "y", values, 1 } }, rows, { { out, 1 }, { out, 2 } }, "результату 2 не хватает места для 1000 строк" },
+		{ { { "x", values, 1 }, { "y", values, 2 } }, rows, { { out, 1 }, { out, 1 } }, "переменной y не хватает значений для 1000 строк" },
+		{ { { "x", values, 1 }, { "y", std::span<double const>(), 0 } }, rows, { { out, 1 }, { out, 1 } }, "переменной y не хватает значений для 1000 строк" },
+		{ { { "x", values, 1 }, { "k", values, 0 }, { "z", values, 1 } }, rows, { { out, 1 }, { out, 1 } }, "не привязана переменная y" },
+		{ { { "x", values, 1 } }, std::numeric_limits<size_t>::max(), { { out, 1 }, { out, 1 } }, "результату 1 не хватает места для 18446744073709551615 строк" },
+	};
+	for (size_t k = 0; k < sizeof(rejected) / sizeof(rejected[0]); ++k) {
+		CHECK(!pair.evaluate(rejected[k].bindings, rejected[k].rows, rejected[k].outs, error));
+		CHECK(error == rejected[k].message);
+	}
+	CHECK(!single.evaluate(bindings, std::span<double>(out), 0, error));
+	CHECK(error == "шаг результата должен быть больше нуля");
+	CHECK(std::count(out.begin(), out.end(), -1.0) == static_cast<std::ptrdiff_t>(rows));
+	CHECK(pair.evaluate({}, 0, { { std::span<double>(), 1 }, { std::span<double>(), 1 } }, error));
+	delete first;
+	delete second;
+}
+
+// APPROX: оценка ошибки atan2 подтверждается проверкой с эталоном в long double; приближённый atan2
+// отличается от точного, в одном пакете с точной формулой не делит с ней инструкцию и даёт
+// то же, что скалярная approxAtan2, в том числе с одним значением на все строки
+void testApproxAtan2() {
+	std::ostringstream report;
+	CHECK(validateApprox(report));
+	CHECK(report.str().find("— OK") != std::string::npos);
+	Expression* expr = formula("atan2(y,x)");
+	size_t const rows = 4001;
+	std::mt19937 random(8);
+	std::uniform_real_distribution<double> value(-3.0, 3.0);
+	std::vector<double> x(rows), y(rows);
+	for (size_t r = 0; r < rows; ++r) {
+		x[r] = r % 50 != 1 ? value(random) : 0.0;
+		y[r] = r % 70 != 1 ? value(random) : -0.0;
+	}
+	BatchEvaluator both(std::vector<Expression const*>{ expr, expr }, 512, 0, false, std::vector<Precision>{ PRECISE, APPROX });
+	for (int uniform = 0; uniform < 2; ++uniform) {
+		std::vector<SpanBinding> bindings = { { "x", x, 1 }, { "y", y, uniform ? 0u : 1u } };
+		std::vector<double> precise(rows), approx(rows);
+		std::string error;
+		CHECK(both.evaluate(bindings, rows, { { precise, 1 }, { approx, 1 } }, error));
+		size_t wrong = 0, differs = 0;
+		for (size_t r = 0; r < rows; ++r) {
+			double yr = y[uniform ? 0 : r];
+			wrong += !sameDouble(precise[r], std::atan2(yr, x[r])) || !sameDouble(approx[r], approxAtan2(yr, x[r]))
+				|| !(std::fabs(approx[r] - precise[r]) <= 2 * APPROX_ATAN2_BOUND * std::fabs(precise[r]));
+			differs += !sameDouble(approx[r], precise[r]);
+		}
+		CHECK(wrong == 0);
+		CHECK(differs > 0);
+	}
+	Expression* folded = formula("atan2(0.3,-2)+x");
+	BatchEvaluator constant(folded, 64, 0, false, APPROX);
+	double const* column = x.data();
+	double out = 0;
+	constant.evaluate(&column, 1, &out);
+	CHECK(sameDouble(out, approxAtan2(0.3, -2.0) + x[0]));
+	delete expr;
+	delete folded;
+}
+
+// фиксированная точка: отчёт compare указывает на строку с наибольшей ошибкой и не меньше
+// ошибки любой строки; формулы без ограниченного результата не компилируются
+void testFixedPoint() {
+	char const* const texts[] = { "x*y+3", "(x-y)/(x*x+2)", "sqrt(abs(x))+min(x,y)", "select(x>y,x,y)-x^3/16" };
+	std::map<std::string, Interval> ranges = { { "x", Interval(-4.0, 4.0) }, { "y", Interval(-4.0, 4.0) } };
+	size_t const rows = 3001;
+	std::mt19937 random(6);
+	std::uniform_real_distribution<double> value(-4.0, 4.0);
+	std::vector<double> x(rows), y(rows);
+	for (size_t r = 0; r < rows; ++r) {
+		x[r] = value(random);
+		y[r] = value(random);
+	}
+	for (size_t t = 0; t < sizeof(texts) / sizeof(texts[0]); ++t) {
+		Expression* expr = formula(texts[t]);
+		FixedPointEvaluator fixed;
+		std::string error;
+		CHECK(fixed.compile(expr, ranges, error));
+		std::vector<double const*> columns;
+		for (size_t i = 0; i < fixed.inputs().size(); ++i)
+			columns.push_back(fixed.inputs()[i] == "x" ? x.data() : y.data());
+		FixedPointEvaluator::Error report = fixed.compare(columns.data(), rows);
+		double step = std::ldexp(1.0, -fixed.outputFraction());
+		CHECK(report.row < rows && report.absolute < 64 * step && report.absolute < 1e-4);
+		double worst = 0.0;
+		for (size_t r = 0; r < rows; ++r) {
+			std::int32_t in[2] = {}, out = 0;
+			std::int32_t const* pointers[2] = { &in[0], &in[1] };
+			for (size_t i = 0; i < fixed.inputs().size(); ++i)
+				in[i] = FixedPointEvaluator::toFixed(columns[i][r], fixed.inputFraction(i));
+			fixed.evaluate(pointers, 1, &out);
+			double error = std::fabs(FixedPointEvaluator::toDouble(out, fixed.outputFraction()) - evaluateAs<double>(expr, { { "x", x[r] }, { "y", y[r] } }));
+			CHECK(error <= report.absolute);
+			if (r == report.row)
+				CHECK(error == report.absolute);
+			worst = error > worst ? error : worst;
+		}
+		CHECK(worst == report.absolute);
+		delete expr;
+	}
+	struct { char const* text; char const* message; } const rejected[] = {
+		{ "x/y", "делитель может быть равен нулю — частное не ограничено" },
+		{ "pow(x,y)", "функция pow не поддерживается в фиксированной точке" },
+		{ "x+z", "не задан диапазон переменной z" },
+		{ "sqrt(-abs(x)-1)", "корень из отрицательного диапазона" },
+	};
+	for (size_t k = 0; k < sizeof(rejected) / sizeof(rejected[0]); ++k) {
+		Expression* expr = formula(rejected[k].text);
+		FixedPointEvaluator fixed;
+		std::string error;
+		CHECK(!fixed.compile(expr, ranges, error));
+		CHECK(error == rejected[k].message);
+		delete expr;
+	}
+}
+
+struct Detached { // сопрограмма без результата: начинается сразу, кадр освобождается по завершении
+	struct promise_type {
+		Detached get_return_object() { return Detached(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+static Detached request(EvalEngine& engine, int formula, BindingsBatch const& batch, EvalStatus& status, std::atomic<int>& done) {
+	status = co_await engine.evaluate(formula, batch);
+	done.fetch_add(1);
+}
+
+static void waitFor(std::atomic<int> const& done, int count) {
+	while (done.load() < count)
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+static BindingsBatch engineBatch(EvalEngine const& engine, int formula, std::map<std::string, double const*> const& columns, size_t rows, double* out) {
+	BindingsBatch batch;
+	std::vector<std::string> inputs = engine.inputs(formula);
+	for (size_t i = 0; i < inputs.size(); ++i)
+		batch.columns.push_back(columns.at(inputs[i]));
+	batch.rows = rows;
+	batch.out = out;
+	return batch;
+}
+
+// EvalEngine через co_await: результаты совпадают со скалярными; отменённый и просроченный запросы
+// не ждут долгого запроса впереди; разрушение движка продолжает каждую ждущую сопрограмму один раз
+void testEvalEngine() {
+	Expression* expr = formula("x*2+y");
+	Expression* slow = formula("pow(x,0.3)+sqrt(x)*x");
+	size_t const rows = 10000;
+	std::mt19937 random(7);
+	std::uniform_real_distribution<double> value(-8.0, 8.0);
+	std::vector<double> x(rows), y(rows);
+	for (size_t r = 0; r < rows; ++r) {
+		x[r] = value(random);
+		y[r] = value(random);
+	}
+	std::map<std::string, double const*> columns = { { "x", x.data() }, { "y", y.data() } };
+	std::vector<double> big(size_t(1) << 22, 2.0), bigOut(big.size());
+	std::map<std::string, double const*> bigColumns = { { "x", big.data() } };
+	double const nan = std::numeric_limits<double>::quiet_NaN();
+	{
+		EvalEngine engine(4, 512);
+		int f = engine.addFormula(expr);
+		size_t const count = 8;
+		std::vector<std::vector<double> > outs(count, std::vector<double>(rows, nan));
+		std::vector<BindingsBatch> batches;
+		for (size_t i = 0; i < count; ++i)
+			batches.push_back(engineBatch(engine, f, columns, rows - i * 1000, outs[i].data()));
+		std::vector<EvalStatus> statuses(count, EVAL_CANCELLED);
+		std::atomic<int> done(0);
+		for (size_t i = 0; i < count; ++i)
+			request(engine, f, batches[i], statuses[i], done);
+		waitFor(done, static_cast<int>(count));
+		for (size_t i = 0; i < count; ++i) {
+			CHECK(statuses[i] == EVAL_OK);
+			size_t wrong = 0;
+			for (size_t r = 0; r < rows; ++r)
+				wrong += !sameDouble(outs[i][r], r < batches[i].rows ? evaluateAs<double>(expr, { { "x", x[r] }, { "y", y[r] } }) : nan);
+			CHECK(wrong == 0);
+		}
+	}
+	{
+		EvalEngine engine(1);
+		int fs = engine.addFormula(slow), f = engine.addFormula(expr);
+		BindingsBatch longBatch = engineBatch(engine, fs, bigColumns, big.size(), bigOut.data());
+		EvalStatus longStatus = EVAL_OK;
+		std::atomic<int> longDone(0), done(0);
+		request(engine, fs, longBatch, longStatus, longDone);
+		std::vector<double> cancelledOut(rows, nan), expiredOut(rows, nan);
+		BindingsBatch cancelled = engineBatch(engine, f, columns, rows, cancelledOut.data());
+		BindingsBatch expired = engineBatch(engine, f, columns, rows, expiredOut.data());
+		expired.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(5);
+		EvalStatus cancelledStatus = EVAL_OK, expiredStatus = EVAL_OK;
+		request(engine, f, cancelled, cancelledStatus, done);
+		request(engine, f, expired, expiredStatus, done);
+		cancelled.cancel.cancel();
+		waitFor(done, 2);
+		CHECK(longDone.load() == 0);
+		CHECK(cancelledStatus == EVAL_CANCELLED);
+		CHECK(expiredStatus == EVAL_DEADLINE_EXCEEDED);
+		CHECK(std::isnan(cancelledOut[0]) && std::isnan(expiredOut[0]));
+		longBatch.cancel.cancel();
+		waitFor(longDone, 1);
+		CHECK(longStatus == EVAL_CANCELLED);
+	}
+	{
+		size_t const count = 64;
+		std::vector<std::vector<double> > outs(count, std::vector<double>(rows, nan));
+		std::vector<BindingsBatch> batches;
+		std::vector<EvalStatus> statuses(count, EVAL_OK);
+		EvalStatus longStatus = EVAL_OK;
+		std::atomic<int> longDone(0), done(0);
+		BindingsBatch longBatch;
+		{
+			EvalEngine engine(1);
+			int fs = engine.addFormula(slow), f = engine.addFormula(expr);
+			longBatch = engineBatch(engine, fs, bigColumns, big.size(), bigOut.data());
+			request(engine, fs, longBatch, longStatus, longDone);
+			for (size_t i = 0; i < count; ++i)
+				batches.push_back(engineBatch(engine, f, columns, rows, outs[i].data()));
+			for (size_t i = 0; i < count; ++i)
+				request(engine, f, batches[i], statuses[i], done);
+		}
+		CHECK(longDone.load() == 1 && done.load() == static_cast<int>(count));
+		CHECK(longStatus == EVAL_CANCELLED);
+		CHECK(std::count(statuses.begin(), statuses.end(), EVAL_CANCELLED) == static_cast<std::ptrdiff_t>(count));
+	}
+	delete expr;
+	delete slow;
+}
+
+int main() {
+	testCsv();
+	testColumnFile();
+	testColumnFileHeader();
+	testAsyncIO();
+	testScalarTypes();
+	testFoldConstantsExact();
+	testErrorBound();
+	testSelectMinMax();
+	testSpanEvaluate();
+	testApproxAtan2();
+	testFixedPoint();
+	testEvalEngine();
+	std::cout << "проверок: " << checks << ", не прошло: " << failures << std::endl;
+	return failures ? 1 : 0;
+}